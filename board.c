@@ -732,6 +732,8 @@ board_remove_stone(struct board *board, group_t group, coord_t c, struct board_u
 	group_at(board, c) = 0;
 	if (!u)
 		board_hash_update(board, c, color);
+	else
+		board->hash ^= hash_at(board, c, color);
 
 	/* Increase liberties of surrounding groups */
 	coord_t coord = c;
@@ -1031,7 +1033,8 @@ board_play_outside(struct board *board, struct move *m, int f, struct board_undo
 	if (!u) {
 		board_hash_update(board, coord, color);
 		board_symmetry_update(board, &board->symmetry, coord);
-	}
+	} else
+		board->hash ^= hash_at(board, coord, color);
 	struct move ko = { pass, S_NONE };
 	board->ko = ko;
 
@@ -1125,7 +1128,8 @@ board_play_in_eye(struct board *board, struct move *m, int f, struct board_undo
 		board_hash_update(board, coord, color);
 		board_hash_commit(board);
 		board_symmetry_update(board, &board->symmetry, coord);
-	}
+	} else
+		board->hash ^= hash_at(board, coord, color);
 	board->ko = ko;
 
 	return !!group;
@@ -1162,6 +1166,7 @@ undo_init(struct board *b, struct move *m, struct board_undo *u)
 	u->ko = b->ko;
 	u->last_ko = b->last_ko;
 	u->last_ko_age = b->last_ko_age;
+	u->hash = b->hash;
 	u->captures = 0;
 	
 	u->nmerged = u->nmerged_tmp = u->nenemies = 0;
@@ -1418,6 +1423,7 @@ board_quick_undo(struct board *b, struct move *m, struct board_undo *u)
 		board_undo_suicide(b, u, m);
 	else
 		assert(0);	/* Anything else doesn't make sense */
+	b->hash = u->hash;
 }
 
 
@@ -269,9 +269,10 @@ FB_ONLY(int last_ko_age);
 #define history_hash_prev(i) ((i - 1) & history_hash_mask)
 #define history_hash_next(i) ((i + 1) & history_hash_mask)
 FB_ONLY(hash_t history_hash)[1 << history_hash_bits];
-	/* Hash of current board position. */
+	/* Hash of current board position.
+	 * Also kept up-to-date by quick_play() / quick_undo(). */
     /*当前板位置的哈希。*/
-FB_ONLY(hash_t hash);
+	hash_t hash;
 	/* Hash of current board position quadrants. */
     /*当前板位置象限哈希*/
 FB_ONLY(hash_t qhash)[4];
@@ -294,6 +295,7 @@ struct board_undo {
 	struct move ko;
 	struct move last_ko;
 	int	    last_ko_age;
+	hash_t      hash;
 	
 	coord_t next_at;
 	
@@ -454,7 +456,8 @@ bool board_set_rules(struct board *board, char *name);
  *
  * Currently this means these can't be used:
  *   - incremental patterns (pat3)
- *   - hashes, superko_violation (spathash, hash, qhash, history_hash)
+ *   - superko_violation, hashes other than the board hash
+ *     (spathash, qhash, history_hash)
  *   - list of free positions (f / flen)
  *   - list of capturable groups (c / clen)
  *   - traits (btraits, t, tq, tqlen)
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+
+#include <stdint.h>
 
 #define CPU_ONLY 1
 #include <caffe/caffe.hpp>
@@ -15,8 +18,15 @@ using namespace caffe;
 extern "C" {
 #include "debug.h"
 #include "util.h"
+#include "dcnn_int8.h"
 //调用py的代码
 static shared_ptr<Net<float> > net;
+/* The net is shared by the main thread and the dcnn queue thread. */
+static pthread_mutex_t net_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Calibration: max input activation of each layer, if calibrating. */
+static bool calibrating = false;
+static vector<float> calib_max;
 
 /* Make caffe quiet */
 void
@@ -59,23 +69,132 @@ caffe_init()
 }	
 
 
+static void
+calibrate_update()
+{
+	const vector<shared_ptr<Layer<float> > >& layers = net->layers();
+	const vector<vector<Blob<float>*> >& bottoms = net->bottom_vecs();
+	if (calib_max.empty())
+		calib_max.resize(layers.size(), 0);
+
+	/* ReLUs are done in place, so conv inputs are what we want here. */
+	for (size_t i = 0; i < layers.size(); i++) {
+		if (strcmp(layers[i]->type(), "Convolution"))
+			continue;
+		Blob<float> *in = bottoms[i][0];
+		const float *d = in->cpu_data();
+		for (int j = 0; j < in->count(); j++)
+			if (fabs(d[j]) > calib_max[i])
+				calib_max[i] = fabs(d[j]);
+	}
+}
+
+void
+caffe_calibrate_start()
+{
+	calibrating = true;
+}
+
+void
+caffe_write_int8(char *filename)
+{
+	assert(net);
+	if (calib_max.empty())
+		die("dcnn: no calibration data, can't quantize network\n");
+
+	const vector<shared_ptr<Layer<float> > >& layers = net->layers();
+	int nconv = 0;
+	for (size_t i = 0; i < layers.size(); i++) {
+		const char *type = layers[i]->type();
+		if (!strcmp(type, "Convolution"))
+			nconv++;
+		else if (strcmp(type, "ReLU") && strcmp(type, "Flatten") &&
+			 strcmp(type, "Softmax") && strcmp(type, "Input"))
+			die("dcnn: can't quantize layer type %s\n", type);
+	}
+
+	FILE *f = fopen(filename, "wb");
+	if (!f)  fail(filename);
+	int32_t hdr[3] = { Q8_VERSION, 19, nconv };
+	fwrite(Q8_MAGIC, 8, 1, f);
+	fwrite(hdr, sizeof(hdr), 1, f);
+
+	for (size_t i = 0; i < layers.size(); i++) {
+		if (strcmp(layers[i]->type(), "Convolution"))
+			continue;
+		const ConvolutionParameter &cp = layers[i]->layer_param().convolution_param();
+		Blob<float> *wb = layers[i]->blobs()[0].get();
+		int cout = wb->shape(0), cin = wb->shape(1), k = wb->shape(2);
+		int pad = (cp.pad_size() ? cp.pad(0) : 0);
+		bool relu = (i + 1 < layers.size() && !strcmp(layers[i + 1]->type(), "ReLU"));
+		float in_scale = (calib_max[i] > 0 ? calib_max[i] / 255 : 1.0 / 255);
+		int32_t lh[5] = { k, pad, cin, cout, relu };
+		fwrite(lh, sizeof(lh), 1, f);
+		fwrite(&in_scale, sizeof(float), 1, f);
+
+		/* Per output channel symmetric quantization,
+		 * caffe [cout][cin][k][k] -> [cout][k][k][cin] */
+		const float *w = wb->cpu_data();
+		vector<float> wscale(cout), bias(cout, 0);
+		vector<int8_t> q(cout * k * k * cin);
+		for (int co = 0; co < cout; co++) {
+			float amax = 0;
+			for (int j = 0; j < cin * k * k; j++)
+				amax = std::max(amax, (float)fabs(w[co * cin * k * k + j]));
+			wscale[co] = (amax > 0 ? amax / 127 : 1.0);
+			for (int ci = 0; ci < cin; ci++)
+			for (int ky = 0; ky < k; ky++)
+			for (int kx = 0; kx < k; kx++) {
+				float v = w[((co * cin + ci) * k + ky) * k + kx];
+				q[((co * k + ky) * k + kx) * cin + ci] = (int8_t)lrintf(v / wscale[co]);
+			}
+		}
+		if (cp.bias_term())
+			for (int co = 0; co < cout; co++)
+				bias[co] = layers[i]->blobs()[1]->cpu_data()[co];
+
+		fwrite(&wscale[0], sizeof(float), cout, f);
+		fwrite(&bias[0], sizeof(float), cout, f);
+		fwrite(&q[0], 1, q.size(), f);
+		if (DEBUGL(2))
+			fprintf(stderr, "dcnn quantize: conv %dx%d %d -> %d, input range %.3f\n",
+				k, k, cin, cout, calib_max[i]);
+	}
+	fclose(f);
+	if (DEBUGL(1))
+		fprintf(stderr, "Wrote int8 dcnn to %s\n", filename);
+}
+
 void
 caffe_get_data(float *data, float *result, int planes, int size)
 {
-	Blob<float> *blob = new Blob<float>(1, planes, size, size);
-	blob->set_cpu_data(data);
-	vector<Blob<float>*> bottom;
-	bottom.push_back(blob);
+	caffe_get_data_batch(data, result, 1, planes, size);
+}
+
+void
+caffe_get_data_batch(float *data, float *result, int n, int planes, int size)
+{
 	assert(net);
-	const vector<Blob<float>*>& rr = net->Forward(bottom);
+	pthread_mutex_lock(&net_lock);
+
+	/* Resize input layer to the batch size if needed. */
+	Blob<float> *input = net->input_blobs()[0];
+	if (input->num() != n) {
+		input->Reshape(n, planes, size, size);
+		net->Reshape();
+	}
+	memcpy(input->mutable_cpu_data(), data, n * planes * size * size * sizeof(float));
+	const vector<Blob<float>*>& rr = net->Forward();
+	if (calibrating)
+		calibrate_update();
 	
-	for (int i = 0; i < 19 * 19; i++) {
+	for (int i = 0; i < n * size * size; i++) {
 		result[i] = rr[0]->cpu_data()[i];
 		if (result[i] < 0.00001)
 			result[i] = 0.00001;
 	}
-	
-	delete blob;	
+
+	pthread_mutex_unlock(&net_lock);
 }
 
 	
@@ -10,6 +10,13 @@ extern "C" {
 bool caffe_ready();
 void caffe_init();
 void caffe_get_data(float *data, float *result, int planes, int size);
+/* Run @n positions through the network at once. */
+void caffe_get_data_batch(float *data, float *result, int n, int planes, int size);
+
+/* Quantization: record activation ranges on every evaluation from now
+ * on, then write int8 version of the network (see dcnn_int8.h). */
+void caffe_calibrate_start();
+void caffe_write_int8(char *filename);
 
 #ifdef DCNN
 void quiet_caffe(int argc, char *argv[]);
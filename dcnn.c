@@ -8,37 +8,104 @@
 #include "uct/tree.h"
 #include "caffe.h"
 #include "dcnn.h"
+#include "dcnn_int8.h"
+#include "poscache.h"
 #include "timeinfo.h"
 
 static bool dcnn_enabled = true;
 void disable_dcnn()     {  dcnn_enabled = false;  }
 
+static bool int8 = false;
+static bool calibration = false;
+void dcnn_use_int8()         {  int8 = true;  }
+void dcnn_use_calibration()  {  calibration = true;  }
+
+/* Int8 network, if in use. */
+static struct q8_net *q8net = NULL;
+
 /* Time spent in dcnn code */
 double dcnn_time = 0;
 double get_dcnn_time()  {  return dcnn_time;  }
 void reset_dcnn_time()  {  dcnn_time = 0;  }
 
+bool
+dcnn_ready()
+{
+	return (dcnn_enabled && (q8net || caffe_ready()));
+}
+
 bool
 using_dcnn(struct board *b)
 {
-	return (dcnn_enabled && real_board_size(b) == 19 && caffe_ready());
+	return (real_board_size(b) == 19 && dcnn_ready());
+}
+
+/* Number of positions kept in dcnn cache (~750 bytes each). */
+#define DCNN_CACHE_SIZE 8192
+static struct poscache *dcnn_cache = NULL;
+
+static void
+dcnn_calibration_done()
+{
+	caffe_write_int8("golast.int8");
 }
 
 void
 dcnn_init()
 {
-	if (dcnn_enabled)  caffe_init();
+	if (!dcnn_enabled)  return;
+
+	if (int8 && !calibration && !q8net) {
+		char filename[256];  get_data_file(filename, "golast.int8");
+		q8net = q8_net_load(filename);
+		if (!q8net && DEBUGL(1))
+			fprintf(stderr, "No int8 dcnn found, using regular one.\n");
+	}
+	if (!q8net)
+		caffe_init();
+
+	static bool calibrating = false;
+	if (calibration && caffe_ready() && !calibrating) {
+		calibrating = true;
+		caffe_calibrate_start();
+		atexit(dcnn_calibration_done);
+	}
+
+	if (dcnn_ready() && !dcnn_cache)
+		dcnn_cache = poscache_init(DCNN_CACHE_SIZE, 19 * 19);
+}
+
+hash_t
+dcnn_cache_key(struct board *b, enum stone color)
+{
+	/* Network looks at the last 4 moves. */
+	return poscache_key(b, color, 4);
+}
+
+bool
+dcnn_cache_get(hash_t key, float result[])
+{
+	return dcnn_cache && poscache_get(dcnn_cache, key, result);
 }
 
 void
-dcnn_get_moves(struct board *b, enum stone color, float result[])
+dcnn_cache_put(hash_t key, float result[])
+{
+	if (dcnn_cache)  poscache_put(dcnn_cache, key, result);
+}
+
+void
+dcnn_print_cache_stats()
+{
+	if (dcnn_cache)  poscache_print_stats(dcnn_cache, "dcnn");
+}
+
+void
+dcnn_board_planes(struct board *b, enum stone color, float data[])
 {
-	double time_start = time_now();
 	assert(real_board_size(b) == 19);
 
-	int dsize = 13 * 19 * 19;
-	float *data = malloc(dsize * sizeof(float));
-	for (int i = 0; i < dsize; i++)  /* memset() not recommended for floats */
+	for (int i = 0; i < DCNN_DATA_SIZE; i++)  /* memset() not recommended for floats */
 		data[i] = 0;
 
 	for (int x = 0; x < 19; x++)
@@ -66,14 +133,43 @@ dcnn_get_moves(struct board *b, enum stone color, float result[])
 		else if (c == b->last_move4.coord)
 			data[12*19*19 + p] = 1.0;
 	}
+}
 
-	caffe_get_data(data, result, 13, 19);
+void
+dcnn_get_moves(struct board *b, enum stone color, float result[])
+{
+	hash_t key = dcnn_cache_key(b, color);
+	if (dcnn_cache_get(key, result))
+		return;
+
+	double time_start = time_now();
+
+	float *data = malloc(DCNN_DATA_SIZE * sizeof(float));
+	dcnn_board_planes(b, color, data);
+
+	if (q8net)
+		q8_net_forward(q8net, data, result, DCNN_PLANES);
+	else
+		caffe_get_data(data, result, DCNN_PLANES, 19);
 	free(data);
+	dcnn_cache_put(key, result);
 	double elapsed = time_now() - time_start;
 	if (DEBUGL(2))  fprintf(stderr, "dcnn in %.2fs\n", elapsed);
 	dcnn_time += elapsed;
 }
 
+/* Batched evaluation doesn't count towards dcnn_time: it runs in the
+ * background while the search goes on. */
+void
+dcnn_get_moves_batch(float data[], float result[], int n)
+{
+	if (q8net) {
+		for (int i = 0; i < n; i++)
+			q8_net_forward(q8net, &data[i * DCNN_DATA_SIZE], &result[i * 19 * 19], DCNN_PLANES);
+		return;
+	}
+	caffe_get_data_batch(data, result, n, DCNN_PLANES, 19);
+}
 
 void
 find_dcnn_best_moves(struct board *b, float *r, coord_t *best_c, float *best_r, int nbest)
@@ -6,11 +6,26 @@
 
 #define DCNN_BEST_N 20
 
+/* Number of input planes of the network (see dcnn_board_planes()). */
+#define DCNN_PLANES 13
+#define DCNN_DATA_SIZE  (DCNN_PLANES * 19 * 19)
+
 /* Don't try to load dcnn. */
 void disable_dcnn();
+/* Use int8 version of the network (golast.int8) if present. */
+void dcnn_use_int8();
+/* Record activation ranges while running, and write golast.int8
+ * on exit. */
+void dcnn_use_calibration();
 
 void dcnn_get_moves(struct board *b, enum stone color, float result[]);
+/* Fill @data (DCNN_DATA_SIZE floats) with the network input for @b. */
+void dcnn_board_planes(struct board *b, enum stone color, float data[]);
+/* Evaluate @n positions prepared by dcnn_board_planes() in one forward
+ * pass; @result receives n * 19 * 19 move probabilities. */
+void dcnn_get_moves_batch(float data[], float result[], int n);
 bool using_dcnn(struct board *b);
+bool dcnn_ready();
 void dcnn_init();
 void find_dcnn_best_moves(struct board *b, float *r, coord_t *best_c, float *best_r, int nbest);
 void print_dcnn_best_moves(struct board *b, coord_t *best_c, float *best_r, int nbest);
@@ -19,6 +34,12 @@ void print_dcnn_best_moves(struct board *b, coord_t *best_c, float *best_r, int
 double get_dcnn_time();
 void reset_dcnn_time();
 
+/* Cache of dcnn results, dcnn_get_moves() uses it already. */
+hash_t dcnn_cache_key(struct board *b, enum stone color);
+bool dcnn_cache_get(hash_t key, float result[]);
+void dcnn_cache_put(hash_t key, float result[]);
+void dcnn_print_cache_stats();
+
 /* Convert board coord to dcnn data index */
 static inline int coord2dcnn_idx(coord_t c, struct board *b);
 
@@ -36,10 +57,13 @@ coord2dcnn_idx(coord_t c, struct board *b)
 
 
 #define disable_dcnn()
+#define dcnn_use_int8()
+#define dcnn_use_calibration()
 #define using_dcnn(b)  0
 #define dcnn_init()
 #define get_dcnn_time()    (0.)
 #define reset_dcnn_time()  do { } while(0)
+#define dcnn_print_cache_stats()  do { } while(0)
 
 
 #endif
@@ -0,0 +1,203 @@
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEBUG
+#include "debug.h"
+#include "util.h"
+#include "dcnn_int8.h"
+
+
+static void
+q8_read(void *buf, size_t size, FILE *f, char *filename)
+{
+	if (fread(buf, size, 1, f) != 1)
+		die("%s: truncated file\n", filename);
+}
+
+struct q8_net *
+q8_net_load(char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)  return NULL;
+
+	char magic[8];
+	int32_t hdr[3];
+	q8_read(magic, sizeof(magic), f, filename);
+	q8_read(hdr, sizeof(hdr), f, filename);
+	if (memcmp(magic, Q8_MAGIC, sizeof(magic)) || hdr[0] != Q8_VERSION)
+		die("%s: not a pachi int8 network (or wrong version)\n", filename);
+
+	struct q8_net *net = calloc2(1, sizeof(*net));
+	net->size = hdr[1];
+	net->nlayers = hdr[2];
+	net->layers = calloc2(net->nlayers, sizeof(*net->layers));
+	for (int i = 0; i < net->nlayers; i++) {
+		struct q8_layer *l = &net->layers[i];
+		int32_t lh[5];
+		q8_read(lh, sizeof(lh), f, filename);
+		l->k = lh[0];  l->pad = lh[1];  l->cin = lh[2];  l->cout = lh[3];  l->relu = lh[4];
+		q8_read(&l->in_scale, sizeof(float), f, filename);
+
+		l->wscale = malloc2(l->cout * sizeof(float));
+		l->bias = malloc2(l->cout * sizeof(float));
+		l->w = malloc2(l->cout * l->k * l->k * l->cin);
+		q8_read(l->wscale, l->cout * sizeof(float), f, filename);
+		q8_read(l->bias, l->cout * sizeof(float), f, filename);
+		q8_read(l->w, l->cout * l->k * l->k * l->cin, f, filename);
+
+		/* Activations are unsigned: everything but the output
+		 * must go through ReLU. */
+		if (i > 0 && l->cin != net->layers[i-1].cout)
+			die("%s: layer %i: channel mismatch\n", filename, i);
+		if (i < net->nlayers - 1 && !l->relu)
+			die("%s: layer %i: unsupported network (no relu)\n", filename, i);
+		if (2 * l->pad != l->k - 1)
+			die("%s: layer %i: unsupported padding\n", filename, i);
+		if (l->pad > net->maxpad)  net->maxpad = l->pad;
+		if (l->cin > net->maxc)    net->maxc = l->cin;
+		if (l->cout > net->maxc)   net->maxc = l->cout;
+	}
+	fclose(f);
+
+	if (net->layers[net->nlayers - 1].cout != 1)
+		die("%s: unsupported network (output must be a single plane)\n", filename);
+	if (DEBUGL(2))
+		fprintf(stderr, "Loaded int8 dcnn (%i layers)\n", net->nlayers);
+	return net;
+}
+
+void
+q8_net_done(struct q8_net *net)
+{
+	for (int i = 0; i < net->nlayers; i++) {
+		free(net->layers[i].wscale);
+		free(net->layers[i].bias);
+		free(net->layers[i].w);
+	}
+	free(net->layers);
+	free(net);
+}
+
+/* Activation buffers of a thread: several threads may run the network
+ * at once (uct threads, t-predict workers). Allocated on first use and
+ * kept until the thread exits. The padding border is zeroed here and
+ * never written by q8_net_forward(). */
+struct q8_scratch {
+	struct q8_net *net;
+	size_t size;
+	uint8_t *act, *next;
+};
+
+static pthread_key_t q8_scratch_key;
+static pthread_once_t q8_scratch_once = PTHREAD_ONCE_INIT;
+
+static void
+q8_scratch_free(void *data)
+{
+	struct q8_scratch *sc = data;
+	free(sc->act);
+	free(sc->next);
+	free(sc);
+}
+
+static void
+q8_scratch_key_init(void)
+{
+	pthread_key_create(&q8_scratch_key, q8_scratch_free);
+}
+
+static struct q8_scratch *
+q8_scratch(struct q8_net *net, size_t size)
+{
+	pthread_once(&q8_scratch_once, q8_scratch_key_init);
+	struct q8_scratch *sc = pthread_getspecific(q8_scratch_key);
+	if (!sc) {
+		sc = calloc2(1, sizeof(*sc));
+		pthread_setspecific(q8_scratch_key, sc);
+	}
+	if (sc->net != net || sc->size != size) {
+		free(sc->act);
+		free(sc->next);
+		sc->net = net;
+		sc->size = size;
+		sc->act = calloc2(size, 1);
+		sc->next = calloc2(size, 1);
+	}
+	return sc;
+}
+
+static inline uint8_t
+q8_quantize(float v, float scale)
+{
+	int q = (int)(v / scale + 0.5);
+	return (q < 0 ? 0 : q > 255 ? 255 : q);
+}
+
+/* u8 x s8 dot product, the hot loop. */
+static inline int32_t
+q8_dot(const uint8_t *restrict a, const int8_t *restrict w, int n)
+{
+	int32_t sum = 0;
+	for (int i = 0; i < n; i++)
+		sum += (int32_t)a[i] * (int32_t)w[i];
+	return sum;
+}
+
+void
+q8_net_forward(struct q8_net *net, float *data, float *result, int planes)
+{
+	int s = net->size, P = net->maxpad, W = s + 2 * P, C = net->maxc;
+	/* Activations are kept channel-last with a zero border
+	 * for the padding. */
+	struct q8_scratch *sc = q8_scratch(net, W * W * C);
+	uint8_t *act = sc->act, *next = sc->next;
+	float out[s * s];
+#define ACT(a, y, x)  (&(a)[(((y) + P) * W + (x) + P) * C])
+
+	struct q8_layer *l = &net->layers[0];
+	assert(planes == l->cin);
+	for (int c = 0; c < planes; c++)
+		for (int y = 0; y < s; y++)
+			for (int x = 0; x < s; x++)
+				ACT(act, y, x)[c] = q8_quantize(data[(c * s + y) * s + x], l->in_scale);
+
+	for (int i = 0; i < net->nlayers; i++) {
+		l = &net->layers[i];
+		struct q8_layer *nl = (i < net->nlayers - 1 ? &net->layers[i + 1] : NULL);
+		int kk = l->k * l->k * l->cin;
+
+		for (int y = 0; y < s; y++)
+		for (int x = 0; x < s; x++)
+			for (int co = 0; co < l->cout; co++) {
+				int8_t *w = &l->w[co * kk];
+				int32_t acc = 0;
+				for (int ky = 0; ky < l->k; ky++)
+					for (int kx = 0; kx < l->k; kx++, w += l->cin)
+						acc += q8_dot(ACT(act, y + ky - l->pad, x + kx - l->pad), w, l->cin);
+
+				float v = acc * l->in_scale * l->wscale[co] + l->bias[co];
+				if (l->relu && v < 0)  v = 0;
+				if (nl)  ACT(next, y, x)[co] = q8_quantize(v, nl->in_scale);
+				else     out[y * s + x] = v;
+			}
+
+		uint8_t *tmp = act;  act = next;  next = tmp;
+	}
+#undef ACT
+
+	/* Softmax */
+	float max = out[0], sum = 0;
+	for (int i = 1; i < s * s; i++)
+		if (out[i] > max)  max = out[i];
+	for (int i = 0; i < s * s; i++)
+		sum += (result[i] = expf(out[i] - max));
+	for (int i = 0; i < s * s; i++) {
+		result[i] /= sum;
+		if (result[i] < 0.00001)
+			result[i] = 0.00001;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef PACHI_DCNN_INT8_H
+#define PACHI_DCNN_INT8_H
+
+/* Reduced precision (int8) inference for the dcnn policy network. */
+
+/* Weights are quantized offline per output channel, activations per
+ * layer using ranges recorded while running the fp32 network on real
+ * positions (pachi --dcnn-calibrate, see caffe_write_int8()). Inference
+ * then works on uint8 activations x int8 weights with int32
+ * accumulation, the layout being channel-last so the inner loop is a
+ * plain dot product. gcc -O3 turns it into vpdpbusd for CPUs with VNNI
+ * (default -march=native build), without VNNI the code it generates is
+ * slower than caffe's fp32 path.
+ * Only plain stacks of convolutions (+ ReLU) followed by a softmax
+ * over the board are supported, which is what golast19 is. */
+
+#include <stdint.h>
+
+#define Q8_MAGIC "PACHIQ8\n"
+#define Q8_VERSION 1
+
+struct q8_layer {
+	int k, pad;		/* Kernel size, padding */
+	int cin, cout;
+	bool relu;
+	float in_scale;		/* Input activation = q * in_scale */
+	float *wscale;		/* [cout] weight = q * wscale */
+	float *bias;		/* [cout] */
+	int8_t *w;		/* [cout][k][k][cin] */
+};
+
+struct q8_net {
+	int size;		/* Board size (19) */
+	int nlayers;
+	struct q8_layer *layers;
+	int maxpad, maxc;
+};
+
+/* Load int8 network, NULL if file can't be found. */
+struct q8_net *q8_net_load(char *filename);
+void q8_net_done(struct q8_net *net);
+
+/* Same interface as caffe_get_data(): @data holds network input
+ * planes (NCHW), @result receives size * size move probabilities. */
+void q8_net_forward(struct q8_net *net, float *data, float *result, int planes);
+
+#endif
@@ -25,8 +25,9 @@
  * also has a temporary hash table to map received coord paths
  * to tree nodes; the hash table is cleared at each new move.
  * The master remembers stats in a queue of received buffers that
- * are merged together, plus one hash table per slave. The master
- * queue and the hash tables are cleared at each new move. */
+ * are tallied once into a shared table of totals, plus one hash table
+ * per slave of what the slave already knows. The master queue and the
+ * hash tables are cleared at each new move. */
 
 /* To allow the master to select the best move, slaves also send
  * absolute playout counts for the best top level nodes (children
@@ -40,13 +41,47 @@
 /* The master-slave protocol has fault tolerance. If a slave is
  * out of sync, the master sends it the appropriate command history. */
 
+/* Large clusters can be organized as a tree of relays to bound the
+ * fan-in and bandwidth of each master. A relay is a distributed engine
+ * connected with -g to its parent master, which sees it as one slave.
+ * The relay forwards the gtp commands to its own slaves. For genmoves,
+ * the stats from the parent go to the receive queue like those of any
+ * slave, and the parent gets in reply the merged increments of all
+ * slaves below the relay, plus the children of the root averaged as by
+ * select_best_move(). All processes of the tree must use the same
+ * shared_nodes and node_keys. */
+
 /* Pass me arguments like a=b,c=d,...
  * Supported arguments:
  * slave_port=SLAVE_PORT     slaves connect to this port; this parameter is mandatory.
  * max_slaves=MAX_SLAVES     default 24
+ * merge_threads=N           threads merging stats for the slaves, default 4.
+ *                           The shared stats table has one partition per thread.
  * shared_nodes=SHARED_NODES default 10K
  * stats_hbits=STATS_HBITS   default 21. 2^stats_bits = hash table size
+ * node_keys=path|hash       keys of shared nodes, default path. hash shares
+ *                           nodes at any depth and merges transpositions, but
+ *                           slaves find only the nodes they already reported
+ *                           (see distributed.h), so path shares more stats.
+ * wire=raw|packed|lz4       best format of the binary stats offered to the
+ *                           slaves, default lz4 if built with LZ4=1, else packed.
+ * shm=0|1                   binary args through shared memory for slaves on
+ *                           the same host (connecting to 127.x), default true.
+ *                           9x9, 20k games/move, shared_levels=3, 1 cpu
+ *                           (games/s, socket KB/s, master ms/iter, off -> on):
+ *                             1 slave:  6.6k -> 7.3k,  16 -> 1,  0.15 -> 0.42
+ *                             2 slaves: 6.7k -> 7.6k,  29 -> 6,  0.14 -> 0.34
+ *                             4 slaves: 7.5k -> 7.1k,  70 -> 18, 0.13 -> 0.27
+ *                             8 slaves: 7.0k -> 7.2k, 150 -> 47, 0.19 -> 0.38
+ *                           So it saves socket traffic, not playouts.
  * slaves_quit=0|1           quit gtp command also sent to slaves, default false.
+ * balance=0|1               give each slave a share of the root children in
+ *                           proportion to its speed, and don't wait for slow
+ *                           slaves longer than needed, default false.
+ * relay                     act as a slave of the master given by -g.
+ * sim_latency=MS            simulate links with this one way latency
+ * sim_bandwidth=MBPS        and this bandwidth in MB/s, to measure the
+ *                           engine with local slaves (see tools/distributed_bench.sh).
  * proxy_port=PROXY_PORT     slaves optionally send their logs to this port.
  *    Warning: with proxy_port, the master stderr mixes the logs of all
  *    machines but you can separate them again:
@@ -64,6 +99,9 @@
  * If the master itself runs on a machine other than that running gogui,
  * gogui-twogtp, kgsGtp or cgosGtp, it can redirect its gtp port:
  *    pachi -e distributed -g 10000 slave_port=1234,proxy_port=1235
+ * A relay between the master and some slaves on relayhost runs as:
+ *    pachi -e distributed -g masterhost:1234 slave_port=1234,relay
+ * and the slaves connect to relayhost:1234.
  */
 
 #include <assert.h>
@@ -84,17 +122,33 @@
 #include "mq.h"
 #include "debug.h"
 #include "chat.h"
+#include "gtp.h"
 #include "distributed/distributed.h"
 #include "distributed/merge.h"
+#include "distributed/wire.h"
 
 /* Internal engine state. */
 struct distributed {
 	char *slave_port;
 	char *proxy_port;
 	int max_slaves;
+	int merge_threads;
 	int shared_nodes;
 	int stats_hbits;
+	enum node_keys node_keys;
+	enum wire_format wire;
+	bool shm;
 	bool slaves_quit;
+	bool balance;
+	bool relay;
+	double sim_latency;
+	double sim_bandwidth;
+	/* Relay state: format of the stats exchanged with the parent,
+	 * genmoves already sent to the slaves at this move, stale
+	 * genmoves from the parent to be ignored. */
+	enum wire_format parent_wire;
+	bool relay_searching;
+	bool relay_skip;
 	struct move my_last_move;
 	struct move_stats my_last_stats;
 	int slaves;
@@ -125,6 +179,15 @@ static const struct time_info default_ti = {
  * ensure that most slaves have replied at least once. */
 #define MIN_EARLY_STOP_WAIT 0.3 /* 300 ms */
 
+/* Cpu time (seconds) used by all threads of the master. */
+static double
+process_cpu_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 /* Display a path as leaf<parent<grandparent...
  * Returns the path string in a static buffer; it is NOT safe for
  * anything but debugging - in particular, it is NOT thread-safe! */
@@ -150,6 +213,52 @@ path2sstr(path_t path, struct board *b)
 	return b2;
 }
 
+/* A relay is a slave for its parent master: check that we are in sync
+ * and handle the handshake like uct/slave.c:uct_notify(). Return P_OK
+ * if the command must also be sent to the slaves. */
+static enum parse_code
+relay_notify(struct engine *e, struct board *b, int id, char *cmd, char *args, char **reply)
+{
+	struct distributed *dist = e->data;
+
+	if (move_number(id) != b->moves && !reply_disabled(id) && !is_reset(cmd)) {
+		static char buf[128];
+		snprintf(buf, sizeof(buf), "Out of sync, %d %s, move %d expected", id, cmd, b->moves);
+		if (DEBUGL(0))
+			fprintf(stderr, "%s\n", buf);
+		discard_bin_args(args);
+
+		*reply = buf;
+		if (!gtp_is_valid(e, cmd) && !is_repeated(cmd)) return P_OK;
+		return P_DONE_ERROR;
+	}
+
+	/* Our slaves may be elsewhere: no shared memory with the parent. */
+	if (!strcasecmp(cmd, "pachi-shm")) {
+		*reply = "relay, no shared memory";
+		return P_DONE_ERROR;
+	}
+	/* Reply with our own node keys, the parent checks them. */
+	if (!strcasecmp(cmd, "pachi-wire")) {
+		static char buf[16];
+		int f = atoi(args);
+		dist->parent_wire = (f < WIRE_RAW) ? WIRE_RAW : (f > WIRE_MAX) ? WIRE_MAX : f;
+		snprintf(buf, sizeof(buf), "%d%s", dist->parent_wire,
+			 dist->node_keys == NODE_KEYS_HASH ? " hash" : "");
+		*reply = buf;
+		return P_DONE_OK;
+	}
+
+	/* Sent to the slaves by distributed_genmoves(), unless this
+	 * is an old genmoves replayed with the history. */
+	if (is_repeated(cmd)) {
+		dist->relay_skip = reply_disabled(id);
+		return P_OK;
+	}
+	dist->relay_searching = false;
+	return P_OK;
+}
+
 /* Dispatch a new gtp command to all slaves.
  * The slave lock must not be held upon entry and is released upon return.
  * args is empty or ends with '\n' */
@@ -158,6 +267,14 @@ distributed_notify(struct engine *e, struct board *b, int id, char *cmd, char *a
 {
 	struct distributed *dist = e->data;
 
+	/* A relay doesn't reply to the history replayed by its parent. */
+	enum parse_code ok = (dist->relay && id >= 0 && reply_disabled(id)) ? P_NOREPLY : P_OK;
+	if (dist->relay) {
+		enum parse_code c = relay_notify(e, b, id, cmd, args, reply);
+		if (c != P_OK) return c;
+		if (is_repeated(cmd)) return ok;
+	}
+
 	/* Commands that should not be sent to slaves.
 	 * time_left will be part of next pachi-genmoves,
 	 * we reduce latency by not forwarding it here. */
@@ -174,7 +291,7 @@ distributed_notify(struct engine *e, struct board *b, int id, char *cmd, char *a
 	    || !strcasecmp(cmd, "kgs-genmove_cleanup")
 	    || !strcasecmp(cmd, "final_score")
 	    || !strcasecmp(cmd, "final_status_list"))
-		return P_OK;
+		return ok;
     //协议同步锁，里面是获取从机锁　如果所有线程都运行到等待的状态，是解锁状态
 	protocol_lock();//没有这个命令的话执行到这里
 
@@ -188,13 +305,15 @@ distributed_notify(struct engine *e, struct board *b, int id, char *cmd, char *a
 	 * for all slaves otherwise we can lose on time because of
 	 * a single slow slave when replaying a whole game. */
 	int min_slaves = active_slaves > 1 ? 3 * active_slaves / 4 : 1;
-	get_replies(time_now() + MAX_FAST_CMD_WAIT, min_slaves);
+	/* A relay must keep answering its parent even without slaves. */
+	if (active_slaves || !dist->relay)
+		get_replies(time_now() + reply_wait(min_slaves, MAX_FAST_CMD_WAIT), min_slaves);
 
 	protocol_unlock();
 
 	// At the beginning wait even more for late slaves.
-	if (b->moves == 0) sleep(1);
-	return P_OK;
+	if (b->moves == 0 && !dist->relay) sleep(1);
+	return ok;
 }
 
 /* The playouts sent by slaves for the children of the root node
@@ -323,7 +442,9 @@ distributed_genmove(struct engine *e, struct board *b, struct time_info *ti,
 	struct large_stats stats_array[board_size2(b) + 2], *stats;
 	stats = &stats_array[2];
 
+	double first_cpu = process_cpu_time();
 	protocol_lock();
+	struct protocol_counts counts = protocol_counts;
 	clear_receive_queue();
 
 	/* Send the first genmoves without stats. */
@@ -335,8 +456,13 @@ distributed_genmove(struct engine *e, struct board *b, struct time_info *ti,
 	for (iterations = 1; ; iterations++) {
 		double start = now;
 		/* Wait for just one slave to get stats as fresh as possible,
-		 * or at most 100ms to check if we run out of time. */
-		get_replies(now + MAX_GENMOVES_WAIT, 1);
+		 * or at most 100ms to check if we run out of time, but not
+		 * past the time budget for slow slaves. */
+		double limit = now + MAX_GENMOVES_WAIT;
+		if (dist->balance && ti->dim == TD_WALLTIME
+		    && limit > ti->len.t.timer_start + stop.worst.time)
+			limit = ti->len.t.timer_start + stop.worst.time;
+		get_replies(limit, 1);
 		now = time_now();
 		if (ti->dim == TD_WALLTIME)
 			time_sub(ti, now - start, false);
@@ -383,6 +509,10 @@ distributed_genmove(struct engine *e, struct board *b, struct time_info *ti,
 	char *coord = coord2bstr(coordbuf, best, b);
 	snprintf(args, sizeof(args), "%s %s\n", stone2str(color), coord);
 	update_cmd(b, "play", args, true);
+	counts.bytes_out = protocol_counts.bytes_out - counts.bytes_out;
+	counts.bytes_in = protocol_counts.bytes_in - counts.bytes_in;
+	counts.nodes_out = protocol_counts.nodes_out - counts.nodes_out;
+	counts.nodes_in = protocol_counts.nodes_in - counts.nodes_in;
 	protocol_unlock();
 
 	if (DEBUGL(1)) {
@@ -396,14 +526,132 @@ distributed_genmove(struct engine *e, struct board *b, struct time_info *ti,
 			 (int)(played/time), (int)(played/time/replies),
 			 (int)(played/time/threads), 1000*time/iterations);
 		logline(NULL, "* ", buf);
+		snprintf(buf, sizeof(buf),
+			 "stats nodes/s sent %d received %d, KB/s sent %d received %d,"
+			 " master cpu %.3f ms/iter\n",
+			 (int)(counts.nodes_out/time), (int)(counts.nodes_in/time),
+			 (int)(counts.bytes_out/time/1024), (int)(counts.bytes_in/time/1024),
+			 1000*(process_cpu_time() - first_cpu)/iterations);
+		logline(NULL, "* ", buf);
 	}
 	if (DEBUGL(3)) {
 		int total_hnodes = replies * (1 << dist->stats_hbits);
 		merge_print_stats(total_hnodes);
+		log_slave_perf();
 	}
 	return best;
 }
 
+/* Reply of a relay to the genmoves of its parent master, in the
+ * format of uct/slave.c:report_stats(): the sums of played_own and
+ * threads, the average root playouts, a majority vote for keep_looking
+ * and the averaged stats of the children of the root.
+ * slave_lock is held on entry and on return. */
+static char *
+relay_report(struct board *b, struct large_stats *stats, int bin_size)
+{
+	static char reply[CMDS_SIZE];
+	char *r = reply;
+	char *end = reply + sizeof(reply);
+
+	if (!reply_count) {
+		snprintf(reply, sizeof(reply), "0 0 0 1 @%d", bin_size);
+		return reply;
+	}
+	int played, playouts, threads;
+	bool keep_looking;
+	select_best_move(b, stats, &played, &playouts, &threads, &keep_looking);
+	r += snprintf(r, end - r, "%d %d %d %d @%d", played, playouts / reply_count,
+		      threads, keep_looking, bin_size);
+
+	for (coord_t c = resign; c < board_size2(b); c++) {
+		if (stats[c].playouts <= 0) continue;
+		r += snprintf(r, end - r, "\n%s %d %.16f", coord2sstr(c, b),
+			      (int)stats[c].playouts, stats[c].value);
+	}
+	return reply;
+}
+
+/* genmoves from the parent master of a relay: forward it to the slaves
+ * with the stats received from the parent, wait for the freshest reply
+ * and return the combined replies (see relay_report()) with the stats
+ * increments of all slaves that the parent doesn't know yet.
+ * Keep this code in sync with uct/slave.c:uct_genmoves(). */
+static char *
+distributed_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone color,
+		     char *args, bool pass_all_alive, void **stats_buf, int *stats_size)
+{
+	struct distributed *dist = e->data;
+	int max_nodes = dist->shared_nodes;
+	static struct incr_stats *stats = NULL;
+	static void *wire_buf = NULL, *wire_tmp = NULL;
+	if (!stats) {
+		stats = malloc2(max_nodes * sizeof(*stats));
+		wire_buf = malloc2(wire_max_size(max_nodes));
+		wire_tmp = malloc2(wire_tmp_size(max_nodes));
+	}
+	*stats_size = 0;
+
+	/* Stats from the other slaves of the parent. */
+	int size = 0, nodes = 0;
+	char *sizep = strchr(args, '@');
+	if (sizep) size = atoi(sizep+1);
+	if (size) {
+		if (size > wire_max_size(max_nodes)
+		    || fread(wire_buf, 1, size, stdin) != (size_t)size)
+			return NULL;
+		nodes = wire_decode(dist->parent_wire, wire_buf, size, stats, max_nodes, wire_tmp);
+		if (nodes <= 0) return NULL;
+	}
+	if (dist->relay_skip) {
+		dist->relay_skip = false;
+		return "";
+	}
+
+	char *cmd = pass_all_alive ? "pachi-genmoves_cleanup" : "pachi-genmoves";
+	char cmd_args[CMDS_SIZE];
+	snprintf(cmd_args, sizeof(cmd_args), "%s %s", stone2str(color), args);
+
+	/* Our slaves divide the share of the root children given by
+	 * the parent, they get their own share. */
+	double start = 0, end = 1;
+	char *share = strstr(cmd_args, "share=");
+	if (share) {
+		sscanf(share + 6, "%lf:%lf", &start, &end);
+		char *next = share + strcspn(share, " \n");
+		if (*next == ' ') next++;
+		memmove(share, next, strlen(next) + 1);
+	}
+
+	struct large_stats stats_array[board_size2(b) + 2];
+
+	protocol_lock();
+	set_share_range(start, end);
+	if (!dist->relay_searching)
+		clear_receive_queue();
+	insert_parent_stats(stats, nodes);
+
+	/* As in distributed_genmove(), the same gtp id for all
+	 * genmoves at this move. */
+	if (!dist->relay_searching) {
+		new_cmd(b, cmd, cmd_args);
+		dist->relay_searching = true;
+	} else {
+		update_cmd(b, cmd, cmd_args, false);
+	}
+	if (active_slaves)
+		get_replies(time_now() + MAX_GENMOVES_WAIT, 1);
+
+	nodes = get_parent_stats(stats) / sizeof(*stats);
+	int bin_size = wire_encode(dist->parent_wire, stats, nodes, wire_buf, wire_tmp);
+	char *reply = relay_report(b, &stats_array[2], bin_size);
+	protocol_unlock();
+
+	*stats_buf = wire_buf;
+	*stats_size = bin_size;
+	return reply;
+}
+
 static char *
 distributed_chat(struct engine *e, struct board *b, bool opponent, char *from, char *cmd)
 {
@@ -462,7 +710,10 @@ distributed_state_init(char *arg, struct board *b)
 
 	dist->stats_hbits = DEFAULT_STATS_HBITS;
 	dist->max_slaves = DEFAULT_MAX_SLAVES;//从机默认最大值
+	dist->merge_threads = DEFAULT_MERGE_THREADS;
 	dist->shared_nodes = DEFAULT_SHARED_NODES;
+	dist->shm = true;
+	dist->wire = WIRE_MAX;
 	if (arg) {
 		char *optspec, *next = arg;
 		while (*next) {
@@ -480,6 +731,8 @@ distributed_state_init(char *arg, struct board *b)
 				dist->proxy_port = strdup(optval);
 			} else if (!strcasecmp(optname, "max_slaves") && optval) {
 				dist->max_slaves = atoi(optval);//设置的从机值
+			} else if (!strcasecmp(optname, "merge_threads") && optval) {
+				dist->merge_threads = atoi(optval);
 			} else if (!strcasecmp(optname, "shared_nodes") && optval) {
 				/* Share at most shared_nodes between master and slave at each genmoves.
 				 * Must use the same value in master and slaves. */
@@ -488,8 +741,38 @@ distributed_state_init(char *arg, struct board *b)
 			} else if (!strcasecmp(optname, "stats_hbits") && optval) {
                                 /* Set hash table size to 2^stats_hbits for the shared stats. */
 				dist->stats_hbits = atoi(optval);
+			} else if (!strcasecmp(optname, "node_keys") && optval) {
+				/* Key shared nodes by coord path or by hash
+				 * (see distributed.h). */
+				if (!strcasecmp(optval, "path"))
+					dist->node_keys = NODE_KEYS_PATH;
+				else if (!strcasecmp(optval, "hash"))
+					dist->node_keys = NODE_KEYS_HASH;
+				else
+					die("distributed: invalid node_keys %s\n", optval);
+			} else if (!strcasecmp(optname, "wire") && optval) {
+				/* Best stats format offered to the slaves. */
+				if (!strcasecmp(optval, "raw"))
+					dist->wire = WIRE_RAW;
+				else if (!strcasecmp(optval, "packed"))
+					dist->wire = WIRE_PACKED;
+				else if (!strcasecmp(optval, "lz4") && WIRE_MAX >= WIRE_LZ4)
+					dist->wire = WIRE_LZ4;
+				else
+					die("distributed: invalid wire format %s\n", optval);
+			} else if (!strcasecmp(optname, "shm")) {
+				dist->shm = !optval || atoi(optval);
 			} else if (!strcasecmp(optname, "slaves_quit")) {
 				dist->slaves_quit = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "balance")) {
+				dist->balance = !optval || atoi(optval);
+			} else if (!strcasecmp(optname, "sim_latency") && optval) {
+				dist->sim_latency = atof(optval) / 1000;
+			} else if (!strcasecmp(optname, "sim_bandwidth") && optval) {
+				dist->sim_bandwidth = atof(optval) * 1000000;
+			} else if (!strcasecmp(optname, "relay")) {
+				/* Slave of the master given by -g. */
+				dist->relay = !optval || atoi(optval);
 			} else {
 				fprintf(stderr, "distributed: Invalid engine argument %s or missing value\n", optname);
 			}
@@ -501,9 +784,15 @@ distributed_state_init(char *arg, struct board *b)
 	if (!dist->slave_port)
 		die("distributed: missing slave_port\n");
 
-	merge_init(&default_sstate, dist->shared_nodes, dist->stats_hbits, dist->max_slaves);
+	/* The parent of a relay is one more source of stats. */
+	merge_init(&default_sstate, dist->shared_nodes, dist->stats_hbits,
+		   dist->max_slaves + dist->relay, dist->merge_threads);
+	protocol_balance(dist->balance);
+	protocol_wire(dist->wire);
+	protocol_sim_link(dist->sim_latency, dist->sim_bandwidth);
 	//分布式引擎的网络初始化引擎
-    protocol_init(dist->slave_port, dist->proxy_port, dist->max_slaves);
+	protocol_init(dist->slave_port, dist->proxy_port, dist->max_slaves,
+		      dist->merge_threads, dist->node_keys, dist->shm, dist->relay);
 
 	return dist;
 }
@@ -519,6 +808,8 @@ engine_distributed_init(char *arg, struct board *b)
 		"Anyone can send me 'winrate' in private chat to get my assessment of the position.";
 	e->notify = distributed_notify;
 	e->genmove = distributed_genmove;
+	if (dist->relay)
+		e->genmoves = distributed_genmoves;
 	e->dead_group_list = distributed_dead_group_list;
 	e->chat = distributed_chat;
 	e->data = dist;
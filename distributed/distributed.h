@@ -22,7 +22,33 @@ typedef int64_t path_t;
 #define parent_path(path, board) ((path) >> board_bits2(board))
 #define leaf_coord(path, board) ((path) & hash_mask(board_bits2(board)))
 #define append_child(path, c, board) (((path) << board_bits2(board)) | (c))
-#define max_parent_path(u, b) (((path_t)1) << (((u)->shared_levels - 1) * board_bits2(b)))
+/* Max shared_levels with coord paths. */
+#define max_path_levels(board) (8 * (int)sizeof(path_t) / board_bits2(board))
+
+/* Instead of coord paths, nodes may be keyed by a hash of the moves
+ * from root and the depth: sharing is then not limited in depth and
+ * transpositions get the same key. The master handles both kinds of
+ * keys alike. Hash keys can't be decoded, so a slave only finds the
+ * nodes it has already visited when reporting its own stats. A coord
+ * path is expanded in the slave's tree if needed, and most received
+ * stats are for nodes the slave has not visited yet: on 9x9 with 4
+ * slaves, slaves use 93% (shared_levels=3) and 100% (9) of the
+ * received nodes with paths, 30% and 20% with hash keys. The master
+ * picks the scheme and drops slaves that can't use it. */
+enum node_keys {
+	NODE_KEYS_PATH,
+	NODE_KEYS_HASH,
+};
+
+/* Hash key of a node at @depth, @moves is the xor of hash_at()
+ * for the moves from root. Never 0 or PATH_T_MAX. */
+static inline path_t
+hash_key(hash_t moves, int depth)
+{
+	path_t key = (moves + depth * 0x9e3779b97f4a7c15ULL) >> 1;
+	if (!key) return 1;
+	return key == PATH_T_MAX ? key - 1 : key;
+}
 
 
 /* For debugging only */
@@ -70,9 +96,16 @@ struct incr_stats {
  * games/s each, a slave machine can do at most 30K games/s. */
 
 /* At 30K games/s a slave can output 270K nodes/s or 4.2 MB/s. The master
- * with a 100 MB/s network can thus support at most 24 slaves. */
+ * with a 100 MB/s network can thus support at most 24 slaves. All slaves
+ * are served by one I/O thread so max_slaves is only limited by the
+ * network and by memory (buffers are allocated for each slave slot
+ * that gets a connection): use max_slaves=100 or more with faster links. */
 #define DEFAULT_MAX_SLAVES 24
 
+/* Threads computing the stats sent to each slave (see merge.c).
+ * Merging is the bulk of the master cpu time. */
+#define DEFAULT_MERGE_THREADS 4
+
 /* In a 30s move at 270K nodes/s a slave can send and receive at most
  * 8.1M nodes so at worst 23 bits are needed for the hash table in the
  * slave and for the per-slave hash table in the master. However the
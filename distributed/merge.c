@@ -1,12 +1,18 @@
 /* The master keeps stats received from slaves in a queue of received
- * buffers that are merged together with the functions implemented
- * here. It also has one hash table per slave to maintain cumulative
- * stats that have not yet been sent to the slave machine. The queue
- * and the hash tables are cleared at each new move. */
+ * buffers. Each buffer is tallied once, by the merge threads, into a
+ * shared table of total stats for the current move. The shared table
+ * is partitioned by coord path range so that the merge threads can
+ * fill the partitions in parallel. One hash table per slave remembers
+ * the stats already known by the slave; the stats sent to a slave are
+ * the difference between the totals and what the slave knows. The
+ * queue and the hash tables are cleared at each new move. */
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <limits.h>
+#include <pthread.h>
 
 #define DEBUG
 
@@ -15,23 +21,40 @@
 #include "distributed/distributed.h"
 #include "distributed/merge.h"
 
-/* We merge together debug stats for all hash tables. */
-static struct hash_counts h_counts;
+/* Debug stats of the hash tables. Each merge thread counts in its own
+ * h_counts and adds them to h_totals under the protocol lock at the
+ * end of each merge. */
+static __thread struct hash_counts h_counts;
+static struct hash_counts h_totals;
+
+/* Add the counts of this thread to the totals.
+ * The protocol lock must be held. */
+static void
+fold_counts(void)
+{
+	h_totals.lookups += h_counts.lookups;
+	h_totals.collisions += h_counts.collisions;
+	h_totals.inserts += h_counts.inserts;
+	h_totals.occupied += h_counts.occupied;
+	memset(&h_counts, 0, sizeof(h_counts));
+}
 
 /* Display and reset hash statistics. For debugging only. */
 void
 merge_print_stats(int total_hnodes)
 {
+	protocol_lock();
 	if (DEBUGL(3)) {
 		char buf[BSIZE];
 		snprintf(buf, sizeof(buf),
 			 "stats occupied %ld %.1f%% inserts %ld collisions %ld/%ld %.1f%%\n",
-			 h_counts.occupied, h_counts.occupied * 100.0 / total_hnodes,
-			 h_counts.inserts, h_counts.collisions, h_counts.lookups,
-			 h_counts.collisions * 100.0 / (h_counts.lookups + 1));
+			 h_totals.occupied, h_totals.occupied * 100.0 / total_hnodes,
+			 h_totals.inserts, h_totals.collisions, h_totals.lookups,
+			 h_totals.collisions * 100.0 / (h_totals.lookups + 1));
 		logline(NULL, "* ", buf);
 	}
-	if (DEBUG_MODE) h_counts.occupied = 0;
+	if (DEBUG_MODE) h_totals.occupied = 0;
+	protocol_unlock();
 }
 
 /* We maintain counts per bucket to avoid sorting large arrays.
@@ -44,170 +67,260 @@ merge_print_stats(int total_hnodes)
  * nodes sent by different slaves so shared_nodes can be lower. */
 #define MAX_BUCKETS 1024
 
-/* Update the hash table for the given increment stats,
- * and increment the bucket count. Return the hash index.
- * The slave lock is not held on either entry or exit of this function */
-static inline int
-stats_tally(struct incr_stats *s, struct slave_state *sstate, int *bucket_count)
+/* Total stats of one node for the current move. */
+struct shared_node {
+	path_t coord_path;
+	struct move_stats total;
+	/* Receive queue index of the last buffer updating this node. */
+	int last_q;
+	/* Update list, least recently updated first. */
+	int prev, next;
+};
+
+/* Part of the shared table for coord paths in [bounds[i], bounds[i+1]). */
+struct merge_shard {
+	pthread_mutex_t lock;
+	struct shared_node *table;
+	int head, tail;	/* Update list, -1 if empty. */
+	int tallied;	/* receive_queue[0..tallied] are in the table. */
+	int age;	/* queue_age of the table contents. */
+};
+
+/* Candidates are encoded as shard << shard_hbits | hash index,
+ * with shard_hbits <= 24. */
+#define MAX_SHARDS 64
+
+static struct merge_shard *shards;
+static int nshards, shard_hbits;
+
+/* Shard boundaries, set from the first buffer of each move. */
+static path_t bounds[MAX_SHARDS + 1];
+static int bounds_age = -1;
+static pthread_mutex_t bounds_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Split the coord paths in nshards ranges of similar sizes, using the
+ * first valid buffer of receive_queue[0..max] as sample. Paths of a
+ * buffer are sorted so quantiles are just evenly spaced entries.
+ * Return false if the move has changed. */
+static bool
+set_bounds(int max, int age)
+{
+	pthread_mutex_lock(&bounds_lock);
+	if (bounds_age == age) {
+		pthread_mutex_unlock(&bounds_lock);
+		return true;
+	}
+	if (bounds_age > age || queue_age != age) {
+		pthread_mutex_unlock(&bounds_lock);
+		return false;
+	}
+	struct buf_state *sample = NULL;
+	for (int q = 0; q <= max && !sample; q++)
+		sample = receive_queue[q];
+	int nodes = sample ? sample->size / sizeof(struct incr_stats) : 0;
+
+	bounds[0] = 0;
+	for (int i = 1; i < nshards; i++)
+		bounds[i] = nodes ? ((struct incr_stats *)sample->buf)[i * nodes / nshards].coord_path : PATH_T_MAX;
+	bounds[nshards] = PATH_T_MAX;
+	bounds_age = age;
+	pthread_mutex_unlock(&bounds_lock);
+	return true;
+}
+
+/* Return the index of the first entry of the sorted stats[0..nodes-1]
+ * with coord path >= path. */
+static int
+lower_bound(struct incr_stats *stats, int nodes, path_t path)
+{
+	int lo = 0, hi = nodes;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (stats[mid].coord_path < path) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* Add an increment received in receive_queue[q] to the shard. */
+static inline void
+shard_tally(struct merge_shard *sh, struct incr_stats *s, int q)
 {
 	int h;
 	bool found;
-	struct incr_stats *stats_htable = sstate->stats_htable;
-	find_hash(h, stats_htable, sstate->stats_hbits, s->coord_path, found, h_counts);
+	struct shared_node *table = sh->table;
+	find_hash(h, table, shard_hbits, s->coord_path, found, h_counts);
 	if (found) {
-		assert(stats_htable[h].incr.playouts > 0);
-		stats_add_result(&stats_htable[h].incr, s->incr.value, s->incr.playouts);
+		assert(table[h].total.playouts > 0);
+		stats_add_result(&table[h].total, s->incr.value, s->incr.playouts);
+		if (sh->tail == h) {
+			table[h].last_q = q;
+			return;
+		}
+		/* Unlink before moving to the tail. */
+		if (table[h].prev >= 0) table[table[h].prev].next = table[h].next;
+		else sh->head = table[h].next;
+		table[table[h].next].prev = table[h].prev;
 	} else {
-		stats_htable[h] = *s;
-		if (DEBUG_MODE) h_counts.inserts++, h_counts.occupied++;
+		table[h].coord_path = s->coord_path;
+		table[h].total = s->incr;
+		if (DEBUG_MODE) h_counts.inserts++;
 	}
+	table[h].last_q = q;
+	table[h].prev = sh->tail;
+	table[h].next = -1;
+	if (sh->tail >= 0) table[sh->tail].next = h;
+	else sh->head = h;
+	sh->tail = h;
+}
 
-	int incr = stats_htable[h].incr.playouts;
-	if (incr >= MAX_BUCKETS) incr = MAX_BUCKETS - 1;
-	bucket_count[incr]++;
-	return h;
+/* Bring the shard up to date with receive_queue[0..max].
+ * Return false if the move has changed.
+ * The shard lock is held on both entry and exit of this function. */
+static bool
+shard_update(int i, int max, int age)
+{
+	struct merge_shard *sh = &shards[i];
+	if (sh->age > age) return false;
+	if (sh->age < age) {
+		memset(sh->table, 0, sizeof(sh->table[0]) << shard_hbits);
+		sh->head = sh->tail = -1;
+		sh->tallied = -1;
+		sh->age = age;
+	}
+	for (int q = sh->tallied + 1; q <= max; q++) {
+		/* Stop if we have a new move. If queue_age is incremented
+		 * after this check, the merged output will be discarded. */
+		if (unlikely(queue_age != age)) return false;
+		struct buf_state *bs = receive_queue[q];
+		if (!bs) continue;
+
+		struct incr_stats *stats = bs->buf;
+		int nodes = bs->size / sizeof(*stats);
+		int end = lower_bound(stats, nodes, bounds[i + 1]);
+		for (int n = lower_bound(stats, nodes, bounds[i]); n < end; n++) {
+			assert(stats[n].coord_path && stats[n].incr.playouts);
+			shard_tally(sh, &stats[n], q);
+		}
+	}
+	if (sh->tallied < max) sh->tallied = max;
+	return true;
 }
 
-static struct incr_stats terminator = { .coord_path = INT64_MAX };
+/* Tally receive_queue[0..max] into all shards. Each merge thread starts
+ * with a different shard so that they fill the shards in parallel and
+ * every buffer is tallied once.
+ * Return false if the move has changed. */
+static bool
+update_shared_stats(struct slave_state *sstate, int max, int age)
+{
+	if (!set_bounds(max, age)) return false;
+	for (int k = 0; k < nshards; k++) {
+		int i = (sstate->thread_id + k) % nshards;
+		pthread_mutex_lock(&shards[i].lock);
+		bool ok = shard_update(i, max, age);
+		pthread_mutex_unlock(&shards[i].lock);
+		if (!ok) return false;
+	}
+	return true;
+}
 
-/* Initialize the next pointers (see merge_new_stats()).
- * Exclude invalid buffers and my own buffers by setting their next pointer
- * to a terminator value. Update min if there are too many nodes to merge,
- * so that merge time remains reasonable and the merge buffer doesn't overflow.
- * (We skip the oldest buffers if the slave thread is too much behind. It is
- * more important to get frequent incomplete updates than late complete updates.)
- * Return the total number of nodes to be merged.
- * The slave lock is not held on either entry or exit of this function. */
-static int
-filter_buffers(struct slave_state *sstate, struct incr_stats **next,
-	       int *min, int max)
+/* Return the entry of the slave hash table for the given coord path,
+ * inserting it with zero stats if not found. */
+static inline struct incr_stats *
+known_stats(struct slave_state *sstate, path_t path)
 {
-	int size = 0;
-	int max_size = sstate->max_merged_nodes * sizeof(struct incr_stats);
- 
-	for (int q = max; q >= *min; q--) {
-		if (!receive_queue[q] || receive_queue[q]->owner == sstate->thread_id) {
-			next[q] = &terminator;
-		} else if (size + receive_queue[q]->size > max_size) {
-			*min = q + 1;
-			assert(*min <= max);
-			break;
-		} else {
-			next[q] = (struct incr_stats *)receive_queue[q]->buf;
-			size += receive_queue[q]->size;
-		}
+	int h;
+	bool found;
+	struct incr_stats *stats_htable = sstate->stats_htable;
+	find_hash(h, stats_htable, sstate->stats_hbits, path, found, h_counts);
+	if (!found) {
+		stats_htable[h].coord_path = path;
+		stats_htable[h].incr.playouts = 0;
+		stats_htable[h].incr.value = 0;
+		if (DEBUG_MODE) h_counts.inserts++, h_counts.occupied++;
 	}
-	return size / sizeof(struct incr_stats);
+	return &stats_htable[h];
 }
 
-/* Return the minimum coord path of next[min..max].
- * This implementation is optimized for small values of max - min,
- * which is the case if slaves are not too much behind.
- * A heap (priority queue) could be used otherwise.
- * The returned value might be come from a buffer that has
- * been invalidated, the caller must check for this; in this
- * case the returned value is < the correct value. */
-static inline path_t
-min_coord(struct incr_stats **next, int min, int max)
+/* Add the stats sent by the slave itself in receive_queue[min..max]
+ * to what it knows. Only this slave's merge touches its hash table. */
+static void
+tally_own_stats(struct slave_state *sstate, int min, int max)
 {
-	path_t min_c = next[min]->coord_path;
-	for (int q = min + 1; q <= max; q++) {
-		if (next[q]->coord_path < min_c)
-			min_c = next[q]->coord_path;
+	for (int q = min; q <= max; q++) {
+		struct buf_state *bs = receive_queue[q];
+		if (!bs || bs->owner != sstate->thread_id) continue;
+		struct incr_stats *stats = bs->buf;
+		int nodes = bs->size / sizeof(*stats);
+		for (int n = 0; n < nodes; n++) {
+			struct incr_stats *k = known_stats(sstate, stats[n].coord_path);
+			stats_add_result(&k->incr, stats[n].incr.value, stats[n].incr.playouts);
+		}
 	}
-	return min_c;
 }
 
-/* Merge all valid incremental stats in receive_queue[min..max],
- * update the hash table, set the bucket counts, and save the
- * list of updated hash table entries. The input buffers and
- * the output buffer are all sorted by increasing coord path.
- * The input buffers end with a terminator value INT64_MAX.
- * Return the number of updated hash table entries. */
-
-/* The slave lock is not held on either entry or exit of this function,
- * so receive_queue entries may be invalidated while we scan them.
- * The receive queue might grow while we scan it but we ignore
- * entries above max, they will be processed at the next call.
- * This function does not modify the receive queue. */
+/* Set d to the stats in total not yet known by the slave. */
+static inline void
+stats_diff(struct move_stats *d, struct move_stats *total, struct move_stats *known)
+{
+	d->playouts = total->playouts - known->playouts;
+	if (d->playouts <= 0) return;
+	double sum = (double)total->value * total->playouts
+		   - (double)known->value * known->playouts;
+	d->value = sum / d->playouts;
+}
+
+static struct move_stats no_stats;
+
+/* Find the nodes updated by receive_queue[min..] with stats not yet
+ * known by the slave, set the bucket counts and save the list of
+ * table indices. Return the number of candidates, or -1 if the move
+ * has changed. */
 static int
-merge_new_stats(struct slave_state *sstate, int min, int max,
-		int *bucket_count, int *nodes_read, int last_queue_age)
+find_candidates(struct slave_state *sstate, int min, int age, int *bucket_count)
 {
-	*nodes_read = 0;
-	if (max < min) return 0;
-
-	/* next[q] is the next value to be checked in receive_queue[q]->buf */
-	struct incr_stats *next_[max - min + 1];
-	struct incr_stats **next = next_ - min;
-	*nodes_read = filter_buffers(sstate, next, &min, max);
-
-	/* prev_min_c is only used for debugging. */
-	path_t prev_min_c = 0;
-
-	/* Do N-way merge, processing one coord path per iteration.
-	 * If the minimum coord is INT64_MAX, either all buffers are
-	 * invalidated, or at least one is valid and we are at the
-	 * end of all valid buffers. In both cases we're done. */
-	int merge_count = 0;
-	path_t min_c;
-	while ((min_c = min_coord(next, min, max)) != INT64_MAX) {
-
-		struct incr_stats sum = { .coord_path = min_c,
-					  .incr = { .playouts = 0, .value = 0.0 }};
-		for (int q = min; q <= max; q++) {
-			struct incr_stats s = *(next[q]);
-
-			/* If s.coord_path != min_c, we must skip s.coord_path for now.
-			 * If min_c is invalid, a future iteration will get a stable
-			 * value since the call of min_coord(), so at some point we will
-			 * get s.coord_path == min_c and we will not loop forever. */
-			 if (s.coord_path != min_c) continue;
-
-			/* We check the buffer validity after s.coord has been checked
-			 * to avoid a race condition, and also to avoid multiple useless
-			 * checks for the same coord_path. */
-			if (unlikely(!receive_queue[q])) {
-				next[q] = &terminator;
-				continue;
-			}
-
-			/* Stop if we have a new move. If queue_age is incremented
-			 * after this check, the merged output will be discarded. */
-			if (unlikely(queue_age > last_queue_age)) return 0;
-
-			/* s.coord_path is valid here, so min_c is valid too.
-			 * (An invalid min_c would be < s.coord_path.) */
-			assert(min_c > prev_min_c);
-
-			assert(s.coord_path && s.incr.playouts);
-			stats_add_result(&sum.incr, s.incr.value, s.incr.playouts);
-			next[q]++;
+	int count = 0;
+	for (int i = 0; i < nshards; i++) {
+		struct merge_shard *sh = &shards[i];
+		pthread_mutex_lock(&sh->lock);
+		if (sh->age != age) {
+			pthread_mutex_unlock(&sh->lock);
+			return -1;
 		}
-		/* All the buffers containing min_c may have been invalidated
-		 * so sum may still be zero. But in this case the next[q] which
-		 * contained min_c have been reset to &terminator so we will
-		 * not loop forever. */
-		if (!sum.incr.playouts) continue;
-
-		assert(min_c > prev_min_c);
-		if (DEBUG_MODE) prev_min_c = min_c;
-
-		/* At this point sum contains only valid increments,
-		 * so we can add it to the hash table. */
-		assert(merge_count < sstate->max_merged_nodes);
-		sstate->merged[merge_count++] = stats_tally(&sum, sstate, bucket_count);
+		for (int h = sh->tail; h >= 0 && sh->table[h].last_q >= min; h = sh->table[h].prev) {
+			struct shared_node *node = &sh->table[h];
+			int k;
+			bool found;
+			find_hash(k, sstate->stats_htable, sstate->stats_hbits, node->coord_path, found, h_counts);
+			struct move_stats d;
+			stats_diff(&d, &node->total, found ? &sstate->stats_htable[k].incr : &no_stats);
+			if (d.playouts <= 0) continue;
+
+			/* Late slave: drop the oldest updates. */
+			if (count >= sstate->max_merged_nodes) break;
+			int incr = d.playouts < MAX_BUCKETS ? d.playouts : MAX_BUCKETS - 1;
+			bucket_count[incr]++;
+			sstate->merged[count++] = i << shard_hbits | h;
+		}
+		pthread_mutex_unlock(&sh->lock);
 	}
-	return merge_count;
+	return count;
+}
+
+/* Used to sort the output by coord path. */
+static int
+path_cmp(const void *p1, const void *p2)
+{
+	path_t a = ((struct incr_stats *)p1)->coord_path;
+	path_t b = ((struct incr_stats *)p2)->coord_path;
+	return (a > b) - (a < b);
 }
 
-/* Save in buf the best increments from other slaves merged previously.
- * To avoid a costly scan of the entire hash table we only send nodes
- * that were previously sent recently by other slaves. It is possible
- * but very unlikely that the hash table contains some nodes with
- * higher number of playouts.
- * Return the number of nodes to be sent.
- * The slave lock is not held on either entry or exit of this function. */
+/* Save in buf the candidates with the largest stats not yet known by
+ * the slave, and remember that the slave now knows them.
+ * Return the number of nodes to be sent. */
 static int
 output_stats(struct incr_stats *buf, struct slave_state *sstate,
 	     int *bucket_count, int merge_count)
@@ -224,24 +337,32 @@ output_stats(struct incr_stats *buf, struct slave_state *sstate,
 	/* Send all all increments > min_incr plus whatever we can at min_incr. */
 	int min_count = bucket_count[min_incr] - (out_count - shared_nodes);
 	out_count = 0;
-	int *merged = sstate->merged;
-	struct incr_stats *stats_htable = sstate->stats_htable;
-	while (merge_count--) {
-		int h = *merged++;
-		int delta = stats_htable[h].incr.playouts - min_incr;
+
+	/* Candidates are grouped by shard. The totals may have grown
+	 * since find_candidates(), hence the check on out_count. */
+	struct merge_shard *sh = NULL;
+	for (int m = 0; m < merge_count && out_count < shared_nodes; m++) {
+		struct merge_shard *s = &shards[sstate->merged[m] >> shard_hbits];
+		if (s != sh) {
+			if (sh) pthread_mutex_unlock(&sh->lock);
+			sh = s;
+			pthread_mutex_lock(&sh->lock);
+		}
+		struct shared_node *node = &sh->table[sstate->merged[m] & hash_mask(shard_hbits)];
+		struct incr_stats *k = known_stats(sstate, node->coord_path);
+		struct move_stats d;
+		stats_diff(&d, &node->total, &k->incr);
+		int delta = d.playouts - min_incr;
 		if (delta < 0 || (delta == 0 && --min_count < 0)) continue;
 
-		assert (out_count < shared_nodes);
-		buf[out_count++] = stats_htable[h];
-
-		/* Clear the hash table entry. (We could instead
-		 * just clear the playouts but clearing the entry
-		 * leads to fewer collisions later.) */
-		stats_htable[h].coord_path = 0;
-		if (DEBUG_MODE) h_counts.occupied--;
-	} 
-	/* The slave expects increments sorted by coord path
-	 * but they are sorted already. */
+		buf[out_count].coord_path = node->coord_path;
+		buf[out_count++].incr = d;
+		k->incr = node->total;
+	}
+	if (sh) pthread_mutex_unlock(&sh->lock);
+
+	/* The slave expects increments sorted by coord path. */
+	qsort(buf, out_count, sizeof(*buf), path_cmp);
 	return out_count;
 }
 
@@ -253,13 +374,16 @@ output_stats(struct incr_stats *buf, struct slave_state *sstate,
 static int
 get_new_stats(struct incr_stats *buf, struct slave_state *sstate, int cmd_id)
 {
+	int age = queue_age;
+	bool new_move = (sstate->stats_age != age);
+	if (new_move) sstate->last_processed = -1;
+
 	/* Process all valid buffers in receive_queue[min..max] */
 	int min = sstate->last_processed + 1;
 	int max = queue_length - 1;
-	if (max < min && cmd_id == sstate->stats_id) return 0;
+	if (max < min && !new_move) return 0;
 
 	sstate->last_processed = max;
-	int last_queue_age = queue_age;
 
 	/* It takes time to clear the hash table and merge the stats
 	 * so do this unlocked. */
@@ -270,70 +394,61 @@ get_new_stats(struct incr_stats *buf, struct slave_state *sstate, int cmd_id)
 
 	/* Clear the hash table at a new move; the old paths in
 	 * the hash table are now meaningless. */
-	if (cmd_id != sstate->stats_id) {
-		memset(sstate->stats_htable, 0, 
+	if (new_move) {
+		memset(sstate->stats_htable, 0,
 		       (1 << sstate->stats_hbits) * sizeof(sstate->stats_htable[0]));
-		sstate->stats_id = cmd_id;
+		sstate->stats_age = age;
 		clear_time = time_now() - start;
 	}
 
-	/* Set the bucket counts and update the hash table stats. */
 	int bucket_count[MAX_BUCKETS];
 	memset(bucket_count, 0, sizeof(bucket_count));
-	int nodes_read;
-	int merge_count = merge_new_stats(sstate, min, max, bucket_count,
-					  &nodes_read, last_queue_age);
-
-	int missed = 0;
-	if (DEBUG_MODE)
-		for (int q = min; q <= max; q++) missed += !receive_queue[q];
+	int merge_count = -1, output_nodes = 0;
+	double tally_time = 0;
+	if (max >= 0 && update_shared_stats(sstate, max, age)) {
+		tally_time = time_now() - start - clear_time;
+		tally_own_stats(sstate, min, max);
+		merge_count = find_candidates(sstate, min, age, bucket_count);
+	}
 
 	/* Put the best increments in the output buffer. */
-	int output_nodes = output_stats(buf, sstate, bucket_count, merge_count);
+	if (merge_count > 0)
+		output_nodes = output_stats(buf, sstate, bucket_count, merge_count);
 
 	if (DEBUGVV(2)) {
 		char b[1024];
-		snprintf(b, sizeof(b), "merged %d..%d missed %d %d/%d nodes,"
-			 " output %d/%d nodes in %.3fms (clear %.3fms)\n",
-			 min, max, missed, merge_count, nodes_read, output_nodes,
+		snprintf(b, sizeof(b), "merged %d..%d %d candidates,"
+			 " output %d/%d nodes in %.3fms (clear %.3fms tally %.3fms)\n",
+			 min, max, merge_count, output_nodes,
 			 sstate->max_buf_size / (int)sizeof(*buf),
-			 (time_now() - start)*1000, clear_time*1000);
+			 (time_now() - start)*1000, clear_time*1000, tally_time*1000);
 		logline(&sstate->client, "= ", b);
 	}
 
 	protocol_lock();
+	if (DEBUG_MODE) fold_counts();
 
 	return output_nodes * sizeof(*buf);
 }
 
-/* Allocate the buffers in the merge specific part of the slave sate,
- * and reserve space for a terminator value (see merge_insert_hook). */
+/* Allocate the buffers in the merge specific part of the slave sate. */
 static void
 merge_state_alloc(struct slave_state *sstate)
 {
 	sstate->stats_htable = calloc2(1 << sstate->stats_hbits, sizeof(struct incr_stats));
 	sstate->merged = malloc2(sstate->max_merged_nodes * sizeof(int));
-	sstate->max_buf_size -= sizeof(struct incr_stats);
 }
 
-/* Append a terminator value to make merge_new_stats() more
- * efficient. merge_state_alloc() has reserved enough space. */
-static void
-merge_insert_hook(struct incr_stats *buf, int size)
-{
-	int nodes = size / sizeof(*buf);
-	buf[nodes].coord_path = INT64_MAX;
-}
-
-/* Initiliaze merge-related fields of the default slave state. */
+/* Initiliaze merge-related fields of the default slave state,
+ * and the shared table with one shard per merge thread. */
 void
-merge_init(struct slave_state *sstate, int shared_nodes, int stats_hbits, int max_slaves)
+merge_init(struct slave_state *sstate, int shared_nodes, int stats_hbits,
+	   int max_slaves, int merge_threads)
 {
-	/* See merge_state_alloc() for shared_nodes + 1 */
-	sstate->max_buf_size = (shared_nodes + 1) * sizeof(struct incr_stats);
+	sstate->max_buf_size = shared_nodes * sizeof(struct incr_stats);
 	sstate->stats_hbits = stats_hbits;
+	sstate->stats_age = -1;
 
-	sstate->insert_hook = (buffer_hook)merge_insert_hook;
 	sstate->alloc_hook = merge_state_alloc;
 	sstate->args_hook = (getargs_hook)get_new_stats;
 
@@ -344,4 +459,17 @@ merge_init(struct slave_state *sstate, int shared_nodes, int stats_hbits, int ma
 	 * Restricting the maximum number of merged nodes to the latter avoids
 	 * spending excessive time on the merge. */
 	sstate->max_merged_nodes = shared_nodes * (max_slaves - 1);
+
+	nshards = merge_threads < 1 ? 1 : merge_threads > MAX_SHARDS ? MAX_SHARDS : merge_threads;
+	shard_hbits = stats_hbits;
+	if (shard_hbits > 24)
+		die("distributed: stats_hbits too large\n");
+	shards = calloc2(nshards, sizeof(*shards));
+	for (int i = 0; i < nshards; i++) {
+		pthread_mutex_init(&shards[i].lock, NULL);
+		shards[i].table = calloc2(1 << shard_hbits, sizeof(struct shared_node));
+		shards[i].head = shards[i].tail = -1;
+		shards[i].tallied = -1;
+		shards[i].age = -1;
+	}
 }
@@ -10,12 +10,54 @@
  * immmediately, and stays so until at least the next queue age
  * increment. */
 
+/* All slave connections are served by a single I/O thread using
+ * non-blocking sockets (epoll on Linux, poll elsewhere). Each slave
+ * has a small state machine (see enum conn_state). Computing the
+ * binary args of genmoves (the stats merge) is the only expensive
+ * part, it is handed to a pool of merge threads. The I/O thread takes
+ * slave_lock once per batch of events, not once per slave, and a new
+ * command just writes one byte to a wakeup pipe. */
+
+/* To measure the distributed engine on one host, the master can
+ * simulate slower links: each reply is held by the I/O thread until
+ * the round trip latency plus the transfer time of the command and
+ * the reply at the given bandwidth have elapsed since the command
+ * was sent. */
+
+/* Slaves may have very different speeds. The master keeps for each
+ * slave a smoothed playout rate, from the played_own of successive
+ * genmoves replies, and a smoothed reply latency. Each genmoves gives
+ * the slave a share of the root children in proportion to its rate
+ * (see uct/policy/ucb1amaf.c), and the master waits for fast commands
+ * only as long as the fastest slaves need, not for stragglers. */
+
+/* Slaves on the same host get the binary args and replies through a
+ * shared memory segment, one per slave: the master writes the args in
+ * the first half and the slave its reply in the second half. Commands
+ * and the ascii part of replies still go through the socket and act as
+ * doorbells: each side only touches a half before sending the message
+ * which hands it to the other side. So the only copies left are from
+ * and to the receive buffers, and no encoding is needed. */
+
 #include <assert.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+#endif
+
 #define DEBUG
 
 #include "random.h"
@@ -25,6 +67,11 @@
 #include "debug.h"
 #include "distributed/distributed.h"
 #include "distributed/protocol.h"
+#include "distributed/wire.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 /* All gtp commands for current game separated by \n */
 static char gtp_cmds[CMDS_SIZE];
@@ -64,9 +111,6 @@ static int queue_max_length;
  * read without the lock but is only written with lock held. */
 static pthread_mutex_t slave_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Condition signaled when a new gtp command is available. */
-static pthread_cond_t cmd_cond = PTHREAD_COND_INITIALIZER;
-
 /* Condition signaled when reply_count increases. */
 static pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
 
@@ -81,6 +125,141 @@ static double start_time;
 struct slave_state default_sstate;
 
 
+/* State of the connection with one slave machine. */
+enum conn_state {
+	C_FREE,		/* No slave connected. */
+	C_NAME,		/* Handshake: "name" sent, waiting for the reply. */
+	C_WIRE,		/* Handshake: "pachi-wire" sent, waiting for the reply. */
+	C_SHM,		/* Handshake: "pachi-shm" sent, waiting for the reply. */
+	C_IDLE,		/* Waiting for a new command. */
+	C_MERGING,	/* A merge thread is computing the binary args. */
+	C_SENDING,	/* Writing the command and its binary args. */
+	C_RECEIVING,	/* Reading the reply. */
+};
+
+/* What the I/O thread must process under slave_lock for a connection. */
+enum conn_event {
+	E_NONE,
+	E_HANDSHAKE,	/* Reply to a handshake command. */
+	E_REPLY,	/* Complete reply received. */
+	E_MERGED,	/* Merge thread done. */
+	E_LOST,		/* Connection lost or protocol error. */
+};
+
+struct slave_conn {
+	struct slave_state s;
+	int fd;
+	enum conn_state state;
+	enum conn_event event;
+	bool active;	/* Counted in active_slaves. */
+	bool lost;	/* Lost while a merge thread owns the connection. */
+	bool out_poll;	/* Waiting for the socket to become writable. */
+
+	/* Same as the locals of the old per slave thread loop. */
+	bool resend;
+	int last_cmd_count;
+	int last_reply_id;
+	int reply_slot;
+
+	/* Binary stats format for this slave, and buffers for the
+	 * encoded stats when it is not WIRE_RAW (see wire_tmp_size()). */
+	enum wire_format wire;
+	void *wire_buf;
+	void *wire_tmp;
+	int wire_max;
+
+	/* Shared memory segment for local slaves, NULL if none. */
+	char *shm;
+	char shm_name[64];
+
+	/* Command being sent: out[0..out_len-1] then send_buf[0..send_size-1].
+	 * The binary args are in bin_buf[0..bin_size-1], send_buf is
+	 * either bin_buf or wire_buf. */
+	char *out;
+	int out_len;
+	void *bin_buf;
+	int bin_size;
+	void *send_buf;
+	int send_size;
+	int sent;
+	bool prepared;	/* Set by the merge thread, false if args are obsolete. */
+
+	/* Reply being received: ascii part in in[0..in_len-1], complete when
+	 * text_len > 0, followed by bin_len bytes read into bin_buf, or
+	 * wire_buf and then decoded. */
+	char *in;
+	int in_len;
+	int text_len;
+	int bin_len;
+	int bin_read;
+	int reply_id;
+
+	/* Copy of the last reply, pointed to by gtp_replies[]. */
+	char *reply_buf;
+	double start;  // for debugging only
+
+	/* Load balancing: smoothed playouts/s and reply latency in
+	 * seconds, zero if unknown; played_own of the last genmoves
+	 * reply, with its time and gtp id. */
+	double rate;
+	double latency;
+	int played;
+	double played_at;
+	int played_id;
+
+	/* Simulated link: bytes of the last command and reply,
+	 * the reply is processed at time due. */
+	int sent_bytes;
+	int recv_bytes;
+	double due;
+};
+
+static struct slave_conn *conns;
+static int max_conns;
+
+/* Connections waiting for a merge thread, and connections done
+ * merging. Protected by job_lock, which may be taken with
+ * slave_lock held but not the other way round. */
+static struct slave_conn **jobs;
+static int job_head, job_count;
+static struct slave_conn **merged;
+static int merged_count;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+
+/* Written to wake up the I/O thread. */
+static int wake_pipe[2] = { -1, -1 };
+
+/* Keys of shared nodes, all slaves must use them. */
+static enum node_keys node_keys;
+
+/* Offer shared memory to slaves on the same host. */
+static bool use_shm;
+
+/* Best stats format offered to the slaves. */
+static enum wire_format wire_max = WIRE_MAX;
+
+/* For a relay, the parent master seen as one more slave: its stats
+ * go to the receive queue like those of the children, and it gets
+ * the increments of the children it doesn't know yet. */
+static struct slave_state parent_sstate;
+static bool relay;
+
+/* Give shares of the root children to the slaves, and wait for the
+ * fastest slaves only. A relay divides its own share among its slaves. */
+static bool balance;
+static double share_min = 0, share_max = 1;
+
+/* Simulated link, disabled if both are zero. */
+static double sim_latency;	/* seconds, one way */
+static double sim_bandwidth;	/* bytes/s, zero for unlimited */
+
+struct protocol_counts protocol_counts;
+
+/* Poller tags for the non-slave file descriptors. */
+static int listen_tag, wake_tag;
+
+
 /* Get exclusive access to the threads and commands state. */
 void
 protocol_lock(void)
@@ -137,113 +316,151 @@ proxy_thread(void *arg)
 	pthread_exit(NULL);
 }
 
-/* Get a reply to one gtp command. Return the gtp command id,
- * or -1 if error. reply must have at least CMDS_SIZE bytes.
- * The ascii reply ends with an empty line; if the first line
- * contains "@size", a binary reply of size bytes follows the
- * empty line. @size is not standard gtp, it is only used
- * internally by Pachi for the genmoves command; it must be the
- * last parameter on the line.
- * *bin_size is the maximum size upon entry, actual size on return.
- * slave_lock is not held on either entry or exit of this function. */
-static int
-get_reply(FILE *f, struct in_addr client, char *reply, void *bin_reply, int *bin_size)
-{
-	double start = time_now();
 
-	int reply_id = -1;
-	*reply = '\0';
-	if (!fgets(reply, CMDS_SIZE, f)) return -1;
+#ifndef _WIN32
 
-	/* Check for binary reply. */
-	char *s = strchr(reply, '@');
-	int size = 0;
-	if (s) size = atoi(s+1);
-	assert(size <= *bin_size);
-	*bin_size = size;
+/********************************************************************************************/
+/* Poller: epoll on Linux, poll() elsewhere. Used by the I/O thread only. */
 
-	if (DEBUGV(s, 2))
-		logline(&client, "<<", reply);
-	if ((*reply == '=' || *reply == '?') && isdigit(reply[1]))
-		reply_id = atoi(reply+1);
+struct io_event {
+	void *tag;
+	bool in, out;
+};
 
-	/* Read the rest of the ascii reply */
-	char *line = reply + strlen(reply);
-	while (fgets(line, reply + CMDS_SIZE - line, f) && *line != '\n') {
-		if (DEBUGL(3))
-			logline(&client, "<<", line);
-		line += strlen(line);
-	}
-	if (*line != '\n') return -1;
+#define MAX_EVENTS 64
 
-	/* Read the binary reply if any. */
-	int len;
-	while (size && (len = fread(bin_reply, 1, size, f)) > 0) {
-		bin_reply = (char *)bin_reply + len;
-		size -= len;
-	}
-	if (*bin_size && DEBUGVV(2)) {
-		char buf[1024];
-		snprintf(buf, sizeof(buf), "read reply %d+%d bytes in %.4fms\n",
-			 (int)strlen(reply), *bin_size,
-			 (time_now() - start)*1000);
-		logline(&client, "= ", buf);
-	}
-	return size ? -1 : reply_id;
+#ifdef __linux__
+
+static int epoll_fd;
+
+static void
+poller_init(int max_fds)
+{
+	epoll_fd = epoll_create(max_fds);
+	if (epoll_fd == -1) fail("epoll_create");
 }
 
-/* Send the gtp command to_send and get a reply from the slave machine.
- * Write the reply in buf which must have at least CMDS_SIZE bytes.
- * If *bin_size > 0, send bin_buf after the gtp command.
- * Return any binary reply in bin_buf and set its size in bin_size.
- * bin_buf is private to the slave and need not be copied.
- * Return the gtp command id, or -1 if error.
- * slave_lock is held on both entry and exit of this function. */
+static void
+poller_ctl(int op, int fd, void *tag, bool out)
+{
+	struct epoll_event ev = { .events = EPOLLIN | (out ? EPOLLOUT : 0), .data.ptr = tag };
+	if (epoll_ctl(epoll_fd, op, fd, &ev) == -1) fail("epoll_ctl");
+}
+
+static void poller_add(int fd, void *tag)	        { poller_ctl(EPOLL_CTL_ADD, fd, tag, false); }
+static void poller_mod(int fd, void *tag, bool out)	{ poller_ctl(EPOLL_CTL_MOD, fd, tag, out); }
+static void poller_del(int fd)			        { poller_ctl(EPOLL_CTL_DEL, fd, NULL, false); }
+
 static int
-send_command(char *to_send, void *bin_buf, int *bin_size,
-	     FILE *f, struct slave_state *sstate, char *buf)
+poller_wait(struct io_event *events, int timeout_ms)
 {
-	assert(to_send && gtp_cmd && bin_buf && bin_size);
-	strncpy(buf, to_send, CMDS_SIZE);
-	bool resend = to_send != gtp_cmd;
+	struct epoll_event ev[MAX_EVENTS];
+	int n = epoll_wait(epoll_fd, ev, MAX_EVENTS, timeout_ms);
+	if (n == -1 && errno != EINTR) fail("epoll_wait");
+	for (int i = 0; i < n; i++) {
+		events[i].tag = ev[i].data.ptr;
+		events[i].in = ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+		events[i].out = ev[i].events & EPOLLOUT;
+	}
+	return n < 0 ? 0 : n;
+}
 
-	pthread_mutex_unlock(&slave_lock);
+#else
 
-	if (DEBUGL(1) && resend)
-		logline(&sstate->client, "? ",
-			to_send == gtp_cmds ? "resend all\n" : "partial resend\n");
+static struct pollfd *pfds;
+static void **ptags;
+static int npfds, next_pfd;
 
-	double start = time_now();
-	fputs(buf, f);
+static void
+poller_init(int max_fds)
+{
+	pfds = calloc2(max_fds, sizeof(*pfds));
+	ptags = calloc2(max_fds, sizeof(*ptags));
+}
 
-	if (*bin_size)
-		fwrite(bin_buf, 1, *bin_size, f);
-	fflush(f);
+static int
+poller_find(int fd)
+{
+	for (int i = 0; i < npfds; i++)
+		if (pfds[i].fd == fd) return i;
+	assert(0);
+	return -1;
+}
 
-	if (DEBUGV(strchr(buf, '@'), 2)) {
-		double ms = (time_now() - start) * 1000.0;
-		if (!DEBUGL(3)) {
-			char *s = strchr(buf, '\n');
-			if (s) s[1] = '\0';
-		}
-		logline(&sstate->client, ">>", buf);
-		if (*bin_size) {
-			char b[1024];
-			snprintf(b, sizeof(b),
-				 "sent cmd %d+%d bytes in %.4fms\n",
-				 (int)strlen(buf), *bin_size, ms);
-			logline(&sstate->client, "= ", b);
-		}
+static void
+poller_add(int fd, void *tag)
+{
+	pfds[npfds].fd = fd;
+	pfds[npfds].events = POLLIN;
+	ptags[npfds++] = tag;
+}
+
+static void
+poller_mod(int fd, void *tag, bool out)
+{
+	pfds[poller_find(fd)].events = POLLIN | (out ? POLLOUT : 0);
+}
+
+static void
+poller_del(int fd)
+{
+	int i = poller_find(fd);
+	npfds--;
+	pfds[i] = pfds[npfds];
+	ptags[i] = ptags[npfds];
+}
+
+/* Return at most MAX_EVENTS ready fds, starting after the last ones
+ * returned so that no slave is starved. */
+static int
+poller_wait(struct io_event *events, int timeout_ms)
+{
+	int ready = poll(pfds, npfds, timeout_ms);
+	if (ready == -1 && errno != EINTR) fail("poll");
+	int n = 0;
+	for (int k = 0; k < npfds && n < ready && n < MAX_EVENTS; k++) {
+		int i = (next_pfd + k) % npfds;
+		if (!pfds[i].revents) continue;
+		events[n].tag = ptags[i];
+		events[n].in = pfds[i].revents & (POLLIN | POLLHUP | POLLERR);
+		events[n].out = pfds[i].revents & POLLOUT;
+		n++;
+		next_pfd = i + 1;
 	}
+	return n;
+}
 
-	/* Reuse the buffers for the reply. */
-	*bin_size = sstate->max_buf_size;
-	int reply_id = get_reply(f, sstate->client, buf, bin_buf, bin_size);
+#endif /* __linux__ */
 
-	pthread_mutex_lock(&slave_lock);
-	return reply_id;
+
+/********************************************************************************************/
+
+static void
+set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		fail("fcntl");
+}
+
+/* Wake up the I/O thread. One pending byte is enough, so a full
+ * pipe is not an error. */
+static void
+wake_io_thread(void)
+{
+	if (wake_pipe[1] < 0) return;
+	char c = 0;
+	while (write(wake_pipe[1], &c, 1) == -1 && errno == EINTR)
+		;
 }
 
+#else
+
+static void wake_io_thread(void) { }
+
+#endif /* !_WIN32 */
+
+
 /* Return the command sent after that with the given gtp id,
  * or gtp_cmds if the id wasn't used in this game. If a play command
  * has overwritten a genmoves command, return the play command.
@@ -268,7 +485,7 @@ next_command(int cmd_id)
 	return next;
 }
 
-/* Allocate buffers for a slave thread. The state should have been
+/* Allocate buffers for a slave connection. The state should have been
  * initialized already as a copy of the default slave state.
  * slave_lock is not held on either entry or exit of this function. */
 static void
@@ -300,14 +517,16 @@ get_free_buf(struct slave_state *sstate)
 		logline(&sstate->client, "? ", b);
 	}
 
+	/* The buffer gets the stats of the current slave of the slot. */
+	sstate->b[newest].owner = sstate->thread_id;
+
 	int index = sstate->b[newest].queue_index;
 	if (index < 0) return buf;
 
-	/* Invalidate the buffer if the calling thread still owns its previous
-	 * entry in the receive queue. The entry may have been overwritten by
-	 * another thread, but only after a new move which invalidates the
-	 * entire receive queue. */
-	if (receive_queue[index] && receive_queue[index]->owner == sstate->thread_id) {
+	/* Invalidate the previous entry of the buffer in the receive queue.
+	 * The entry may have been overwritten by another buffer, but only
+	 * after a new move which invalidates the entire receive queue. */
+	if (receive_queue[index] == &sstate->b[newest]) {
 		receive_queue[index] = NULL;
 	}
 	sstate->b[newest].queue_index = -1;
@@ -315,7 +534,7 @@ get_free_buf(struct slave_state *sstate)
 }
 
 /* Insert a buffer in the receive queue. It should be the most
- * recent buffer allocated by the calling thread.
+ * recent buffer allocated by the calling slave.
  * slave_lock is held on both entry and exit of this function. */
 static void
 insert_buf(struct slave_state *sstate, void *buf, int size)
@@ -360,7 +579,7 @@ clear_receive_queue(void)
 
 /* Process the reply received from a slave machine.
  * Copy the ascii part to reply_buf and insert the binary part
- * (if any) in the receive queue.
+ * (if any) in the receive queue. The caller signals reply_cond.
  * Return false if ok, true if the slave is out of sync.
  * slave_lock is held on both entry and exit of this function. */
 static bool
@@ -392,174 +611,750 @@ process_reply(int reply_id, char *reply, char *reply_buf,
 
 	if (bin_size) insert_buf(sstate, bin_reply, bin_size);
 
-	pthread_cond_signal(&reply_cond);
 	*last_reply_id = reply_id;
 	return false;
 }
 
-/* Get the binary arg for the given command, and update the command
- * if necessary. For now, only genmoves has a binary argument, and
- * we return the best stats increments from all other slaves.
+/* Get the binary arg for the current command. For now, only genmoves
+ * has a binary argument, and we return the best stats increments from
+ * all other slaves.
  * Set *bin_size to 0 if the command doesn't take binary arguments,
  * but still return a buffer, to be used for the reply.
  * Return NULL if the binary arg is obsolete by the time we have
  * finished computing it, because a new command is available.
- * This version only gets the buffer for the reply, to be completed
- * in future commits.
  * slave_lock is held on both entry and exit of this function. */
-void *
-get_binary_arg(struct slave_state *sstate, char *cmd, int cmd_size, int *bin_size)
+static void *
+get_binary_arg(struct slave_state *sstate, int *bin_size)
 {
 	int cmd_id = atoi(gtp_cmd);
 	void *buf = get_free_buf(sstate);
 
 	*bin_size = 0;
-	char *s = strchr(cmd, '@');
-	if (!s || !sstate->args_hook) return buf;
+	if (!strchr(gtp_cmd, '@') || !sstate->args_hook) return buf;
 
 	int size = sstate->args_hook(buf, sstate, cmd_id);
 
 	/* Check that the command is still valid. */
 	if (atoi(gtp_cmd) != cmd_id) return NULL;
 
-	/* Set the correct binary size for this slave.
-	 * cmd may have been overwritten with new parameters. */
 	*bin_size = size;
-	s = strchr(cmd, '@');
-	assert(s);
-	snprintf(s, cmd + cmd_size - s, "@%d\n", size);
 	return buf;
 }
 
-/* Main loop of a slave thread.
- * Send the current command to the slave machine and wait for a reply.
- * Resend command history if the slave machine is out of sync.
- * Returns when the connection with the slave machine is cut.
+/* Does the current command need a merge thread ?
+ * slave_lock is held on both entry and exit of this function. */
+static bool
+needs_merge(struct slave_conn *c)
+{
+	return c->s.args_hook && strchr(gtp_cmd, '@');
+}
+
+/* Share of the root children for a slave, in proportion to its playout
+ * rate. Slaves without a rate yet count as average ones.
  * slave_lock is held on both entry and exit of this function. */
-/*从线程的主循环。将当前命令发送到从属计算机并等待答复。如果从机不同步，则重新发送命令历史记录。当与从机的连接被切断时返回。从锁在该功能的入口和出口都保持不变。*/
 static void
-slave_loop(FILE *f, char *reply_buf, struct slave_state *sstate, bool resend)
+slave_share(struct slave_conn *c, double *start, double *end)
 {
-	char *to_send;
-	int last_cmd_count = 0;
-	int last_reply_id = -1;
-	int reply_slot = -1;
-    /*这个是循环等待命令，也就是一直等着是否有命令*/
-	for (;;) {
-		if (resend) {
-			/* Resend complete or partial history */
-            /*重新发送完整或部分历史记录，处理失败的情况　断线回复功能*/
-			to_send = next_command(last_reply_id);
-		} else {
-			/* Wait for a new command. */
-            /*等待新命令。*/
-			while (last_cmd_count == cmd_count)
-				pthread_cond_wait(&cmd_cond, &slave_lock);//条件等待，　产生一条命令就处理
-			to_send = gtp_cmd;//待发送的命令
+	double known = 0;
+	int nknown = 0;
+	for (int i = 0; i < max_conns; i++) {
+		if (!conns[i].active || !conns[i].rate) continue;
+		known += conns[i].rate;
+		nknown++;
+	}
+	double avg = nknown ? known / nknown : 1;
+	double before = 0, total = 0;
+	for (int i = 0; i < max_conns; i++) {
+		if (!conns[i].active && &conns[i] != c) continue;
+		double r = conns[i].rate ? conns[i].rate : avg;
+		if (&conns[i] == c) before = total;
+		total += r;
+	}
+	double own = c->rate ? c->rate : avg;
+	*start = share_min + (share_max - share_min) * before / total;
+	*end = share_min + (share_max - share_min) * (before + own) / total;
+}
+
+/* Update the rate and latency of a slave from a complete reply.
+ * slave_lock is held on both entry and exit of this function. */
+static void
+update_slave_perf(struct slave_conn *c)
+{
+	double now = time_now();
+	double latency = now - c->start;
+	c->latency = c->latency ? 0.8 * c->latency + 0.2 * latency : latency;
+
+	/* played_own of genmoves grows during a move. */
+	int played;
+	char *eol = strchr(c->in, '\n');
+	char *s = strchr(c->in, '@');
+	if (!s || s > eol || sscanf(c->in, "=%*d %d", &played) != 1) return;
+	if (c->reply_id == c->played_id && played > c->played && now > c->played_at) {
+		double rate = (played - c->played) / (now - c->played_at);
+		c->rate = c->rate ? 0.7 * c->rate + 0.3 * rate : rate;
+	}
+	c->played = played;
+	c->played_at = now;
+	c->played_id = c->reply_id;
+}
+
+/* Copy the commands from @history to the current one in @out, which has
+ * CMDS_SIZE bytes. The genmoves of past moves are left out: they only
+ * start a search which the next play stops, so a slave joining late
+ * just replays the moves. Return the copy of the current command. */
+static char *
+copy_history(char *out, char *history)
+{
+	char *o = out;
+	char *end = out + CMDS_SIZE - 1;
+	for (char *cmd = history; cmd < gtp_cmd; ) {
+		char *next = strchr(cmd, '\n');
+		next = next ? next + 1 : gtp_cmd;
+		char *name = cmd + strspn(cmd, "0123456789 ");
+		bool stale = (!strncasecmp(name, "pachi-genmoves ", 15)
+			      && reply_disabled(atoi(cmd)));
+		if (!stale && o + (next - cmd) < end) {
+			memcpy(o, cmd, next - cmd);
+			o += next - cmd;
 		}
+		cmd = next;
+	}
+	strncpy(o, gtp_cmd, end - o);
+	*end = '\0';
+	return o;
+}
 
-		/* Command available, send it to slave machine.
-		 * If slave was out of sync, send the history.
-		 * But first get binary arguments if necessary. */
-        /*命令可用，发送到从机。如果slave不同步，发送历史记录。但是如果需要，首先获取二进制参数。*/
-		int bin_size = 0;
-		void *bin_buf = get_binary_arg(sstate, gtp_cmd,
-					       gtp_cmds + CMDS_SIZE - gtp_cmd,
-					       &bin_size);
-		/* Check that the command is still valid. */
-        /*检查命令是否仍然有效。*/
-		resend = true;
-		if (!bin_buf) continue;
-
-		/* Send the command and get the reply, which always ends with \n\n
-		 * The slave machine sends "=id reply" or "?id reply"
-		 * with id == cmd_id if it is in sync. */
-        /*发送命令并获得答复，该答复始终以\n \n从机发送“=id reply”或“”结尾。id reply“如果它是同步的，id==cmd_id。*/
-		last_cmd_count = cmd_count;
-		char buf[CMDS_SIZE];
-        //发送命令
-		int reply_id = send_command(to_send, bin_buf, &bin_size, f,
-					    sstate, buf);
-		if (reply_id == -1) return;
-        //获得回复
-		resend = process_reply(reply_id, buf, reply_buf, bin_buf, bin_size,
-				       &last_reply_id, &reply_slot, sstate);
-	}
-}
-
-/* Minimimal check of slave identity. Close the file if error. */
+/* Prepare the command to send to the slave: the current command, or
+ * the history if it is out of sync, followed by binary arguments.
+ * The command is copied with the binary size set for this slave.
+ * Return false if the binary args became obsolete while computing them.
+ * slave_lock is held on both entry and exit of this function (but
+ * released while merging stats). */
 static bool
-is_pachi_slave(FILE *f, struct in_addr *client)
-{
-	char buf[1024];
-	fputs("name\n", f);
-	if (!fgets(buf, sizeof(buf), f)
-	    || strncasecmp(buf, "= Pachi", 7)
-	    || !fgets(buf, sizeof(buf), f)
-	    || strcmp(buf, "\n")) {
-		logline(client, "? ", "bad slave\n");
-		fclose(f);
-		sleep(1); // avoid busy loop if error
-		return false;
+prepare_command(struct slave_conn *c)
+{
+	c->bin_buf = get_binary_arg(&c->s, &c->bin_size);
+	if (!c->bin_buf) return false;
+	c->send_buf = c->bin_buf;
+	c->send_size = c->bin_size;
+	if (c->bin_size && c->wire != WIRE_RAW) {
+		c->send_buf = c->wire_buf;
+		c->send_size = wire_encode(c->wire, c->bin_buf,
+					   c->bin_size / sizeof(struct incr_stats), c->wire_buf, c->wire_tmp);
 	}
+
+	/* Send the history if the slave is out of sync, but also the
+	 * commands it missed if several were issued since its last reply:
+	 * slaves don't notice a missed play before pachi-genmoves.
+	 * gtp_cmd is always the last command of to_send. */
+	char *to_send = gtp_cmd;
+	if (c->last_reply_id != atoi(gtp_cmd))
+		to_send = next_command(c->last_reply_id);
+	char *last = copy_history(c->out, to_send);
+	char *s = strchr(last, '@');
+	if (s && balance) {
+		double start, end;
+		slave_share(c, &start, &end);
+		s += snprintf(s, c->out + CMDS_SIZE - s, "share=%.4f:%.4f ", start, end);
+	}
+	if (s) snprintf(s, c->out + CMDS_SIZE - s, "@%d\n", c->send_size);
+	c->out_len = strlen(c->out);
+	c->sent = 0;
+
+	/* The slave reads the binary args once it gets the command. */
+	if (c->shm && c->send_size) {
+		memcpy(c->shm, c->send_buf, c->send_size);
+		c->send_size = 0;
+	}
+
+	if (DEBUGL(1) && to_send != gtp_cmd)
+		logline(&c->s.client, "? ",
+			to_send == gtp_cmds ? "resend all\n" : "partial resend\n");
+
+	c->last_cmd_count = cmd_count;
+	c->resend = true;
 	return true;
 }
 
-/* Thread sending gtp commands to one slave machine, and
- * reading replies. If a slave machine dies, this thread waits
- * for a connection from another slave.
- * The large buffers are allocated only once we get a first
- * connection, to avoid wasting memory if max_slaves is too large.
- * We do not invalidate the received buffers if a slave disconnects;
- * they are still useful for other slaves. */
-/*线程将gtp命令发送到一个从机，并读取响应。如果一个从机死了，这个线程会等待另一个从机的连接。只有在我们第一次连接时才分配大的缓冲区，以避免在max_slaves太大时浪费内存。如果从机断开连接，我们不会使接收到的缓冲区失效；它们对其他从机仍然有用。*/
+#ifndef _WIN32
+
+/* Thread computing binary args (merging stats) for the I/O thread. */
 static void * __attribute__((noreturn))
-slave_thread(void *arg)
+merge_thread(void *arg)
+{
+	for (;;) {
+		pthread_mutex_lock(&job_lock);
+		while (!job_count)
+			pthread_cond_wait(&job_cond, &job_lock);
+		struct slave_conn *c = jobs[job_head];
+		job_head = (job_head + 1) % max_conns;
+		job_count--;
+		pthread_mutex_unlock(&job_lock);
+
+		protocol_lock();
+		c->prepared = prepare_command(c);
+		protocol_unlock();
+
+		pthread_mutex_lock(&job_lock);
+		merged[merged_count++] = c;
+		pthread_mutex_unlock(&job_lock);
+		wake_io_thread();
+	}
+}
+
+/* Hand a connection to the merge threads.
+ * slave_lock is held on both entry and exit of this function. */
+static void
+queue_merge(struct slave_conn *c)
+{
+	c->state = C_MERGING;
+	pthread_mutex_lock(&job_lock);
+	assert(job_count < max_conns);
+	jobs[(job_head + job_count++) % max_conns] = c;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+}
+
+/* Create the shared memory segment of a local slave: two halves of
+ * max_buf_size bytes. The name is removed once the slave has replied.
+ * Return false if not possible, the slave then uses the socket. */
+static bool
+shm_create(struct slave_conn *c)
+{
+	int size = 2 * c->s.max_buf_size;
+	snprintf(c->shm_name, sizeof(c->shm_name), "/pachi-%d-%d", (int)getpid(), c->s.thread_id);
+	int fd = shm_open(c->shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd == -1 && errno == EEXIST) {
+		shm_unlink(c->shm_name);
+		fd = shm_open(c->shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	if (fd == -1) return false;
+	void *p = MAP_FAILED;
+	if (ftruncate(fd, size) == 0)
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		shm_unlink(c->shm_name);
+		return false;
+	}
+	c->shm = p;
+	return true;
+}
+
+/* Remove the segment name, and unmap it too if not used. */
+static void
+shm_release(struct slave_conn *c, bool unmap)
+{
+	if (!c->shm) return;
+	if (*c->shm_name) shm_unlink(c->shm_name);
+	*c->shm_name = '\0';
+	if (unmap) {
+		munmap(c->shm, 2 * c->s.max_buf_size);
+		c->shm = NULL;
+	}
+}
+
+/* Close the connection with a slave, keeping its buffers for the
+ * next slave using the same slot. */
+static void
+conn_close(struct slave_conn *c)
+{
+	if (DEBUGL(2))
+		logline(&c->s.client, "= ", c->active ? "lost slave\n" : "bad slave\n");
+	if (!c->lost) poller_del(c->fd);
+	close(c->fd);
+	shm_release(c, true);
+	c->fd = -1;
+	c->active = false;
+	c->state = C_FREE;
+	c->event = E_NONE;
+	c->out_poll = false;
+}
+
+/* Write as much of the pending command as the socket accepts. */
+static void
+conn_write(struct slave_conn *c)
 {
-	struct slave_state sstate = default_sstate;
-	sstate.thread_id = (intptr_t)arg;
+	assert(c->state == C_SENDING || c->state == C_NAME || c->state == C_WIRE
+	       || c->state == C_SHM);
+	int total = c->out_len + c->send_size;
+	while (c->sent < total) {
+		struct iovec iov[2];
+		int n = 0;
+		if (c->sent < c->out_len) {
+			iov[n].iov_base = c->out + c->sent;
+			iov[n++].iov_len = c->out_len - c->sent;
+		}
+		if (c->send_size) {
+			int bin_sent = c->sent > c->out_len ? c->sent - c->out_len : 0;
+			iov[n].iov_base = (char *)c->send_buf + bin_sent;
+			iov[n++].iov_len = c->send_size - bin_sent;
+		}
+		struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n };
+		ssize_t len = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+		if (len == -1 && errno == EINTR) continue;
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (!c->out_poll) poller_mod(c->fd, c, true);
+			c->out_poll = true;
+			return;
+		}
+		if (len <= 0) {
+			c->event = E_LOST;
+			return;
+		}
+		c->sent += len;
+	}
+	if (c->out_poll) poller_mod(c->fd, c, false);
+	c->out_poll = false;
+
+	if (DEBUGV(strchr(c->out, '@'), 2)) {
+		char *s = DEBUGL(3) ? NULL : strchr(c->out, '\n');
+		char save = s ? s[1] : 0;
+		if (s) s[1] = '\0';
+		logline(&c->s.client, ">>", c->out);
+		if (s) s[1] = save;
+		if (c->send_size) {
+			char b[1024];
+			snprintf(b, sizeof(b), "sent cmd %d+%d bytes in %.4fms\n",
+				 c->out_len, c->send_size, (time_now() - c->start) * 1000);
+			logline(&c->s.client, "= ", b);
+		}
+	}
+
+	/* Reuse the binary buffer for the reply. */
+	c->start = time_now();
+	if (c->state == C_SENDING) c->state = C_RECEIVING;
+}
 
-	assert(sstate.slave_sock >= 0);
-	char reply_buf[CMDS_SIZE];
-	bool resend = false;
+/* Where the binary part of a reply is read. */
+static void *
+recv_buf(struct slave_conn *c)
+{
+	return c->wire == WIRE_RAW ? c->bin_buf : c->wire_buf;
+}
 
+/* The ascii part of the reply is complete. The reply ends with an
+ * empty line; if the first line contains "@size", a binary reply of
+ * size bytes follows the empty line. @size is not standard gtp, it is
+ * only used internally by Pachi for the genmoves command; it must be
+ * the last parameter on the line. Bytes already read past the empty
+ * line are moved to the binary buffer. Return false if error. */
+static bool
+reply_text_done(struct slave_conn *c, char *end)
+{
+	c->text_len = end - c->in;
+	char *eol = strchr(c->in, '\n');
+	char *s = strchr(c->in, '@');
+	c->bin_len = (s && s < eol) ? atoi(s + 1) : 0;
+
+	int extra = c->in_len - c->text_len;
+	int max = (c->wire == WIRE_RAW ? c->s.max_buf_size : c->wire_max);
+	if (c->bin_len > max || extra > c->bin_len) return false;
+	if (c->bin_len && c->state != C_RECEIVING && c->state != C_SENDING) return false;
+	if (c->shm && extra) return false;
+	if (extra) memcpy(recv_buf(c), end, extra);
+	c->bin_read = extra;
+	if (c->shm && c->bin_len) {
+		memcpy(c->bin_buf, c->shm + c->s.max_buf_size, c->bin_len);
+		c->bin_read = c->bin_len;
+	}
+	c->in[c->text_len] = '\0';
+	c->in_len = c->text_len;
+
+	c->reply_id = -1;
+	if ((*c->in == '=' || *c->in == '?') && isdigit(c->in[1]))
+		c->reply_id = atoi(c->in + 1);
+
+	if (DEBUGV(s && s < eol, 2)) {
+		char save = eol[1];
+		eol[1] = '\0';
+		logline(&c->s.client, "<<", c->in);
+		eol[1] = save;
+	}
+	if (DEBUGL(3) && eol[1] != '\n')
+		logline(&c->s.client, "<<", eol + 1);
+	return true;
+}
+
+/* Read what the slave sent. Set c->event when a reply is complete,
+ * or if the connection is lost. */
+static void
+conn_read(struct slave_conn *c)
+{
+	bool expected = (c->state == C_NAME || c->state == C_WIRE || c->state == C_SHM ||
+			 c->state == C_SENDING || c->state == C_RECEIVING);
+	for (;;) {
+		char *dst; int max;
+		if (!expected) {
+			/* Anything but EOF is a protocol error, drop it. */
+			char b[BSIZE];
+			dst = b; max = sizeof(b);
+			ssize_t len = recv(c->fd, dst, max, 0);
+			if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+			c->event = E_LOST;
+			return;
+		}
+		if (!c->text_len) {
+			dst = c->in + c->in_len;
+			max = CMDS_SIZE - 1 - c->in_len;
+		} else {
+			dst = (char *)recv_buf(c) + c->bin_read;
+			max = c->bin_len - c->bin_read;
+		}
+		if (max <= 0) {
+			c->event = E_LOST;  // reply too long
+			return;
+		}
+		ssize_t len = recv(c->fd, dst, max, 0);
+		if (len == -1 && errno == EINTR) continue;
+		if (len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		if (len <= 0) {
+			c->event = E_LOST;
+			return;
+		}
+		if (!c->text_len) {
+			int from = c->in_len ? c->in_len - 1 : 0;
+			c->in_len += len;
+			c->in[c->in_len] = '\0';
+			char *end = strstr(c->in + from, "\n\n");
+			if (!end) continue;
+			if (!reply_text_done(c, end + 2)) {
+				c->event = E_LOST;
+				return;
+			}
+		} else {
+			c->bin_read += len;
+		}
+		if (c->bin_read < c->bin_len) continue;
+
+		if (c->bin_len && DEBUGVV(2)) {
+			char b[1024];
+			snprintf(b, sizeof(b), "read reply %d+%d bytes in %.4fms\n",
+				 c->text_len, c->bin_len, (time_now() - c->start) * 1000);
+			logline(&c->s.client, "= ", b);
+		}
+		c->recv_bytes = c->text_len + (c->shm ? 0 : c->bin_len);
+		if (c->bin_len && c->wire != WIRE_RAW) {
+			int max_nodes = c->s.max_buf_size / sizeof(struct incr_stats);
+			int nodes = wire_decode(c->wire, c->wire_buf, c->bin_len, c->bin_buf, max_nodes, c->wire_tmp);
+			if (nodes <= 0) {
+				c->event = E_LOST;
+				return;
+			}
+			c->bin_len = nodes * sizeof(struct incr_stats);
+		}
+		c->event = (c->state == C_SENDING || c->state == C_RECEIVING ? E_REPLY : E_HANDSHAKE);
+		return;
+	}
+}
+
+/* Accept all pending slave connections and start the handshake
+ * (minimal check of slave identity). The large buffers are allocated
+ * only once we get a first connection on a slot, to avoid wasting
+ * memory if max_slaves is too large. */
+static void
+accept_slaves(void)
+{
 	for (;;) {
-		/* Wait for a connection from any slave. */
-        /*等待任何从机的连接。*/
 		struct in_addr client;
-        //等待连接
-		int conn = open_server_connection(sstate.slave_sock, &client);
+		int fd = open_server_connection(default_sstate.slave_sock, &client);
+		if (fd < 0) return;
+
+		struct slave_conn *c = NULL;
+		for (int i = 0; i < max_conns && !c; i++)
+			if (conns[i].state == C_FREE) c = &conns[i];
+		if (!c) {
+			logline(&client, "? ", "too many slaves\n");
+			close(fd);
+			continue;
+		}
 
-		FILE *f = fdopen(conn, "r+");
+		/* We do not invalidate the received buffers if a slave disconnects;
+		 * they are still useful for other slaves, and for the new slave
+		 * of the slot which doesn't own them: get_free_buf() gives the
+		 * ownership back only when a buffer is reused. A slave reusing
+		 * a slot gets the command history right away. */
+		c->resend = c->out != NULL;
+		for (int n = 0; c->out && n < BUFFERS_PER_SLAVE; n++)
+			c->s.b[n].owner = -1;
+		/* Its first stats are all those of the current move. */
+		c->s.last_processed = -1;
+		c->s.stats_age = -1;
+		if (!c->out) {
+			slave_state_alloc(&c->s);
+			c->out = malloc2(CMDS_SIZE);
+			c->in = malloc2(CMDS_SIZE);
+			c->reply_buf = malloc2(CMDS_SIZE);
+			int max_nodes = c->s.max_buf_size / sizeof(struct incr_stats);
+			c->wire_max = wire_max_size(max_nodes);
+			c->wire_buf = malloc2(c->wire_max);
+			c->wire_tmp = malloc2(wire_tmp_size(max_nodes));
+		}
 		if (DEBUGL(2)) {
-			snprintf(reply_buf, sizeof(reply_buf),
-				 "new slave, id %d\n", sstate.thread_id);
-			logline(&client, "= ", reply_buf);
+			char b[1024];
+			snprintf(b, sizeof(b), "new slave, id %d\n", c->s.thread_id);
+			logline(&client, "= ", b);
 		}
-		if (!is_pachi_slave(f, &client)) continue;
-
-		if (!resend) slave_state_alloc(&sstate);
-		sstate.client = client;
-        //设置一个从机锁　配合条件等待锁的
-		pthread_mutex_lock(&slave_lock);
-		active_slaves++;//活动的从机数量加一
-        //一旦他和某个从机连接起来之后，的通讯
-		slave_loop(f, reply_buf, &sstate, resend);
-
-		assert(active_slaves > 0);
-		active_slaves--;
-		// Unblock main thread if it was waiting for this slave.
-		pthread_cond_signal(&reply_cond);
-		pthread_mutex_unlock(&slave_lock);
-
-		resend = true;
-		if (DEBUGL(2))
-			logline(&client, "= ", "lost slave\n");
-		fclose(f);
+		set_nonblocking(fd);
+		c->fd = fd;
+		c->s.client = client;
+		c->last_cmd_count = 0;
+		c->last_reply_id = -1;
+		c->reply_slot = -1;
+		c->lost = false;
+		c->in_len = c->text_len = 0;
+		c->wire = WIRE_RAW;
+		c->rate = c->latency = 0;
+		c->played_id = -1;
+
+		c->state = C_NAME;
+		strcpy(c->out, "name\n");
+		c->out_len = strlen(c->out);
+		c->send_size = c->sent = 0;
+		poller_add(fd, c);
+		conn_write(c);
+		if (c->event == E_LOST) conn_close(c);
+	}
+}
+
+/* Process the events of one batch, then give the current command to
+ * all idle slaves. Slaves ready to send are added to sending[].
+ * Return the number of slaves in sending[].
+ * slave_lock is held on both entry and exit of this function. */
+static int
+process_batch(struct slave_conn **ready, int nready, struct slave_conn **sending)
+{
+	bool signal = false;
+	int nsending = 0;
+
+	for (int i = 0; i < nready; i++) {
+		struct slave_conn *c = ready[i];
+		switch (c->event) {
+			case E_HANDSHAKE:
+				if (c->state == C_NAME) {
+					/* Minimal check of slave identity. */
+					if (strncasecmp(c->in, "= Pachi", 7)) {
+						conn_close(c);
+						break;
+					}
+					/* Old slaves reply with an error, or ignore
+					 * the node keys. */
+					c->state = C_WIRE;
+					snprintf(c->out, CMDS_SIZE, "pachi-wire %d%s\n", wire_max,
+						 node_keys == NODE_KEYS_HASH ? " hash" : "");
+					c->out_len = strlen(c->out);
+					c->send_size = c->sent = 0;
+					sending[nsending++] = c;
+					break;
+				}
+				if (c->state == C_SHM) {
+					/* Old slaves reply with an error. */
+					bool ok = (*c->in == '=');
+					shm_release(c, !ok);
+					if (ok) c->wire = WIRE_RAW;
+					if (DEBUGL(2))
+						logline(&c->s.client, "= ", ok ? "using shared memory\n"
+							: "shared memory refused\n");
+				} else {
+					if (*c->in == '=') {
+						int f = atoi(c->in + 1);
+						if (f > WIRE_RAW && f <= (int)wire_max) c->wire = f;
+					}
+					/* Only relays use hash keys unasked. */
+					bool hash = (*c->in == '=' && strstr(c->in, " hash"));
+					if (hash != (node_keys == NODE_KEYS_HASH)) {
+						logline(&c->s.client, "? ", "slave uses other node keys\n");
+						conn_close(c);
+						break;
+					}
+					/* Local slave, try shared memory. */
+					if (use_shm && (ntohl(c->s.client.s_addr) >> 24) == 127
+					    && shm_create(c)) {
+						c->state = C_SHM;
+						snprintf(c->out, CMDS_SIZE, "pachi-shm %s %d\n",
+							 c->shm_name, c->s.max_buf_size);
+						c->out_len = strlen(c->out);
+						c->send_size = c->sent = 0;
+						sending[nsending++] = c;
+						break;
+					}
+				}
+				c->active = true;
+				active_slaves++;
+				c->state = C_IDLE;
+				break;
+			case E_REPLY:
+				update_slave_perf(c);
+				protocol_counts.bytes_in += c->recv_bytes;
+				protocol_counts.nodes_in += c->bin_len / sizeof(struct incr_stats);
+				c->resend = process_reply(c->reply_id, c->in, c->reply_buf,
+							  c->bin_buf, c->bin_len, &c->last_reply_id,
+							  &c->reply_slot, &c->s);
+				signal = true;
+				c->state = C_IDLE;
+				break;
+			case E_MERGED:
+				if (c->prepared) {
+					c->state = C_SENDING;
+					sending[nsending++] = c;
+				} else {
+					c->state = C_IDLE;
+				}
+				break;
+			case E_LOST:
+				if (c->active) {
+					assert(active_slaves > 0);
+					active_slaves--;
+					// Unblock main thread if it was waiting for this slave.
+					signal = true;
+				}
+				conn_close(c);
+				break;
+			case E_NONE:
+				assert(0);
+		}
+		c->event = E_NONE;
+		c->in_len = c->text_len = 0;
+	}
+
+	/* Send the new command, or the history if out of sync. */
+	for (int i = 0; gtp_cmd && i < max_conns; i++) {
+		struct slave_conn *c = &conns[i];
+		if (c->state != C_IDLE) continue;
+		if (!c->resend && c->last_cmd_count == cmd_count) continue;
+
+		if (needs_merge(c)) {
+			queue_merge(c);
+		} else {
+			prepare_command(c);
+			c->state = C_SENDING;
+			sending[nsending++] = c;
+		}
+	}
+
+	for (int i = 0; i < nsending; i++) {
+		struct slave_conn *c = sending[i];
+		c->sent_bytes = c->out_len + c->send_size;
+		protocol_counts.bytes_out += c->sent_bytes;
+		if (c->state == C_SENDING)
+			protocol_counts.nodes_out += c->bin_size / sizeof(struct incr_stats);
+	}
+
+	if (signal) pthread_cond_signal(&reply_cond);
+	return nsending;
+}
+
+/* Thread serving all slave machines: sends gtp commands, reads replies.
+ * Resends command history if a slave machine is out of sync. If a slave
+ * machine dies, its slot waits for a connection from another slave. */
+static void * __attribute__((noreturn))
+io_thread(void *arg)
+{
+	struct slave_conn *ready[MAX_EVENTS + 3 * max_conns];
+	struct slave_conn *sending[max_conns];
+	struct slave_conn *delayed[max_conns];
+	struct slave_conn *lost[max_conns];
+	int ndelayed = 0, nlost = 0;
+
+	for (;;) {
+		/* Wait at most until the next delayed reply is due. */
+		int timeout = -1;
+		double now = time_now();
+		for (int i = 0; i < ndelayed; i++) {
+			int ms = delayed[i]->due > now ? (int)((delayed[i]->due - now) * 1000) + 1 : 0;
+			if (timeout < 0 || ms < timeout) timeout = ms;
+		}
+
+		struct io_event events[MAX_EVENTS];
+		int n = poller_wait(events, timeout);
+		int nready = 0;
+		bool wake = false;
+
+		/* Connections lost while sending the last batch. The poll
+		 * loop below skips them since their event is set. */
+		for (int i = 0; i < nlost; i++)
+			ready[nready++] = lost[i];
+		nlost = 0;
+
+		now = time_now();
+		for (int i = 0; i < ndelayed; i++) {
+			if (delayed[i]->due > now) continue;
+			poller_add(delayed[i]->fd, delayed[i]);
+			ready[nready++] = delayed[i];
+			delayed[i--] = delayed[--ndelayed];
+		}
+
+		for (int i = 0; i < n; i++) {
+			if (events[i].tag == &listen_tag) {
+				accept_slaves();
+				continue;
+			}
+			if (events[i].tag == &wake_tag) {
+				char b[256];
+				while (read(wake_pipe[0], b, sizeof(b)) > 0)
+					;
+				wake = true;
+				continue;
+			}
+			struct slave_conn *c = events[i].tag;
+			if (c->state == C_FREE || c->event != E_NONE) continue;
+			if (events[i].out) conn_write(c);
+			if (events[i].in && c->event == E_NONE) conn_read(c);
+			if (c->event == E_NONE) continue;
+
+			if (c->event == E_REPLY && (sim_latency || sim_bandwidth)) {
+				c->due = c->start + 2 * sim_latency;
+				if (sim_bandwidth)
+					c->due += (c->sent_bytes + c->recv_bytes) / sim_bandwidth;
+				if (c->due > now) {
+					/* Events are level triggered: a slave closing
+					 * its end meanwhile would wake us up until the
+					 * reply is due. */
+					poller_del(c->fd);
+					delayed[ndelayed++] = c;
+					continue;
+				}
+			}
+
+			/* The merge thread owns the connection, finish later. */
+			if (c->state == C_MERGING) {
+				c->lost = true;
+				c->event = E_NONE;
+				poller_del(c->fd);
+				continue;
+			}
+			ready[nready++] = c;
+		}
+
+		/* Connections done merging. */
+		pthread_mutex_lock(&job_lock);
+		for (int i = 0; i < merged_count; i++) {
+			struct slave_conn *c = merged[i];
+			c->event = c->lost ? E_LOST : E_MERGED;
+			ready[nready++] = c;
+		}
+		merged_count = 0;
+		pthread_mutex_unlock(&job_lock);
+
+		if (!nready && !wake) continue;
+
+		protocol_lock();
+		int nsending = process_batch(ready, nready, sending);
+		protocol_unlock();
+
+		for (int i = 0; i < nsending; i++) {
+			struct slave_conn *c = sending[i];
+			c->start = time_now();
+			conn_write(c);
+			/* Lost connections are closed at the next batch. */
+			if (c->event == E_LOST) lost[nlost++] = c;
+		}
+		if (nlost) wake_io_thread();
 	}
-	pthread_exit(NULL);
 }
 
+#endif /* !_WIN32 */
+
 /* Create a new gtp command for all slaves. The slave lock is held
  * upon entry and upon return, so the command will actually be
  * sent when the lock is released. The last command is overwritten
@@ -599,9 +1394,8 @@ update_cmd(struct board *b, char *cmd, char *args, bool new_id)
 		last->gtp_id = gtp_id;
 		last->next_cmd = NULL;
 	}
-	// Notify the slave threads about the new command.
-    //通知从线程有关新命令的信息。
-	pthread_cond_broadcast(&cmd_cond);//条件信号的广播
+	// Notify the I/O thread about the new command.
+	wake_io_thread();
 }
 
 /* Update the command history, then create a new gtp command
@@ -671,19 +1465,133 @@ get_replies(double time_limit, int min_replies)
 	assert(reply_count > 0);
 }
 
+/* Time to wait for min_replies replies: twice the latency of the
+ * min_replies-th fastest slave, at most max_wait. Slaves with
+ * unknown latency are assumed to need max_wait.
+ * slave_lock is held on both entry and exit of this function. */
+double
+reply_wait(int min_replies, double max_wait)
+{
+	if (!balance || min_replies <= 0) return max_wait;
+	double lat[max_conns];
+	int n = 0;
+	for (int i = 0; i < max_conns; i++) {
+		if (!conns[i].active) continue;
+		lat[n++] = conns[i].latency ? conns[i].latency : max_wait;
+	}
+	if (n < min_replies) return max_wait;
+	/* Partial selection sort, min_replies is small. */
+	for (int k = 0; k < min_replies; k++) {
+		for (int i = k + 1; i < n; i++) {
+			if (lat[i] < lat[k]) {
+				double t = lat[k]; lat[k] = lat[i]; lat[i] = t;
+			}
+		}
+	}
+	double wait = 2 * lat[min_replies - 1];
+	return wait < max_wait ? wait : max_wait;
+}
+
+/* Log the speed and share of each slave. */
+void
+log_slave_perf(void)
+{
+	protocol_lock();
+	for (int i = 0; i < max_conns; i++) {
+		struct slave_conn *c = &conns[i];
+		if (!c->active) continue;
+		double start = 0, end = 0;
+		if (balance) slave_share(c, &start, &end);
+		char b[1024];
+		snprintf(b, sizeof(b), "%d playouts/s, latency %.1fms, share %.3f-%.3f\n",
+			 (int)c->rate, c->latency * 1000, start, end);
+		logline(&c->s.client, "= ", b);
+	}
+	protocol_unlock();
+}
+
+/* Relays: part of the root children given by the parent master,
+ * to be divided among our slaves.
+ * slave_lock is held on both entry and exit of this function. */
+void
+set_share_range(double start, double end)
+{
+	share_min = start;
+	share_max = end;
+}
+
+/* Relays only: insert the stats received from the parent master
+ * in the receive queue, so that the children get them.
+ * slave_lock is held on both entry and exit of this function. */
+void
+insert_parent_stats(struct incr_stats *stats, int nodes)
+{
+	assert(relay);
+	if (!nodes) return;
+	void *buf = get_free_buf(&parent_sstate);
+	int size = nodes * sizeof(*stats);
+	assert(size <= parent_sstate.max_buf_size);
+	memcpy(buf, stats, size);
+	insert_buf(&parent_sstate, buf, size);
+}
+
+/* Relays only: get in buf the stats of the children not yet sent to
+ * the parent master. buf must have max_buf_size bytes.
+ * Return the byte size of the stats.
+ * slave_lock is held on both entry and exit of this function. */
+int
+get_parent_stats(struct incr_stats *buf)
+{
+	assert(relay);
+	return parent_sstate.args_hook(buf, &parent_sstate, atoi(gtp_cmd));
+}
+
+/* Enable load balancing between slaves of different speeds.
+ * Must be called before protocol_init(). */
+void
+protocol_balance(bool on)
+{
+	balance = on;
+}
+
+/* Offer stats formats up to @max to the slaves (default: the best
+ * format of this build). Must be called before protocol_init(). */
+void
+protocol_wire(enum wire_format max)
+{
+	wire_max = max;
+}
+
+/* Simulate links with the given one way latency (seconds) and
+ * bandwidth (bytes/s, zero for unlimited). Shared memory is not
+ * used then. Must be called before protocol_init(). */
+void
+protocol_sim_link(double latency, double bandwidth)
+{
+	sim_latency = latency;
+	sim_bandwidth = bandwidth;
+}
+
 /* In a 5mn move with at least 5ms per genmoves we get at most
  * 300*200=60000 genmoves per slave. */
 #define MAX_GENMOVES_PER_SLAVE 60000
 
-/* Allocate the receive queue, and create the slave and proxy threads.
+/* Allocate the receive queue, and create the I/O, merge and proxy threads.
  * max_buf_size and the merge-related fields of default_sstate must
  * already be initialized. */
 void
-protocol_init(char *slave_port, char *proxy_port, int max_slaves)
+protocol_init(char *slave_port, char *proxy_port, int max_slaves,
+	      int merge_threads, enum node_keys keys, bool shm, bool is_relay)
 {
+#ifdef _WIN32
+	die("distributed: not supported on this platform\n");
+#else
 	start_time = time_now();
+	node_keys = keys;
+	use_shm = shm && !sim_latency && !sim_bandwidth;
 
-	queue_max_length = max_slaves * MAX_GENMOVES_PER_SLAVE;
+	relay = is_relay;
+	queue_max_length = (max_slaves + relay) * MAX_GENMOVES_PER_SLAVE;
 	receive_queue = calloc2(queue_max_length, sizeof(*receive_queue));
     //设置监听端口的套接字
 	default_sstate.slave_sock = port_listen(slave_port, max_slaves);
@@ -692,16 +1600,42 @@ protocol_init(char *slave_port, char *proxy_port, int max_slaves)
 	for (int n = 0; n < BUFFERS_PER_SLAVE; n++) {
 		default_sstate.b[n].queue_index = -1;
 	}
-    //开启线程，每个线程处理一个从机
-	pthread_t thread;
-	for (int id = 0; id < max_slaves; id++) {
-		pthread_create(&thread, NULL, slave_thread, (void *)(intptr_t)id);
+
+	max_conns = max_slaves;
+	conns = calloc2(max_conns, sizeof(*conns));
+	for (int id = 0; id < max_conns; id++) {
+		conns[id].s = default_sstate;
+		conns[id].s.thread_id = id;
+		conns[id].fd = -1;
+	}
+	jobs = calloc2(max_conns, sizeof(*jobs));
+	merged = calloc2(max_conns, sizeof(*merged));
+
+	if (relay) {
+		parent_sstate = default_sstate;
+		parent_sstate.thread_id = max_conns;
+		slave_state_alloc(&parent_sstate);
 	}
 
+	if (pipe(wake_pipe) == -1) fail("pipe");
+	set_nonblocking(wake_pipe[0]);
+	set_nonblocking(wake_pipe[1]);
+	set_nonblocking(default_sstate.slave_sock);
+
+	poller_init(max_conns + 2);
+	poller_add(default_sstate.slave_sock, &listen_tag);
+	poller_add(wake_pipe[0], &wake_tag);
+
+	pthread_t thread;
+	pthread_create(&thread, NULL, io_thread, NULL);
+	for (int i = 0; i < merge_threads || !i; i++)
+		pthread_create(&thread, NULL, merge_thread, NULL);
+
 	if (proxy_port) {
 		int proxy_sock = port_listen(proxy_port, max_slaves);
 		for (int id = 0; id < max_slaves; id++) {
 			pthread_create(&thread, NULL, proxy_thread, (void *)(intptr_t)proxy_sock);
 		}
 	}
+#endif
 }
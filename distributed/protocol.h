@@ -10,9 +10,11 @@
 #endif
 
 #include "board.h"
+#include "distributed/distributed.h"
+#include "distributed/wire.h"
 
 
-/* Each slave thread maintains a ring of 256 buffers holding
+/* Each slave connection maintains a ring of 256 buffers holding
  * incremental stats received from the slave. The oldest
  * buffer is recycled to hold stats sent to the slave and
  * received the next reply. */
@@ -36,7 +38,7 @@ struct buf_state {
 
 struct slave_state {
 	int max_buf_size;
-	int thread_id;
+	int thread_id;  // slave slot, owner of its buffers
 	struct in_addr client; // for debugging only
 	state_alloc_hook alloc_hook;
 	buffer_hook insert_hook;
@@ -54,12 +56,12 @@ struct slave_state {
 
 	/* --- PRIVATE DATA for merge.c --- */
 
-	/* Hash table of incremental stats. */
+	/* Hash table of the stats known by the slave. */
 	struct incr_stats *stats_htable;
 	int stats_hbits;
-	int stats_id;
+	int stats_age;	/* queue_age of the hash table contents. */
 
-	/* Hash indices updated by stats merge. */
+	/* Shared table indices of candidate nodes. */
 	int *merged;
 	int max_merged_nodes;
 };
@@ -74,7 +76,24 @@ void clear_receive_queue(void);
 void update_cmd(struct board *b, char *cmd, char *args, bool new_id);
 void new_cmd(struct board *b, char *cmd, char *args);
 void get_replies(double time_limit, int min_replies);
-void protocol_init(char *slave_port, char *proxy_port, int max_slaves);
+void protocol_init(char *slave_port, char *proxy_port, int max_slaves,
+		   int merge_threads, enum node_keys keys, bool shm, bool relay);
+void protocol_balance(bool on);
+void protocol_wire(enum wire_format max);
+void protocol_sim_link(double latency, double bandwidth);
+double reply_wait(int min_replies, double max_wait);
+void log_slave_perf(void);
+void set_share_range(double start, double end);
+void insert_parent_stats(struct incr_stats *stats, int nodes);
+int get_parent_stats(struct incr_stats *buf);
+
+/* Traffic with the slaves since the start, bytes through the sockets
+ * and nodes of the binary stats. Updated with slave_lock held. */
+struct protocol_counts {
+	long long bytes_out, bytes_in;
+	long long nodes_out, nodes_in;
+};
+extern struct protocol_counts protocol_counts;
 
 extern int reply_count;
 extern char **gtp_replies;
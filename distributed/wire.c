@@ -0,0 +1,175 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "util.h"
+#include "distributed/wire.h"
+
+/* Paths of consecutive nodes share their high bits so the deltas are
+ * small, 1-3 bytes. Playout increments take 1-2 bytes. A value is an
+ * average of playout results, 16 bits are more than enough. So a node
+ * takes 4-7 bytes instead of 16 for struct incr_stats. */
+
+#define VALUE_SCALE 65535
+
+/* varint(path) + varint(playouts) + 2 */
+#define MAX_PACKED_NODE (10 + 5 + 2)
+
+static inline uint8_t *
+put_varint(uint8_t *p, uint64_t x)
+{
+	while (x >= 0x80) {
+		*p++ = x | 0x80;
+		x >>= 7;
+	}
+	*p++ = x;
+	return p;
+}
+
+/* Return NULL if truncated or too long. */
+static inline uint8_t *
+get_varint(uint8_t *p, uint8_t *end, uint64_t *x)
+{
+	*x = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t c = *p++;
+		*x |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) return p;
+	}
+	return NULL;
+}
+
+static int
+packed_encode(struct incr_stats *stats, int nodes, uint8_t *out)
+{
+	uint8_t *p = out;
+	path_t prev = 0;
+	for (int i = 0; i < nodes; i++) {
+		assert(stats[i].coord_path > prev && stats[i].incr.playouts > 0);
+		p = put_varint(p, stats[i].coord_path - prev);
+		p = put_varint(p, stats[i].incr.playouts);
+		prev = stats[i].coord_path;
+
+		/* With virtual loss the increment may be slightly off [0,1]. */
+		floating_t v = stats[i].incr.value;
+		int q = v <= 0 ? 0 : v >= 1 ? VALUE_SCALE : (int)(v * VALUE_SCALE + 0.5);
+		*p++ = q;
+		*p++ = q >> 8;
+	}
+	return p - out;
+}
+
+static int
+packed_decode(uint8_t *in, int size, struct incr_stats *stats, int max_nodes)
+{
+	uint8_t *p = in, *end = in + size;
+	path_t prev = 0;
+	int n = 0;
+	while (p < end) {
+		uint64_t delta, playouts;
+		if (n >= max_nodes) return -1;
+		if (!(p = get_varint(p, end, &delta)) || !delta) return -1;
+		if (!(p = get_varint(p, end, &playouts)) || !playouts || playouts > INT32_MAX) return -1;
+		if (end - p < 2) return -1;
+		if (delta > (uint64_t)(PATH_T_MAX - prev)) return -1;
+
+		stats[n].coord_path = prev += delta;
+		stats[n].incr.playouts = playouts;
+		stats[n].incr.value = (floating_t)(p[0] | p[1] << 8) / VALUE_SCALE;
+		p += 2;
+		n++;
+	}
+	return n;
+}
+
+int
+wire_max_size(int nodes)
+{
+	int packed = nodes * MAX_PACKED_NODE;
+	/* LZ4_COMPRESSBOUND() plus the packed size. */
+	int lz4 = packed + packed / 255 + 16 + 5;
+	int raw = nodes * (int)sizeof(struct incr_stats);
+	return lz4 > raw ? lz4 : raw;
+}
+
+int
+wire_tmp_size(int nodes)
+{
+	/* The packed stream of WIRE_LZ4. */
+	return nodes * MAX_PACKED_NODE + 1;
+}
+
+int
+wire_encode(enum wire_format f, struct incr_stats *stats, int nodes, void *out, void *tmp)
+{
+	if (!nodes) return 0;
+	switch (f) {
+		case WIRE_RAW:
+			memcpy(out, stats, nodes * sizeof(*stats));
+			return nodes * sizeof(*stats);
+		case WIRE_PACKED:
+			return packed_encode(stats, nodes, out);
+#ifdef HAVE_LZ4
+		case WIRE_LZ4: {
+			int size = packed_encode(stats, nodes, tmp);
+			uint8_t *p = put_varint(out, size);
+			int max = wire_max_size(nodes) - (p - (uint8_t *)out);
+			int len = LZ4_compress_default(tmp, (char *)p, size, max);
+			assert(len > 0);
+			return p + len - (uint8_t *)out;
+		}
+#endif
+		default:
+			assert(0);
+	}
+	return 0;
+}
+
+int
+wire_decode(enum wire_format f, void *in, int size, struct incr_stats *stats, int max_nodes, void *tmp)
+{
+	if (!size) return 0;
+	switch (f) {
+		case WIRE_RAW:
+			if (size % sizeof(*stats) || size / (int)sizeof(*stats) > max_nodes) return -1;
+			memcpy(stats, in, size);
+			return size / sizeof(*stats);
+		case WIRE_PACKED:
+			return packed_decode(in, size, stats, max_nodes);
+#ifdef HAVE_LZ4
+		case WIRE_LZ4: {
+			uint64_t packed_size;
+			uint8_t *p = get_varint(in, (uint8_t *)in + size, &packed_size);
+			if (!p || !packed_size || packed_size > (uint64_t)max_nodes * MAX_PACKED_NODE) return -1;
+			int len = LZ4_decompress_safe((char *)p, tmp, (uint8_t *)in + size - p, packed_size);
+			return len == (int)packed_size ? packed_decode(tmp, len, stats, max_nodes) : -1;
+		}
+#endif
+		default:
+			return -1;
+	}
+}
+
+/* Read and discard any binary arguments. The number of
+ * bytes to be skipped is given by @size in the command. */
+void
+discard_bin_args(char *args)
+{
+	char *s = strchr(args, '@');
+	int size = 0;
+	if (s) size = atoi(s+1);
+	while (size) {
+		char buf[64*1024];
+		int len = sizeof(buf);
+		if (len > size) len = size;
+		len = fread(buf, 1, len, stdin);
+		if (len <= 0) break;
+		size -= len;
+	}
+}
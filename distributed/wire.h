@@ -0,0 +1,48 @@
+#ifndef PACHI_DISTRIBUTED_WIRE_H
+#define PACHI_DISTRIBUTED_WIRE_H
+
+/* Encoding of the binary incr_stats arrays exchanged between master and
+ * slaves. The format is negotiated per slave with "pachi-wire" when the
+ * slave connects; slaves not knowing the command get WIRE_RAW. */
+
+#include "distributed/distributed.h"
+
+enum wire_format {
+	/* Array of struct incr_stats, master and slave must have
+	 * the same architecture. */
+	WIRE_RAW,
+	/* For each node sorted by coord path: varint path delta,
+	 * varint playouts, value quantized to 16 bits. */
+	WIRE_PACKED,
+	/* WIRE_PACKED compressed with LZ4, after the varint packed size. */
+	WIRE_LZ4,
+};
+
+/* Best format of this build. */
+#ifdef HAVE_LZ4
+#define WIRE_MAX WIRE_LZ4
+#else
+#define WIRE_MAX WIRE_PACKED
+#endif
+
+/* Max encoded size of @nodes stats, for any format. */
+int wire_max_size(int nodes);
+
+/* Size of the scratch buffer @tmp of wire_encode() and wire_decode()
+ * for up to @nodes stats. Callers keep one per connection so that
+ * nothing is allocated per command. */
+int wire_tmp_size(int nodes);
+
+/* Encode stats[0..nodes-1], sorted by increasing coord path, into @out
+ * which must have wire_max_size(nodes) bytes. Return the encoded size. */
+int wire_encode(enum wire_format f, struct incr_stats *stats, int nodes, void *out, void *tmp);
+
+/* Decode @size bytes from @in into stats[0..max_nodes-1], @tmp must
+ * have wire_tmp_size(max_nodes) bytes.
+ * Return the number of nodes, or -1 if the input is invalid. */
+int wire_decode(enum wire_format f, void *in, int size, struct incr_stats *stats, int max_nodes, void *tmp);
+
+/* Read and discard the binary args of a gtp command from stdin. */
+void discard_bin_args(char *args);
+
+#endif
@@ -46,7 +46,7 @@ struct engine *
 engine_dcnn_init(char *arg, struct board *b)
 {
 	dcnn_init();
-	if (!caffe_ready()) {
+	if (!dcnn_ready()) {
 		fprintf(stderr, "Couldn't initialize dcnn, aborting.\n");
 		abort();
 	}
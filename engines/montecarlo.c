@@ -9,6 +9,7 @@
 #include "engines/josekibase.h"
 #include "move.h"
 #include "playout/moggy.h"
+#include "playout/gamma.h"
 #include "playout/light.h"
 #include "engines/montecarlo.h"
 #include "playout.h"
@@ -267,6 +268,8 @@ montecarlo_state_init(char *arg, struct board *b)
 					mc->playout = playout_moggy_init(playoutarg, b, mc->jdict);
 				} else if (!strcasecmp(optval, "light")) {
 					mc->playout = playout_light_init(playoutarg, b);
+				} else if (!strcasecmp(optval, "gamma")) {
+					mc->playout = playout_gamma_init(playoutarg, b);
 				} else {
 					fprintf(stderr, "MonteCarlo: Invalid playout policy %s\n", optval);
 				}
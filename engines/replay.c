@@ -9,6 +9,7 @@
 #include "move.h"
 #include "playout.h"
 #include "engines/josekibase.h"
+#include "playout/gamma.h"
 #include "playout/light.h"
 #include "playout/moggy.h"
 #include "engines/replay.h"
@@ -25,11 +26,13 @@ struct replay {
 static void
 suicide_stats(int suicide)
 {
+	/* Several engines may run at once (t-predict threads). */
 	static int total = 0;
 	static int suicides = 0;
-	if (suicide) suicides++;
-	if (++total % 100 == 0)
-		fprintf(stderr, "Suicides: %i/%i (%i%%)\n", suicides, total, suicides * 100 / total);
+	int s = (suicide ? __sync_add_and_fetch(&suicides, 1) : suicides);
+	int t = __sync_add_and_fetch(&total, 1);
+	if (t % 100 == 0)
+		fprintf(stderr, "Suicides: %i/%i (%i%%)\n", s, t, s * 100 / t);
 }
 
 coord_t
@@ -179,6 +182,8 @@ replay_state_init(char *arg, struct board *b)
 					r->playout = playout_moggy_init(playoutarg, b, r->jdict);
 				} else if (!strcasecmp(optval, "light")) {
 					r->playout = playout_light_init(playoutarg, b);
+				} else if (!strcasecmp(optval, "gamma")) {
+					r->playout = playout_gamma_init(playoutarg, b);
 				} else {
 					fprintf(stderr, "Replay: Invalid playout policy %s\n", optval);
 				}
@@ -7,6 +7,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/uio.h>
+#endif
 
 #include "board.h"
 #include "debug.h"
@@ -14,6 +18,7 @@
 #include "fbook.h"
 #include "gtp.h"
 #include "mq.h"
+#include "playout/moggy.h"
 #include "uct/uct.h"
 #include "version.h"
 #include "timeinfo.h"
@@ -372,6 +377,44 @@ cmd_genmove(struct board *board, struct engine *engine, struct time_info *ti, gt
 	return P_OK;
 }
 
+/* Reply to pachi-genmoves with the binary stats after the text,
+ * in a single write and without copying the stats to stdout buffer. */
+static void
+gtp_reply_stats(gtp_t *gtp, char *reply, void *stats, int stats_size)
+{
+#ifndef _WIN32
+	if (gtp->id != NO_REPLY) {
+		char prefix[16];
+		int len = (gtp->id >= 0 ? snprintf(prefix, sizeof(prefix), "=%d ", gtp->id)
+			   : snprintf(prefix, sizeof(prefix), "= "));
+		struct iovec iov[] = {
+			{ prefix, len }, { reply, strlen(reply) }, { "\n\n", 2 }, { stats, stats_size },
+		};
+		struct iovec *v = iov;
+		int n = sizeof(iov) / sizeof(iov[0]);
+		gtp->replied = true;
+		fflush(stdout);
+		while (n) {
+			ssize_t w = writev(fileno(stdout), v, n);
+			if (w < 0) {
+				if (errno == EINTR) continue;
+				return;
+			}
+			for (; n && w >= (ssize_t)v->iov_len; v++, n--)
+				w -= v->iov_len;
+			if (n) {
+				v->iov_base = (char *)v->iov_base + w;
+				v->iov_len -= w;
+			}
+		}
+		return;
+	}
+#endif
+	gtp_reply(gtp, reply, NULL);
+	fwrite(stats, 1, stats_size, stdout);
+	fflush(stdout);
+}
+
 static enum parse_code
 cmd_pachi_genmoves(struct board *board, struct engine *engine, struct time_info *ti, gtp_t *gtp)
 {
@@ -393,18 +436,27 @@ cmd_pachi_genmoves(struct board *board, struct engine *engine, struct time_info
 		fprintf(stderr, "proposing moves %s\n", reply);
 	if (DEBUGL(4) && debug_boardprint)
 		engine_board_print(engine, board, stderr);
-	gtp_reply(gtp, reply, NULL);
 	if (stats_size > 0) {
 		double start = time_now();
-		fwrite(stats, 1, stats_size, stdout);
-		fflush(stdout);
+		gtp_reply_stats(gtp, reply, stats, stats_size);
 		if (DEBUGVV(2))
 			fprintf(stderr, "sent reply %d bytes in %.4fms\n",
 				stats_size, (time_now() - start)*1000);
+	} else {
+		gtp_reply(gtp, reply, NULL);
 	}
 	return P_OK;
 }
 
+/* Handshake commands handled by distributed engine slaves
+ * (see uct_notify()). */
+static enum parse_code
+cmd_pachi_slave(struct board *board, struct engine *engine, struct time_info *ti, gtp_t *gtp)
+{
+	gtp_error(gtp, "not a slave", NULL);
+	return P_OK;
+}
+
 static enum parse_code
 cmd_set_free_handicap(struct board *board, struct engine *engine, struct time_info *ti, gtp_t *gtp)
 {
@@ -594,6 +646,25 @@ cmd_pachi_result(struct board *board, struct engine *engine, struct time_info *t
 	return P_OK;
 }
 
+static enum parse_code
+cmd_pachi_playout_stats(struct board *board, struct engine *engine, struct time_info *ti, gtp_t *gtp)
+{
+	/* Moggy rule statistics (moggy "stats" option).
+	 * "reset" clears them, e.g. when changing board size. */
+	char *arg;
+	next_tok(arg);
+	if (!strcasecmp(arg, "reset")) {
+		moggy_stats_reset();
+		gtp_reply(gtp, NULL);
+		return P_OK;
+	}
+
+	gtp_prefix('=', gtp);
+	moggy_stats_print(stdout);
+	gtp_flush();
+	return P_OK;
+}
+
 static enum parse_code
 cmd_pachi_tunit(struct board *board, struct engine *engine, struct time_info *ti, gtp_t *gtp)
 {
@@ -723,10 +794,13 @@ static gtp_command_t commands[] =
 	{ "pachi-tunit",            cmd_pachi_tunit },
 	{ "pachi-genmoves",         cmd_pachi_genmoves },
 	{ "pachi-genmoves_cleanup", cmd_pachi_genmoves },
+	{ "pachi-wire",             cmd_pachi_slave },
+	{ "pachi-shm",              cmd_pachi_slave },
 	{ "pachi-gentbook",         cmd_pachi_gentbook },
 	{ "pachi-dumptbook",        cmd_pachi_dumptbook },
 	{ "pachi-evaluate",         cmd_pachi_evaluate },
 	{ "pachi-result",           cmd_pachi_result },
+	{ "pachi-playout_stats",    cmd_pachi_playout_stats },
 
 	/* Short aliases */
 	{ "predict",                cmd_pachi_predict },
@@ -48,8 +48,8 @@ port_listen(char *port, int max_connections)
 	server_addr.sin_port = htons(atoi(port));     
 	server_addr.sin_addr.s_addr = INADDR_ANY; 
 
-	const char val = 1;
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)))
+	const int val = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&val, sizeof(val)))
 		fail("setsockopt");
 	if (bind(sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr)) == -1)
 		fail("bind");
@@ -58,17 +58,20 @@ port_listen(char *port, int max_connections)
 	return sock;
 }
 
-/* Returns true if in private address range: 10.0.0.0/8 172.16.0.0/12 192.168.0.0/16 */
+/* Returns true if in private address range: 10.0.0.0/8 172.16.0.0/12 192.168.0.0/16
+ * or loopback 127.0.0.0/8 */
 static bool
 is_private(struct in_addr *in)
 {
 	return (ntohl(in->s_addr) & 0xff000000) >> 24 == 10
+	    || (ntohl(in->s_addr) & 0xff000000) >> 24 == 127
 	    || (ntohl(in->s_addr) & 0xfff00000) >> 16 == 172 * 256 + 16
 	    || (ntohl(in->s_addr) & 0xffff0000) >> 16 == 192 * 256 + 168;
 }
 
 /* Waits for a connection on the given socket, and returns the file descriptor.
- * Updates the client address if it is not null.
+ * Updates the client address if it is not null. If the socket is
+ * non-blocking, returns -1 when no connection is pending.
  * WARNING: the connection is not authenticated. As a weak security measure,
  * the connections are limited to a private network. */
 int
@@ -80,6 +83,8 @@ open_server_connection(int socket, struct in_addr *client)
 		int sin_size = sizeof(struct sockaddr_in);
 		int fd = accept(socket, (struct sockaddr *)&client_addr, (socklen_t *)&sin_size);
 		if (fd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED)
+				return -1;
 			fail("accept");
 		}
 		if (is_private(&client_addr.sin_addr)) {
@@ -57,6 +57,15 @@ board_ownermap_fill(struct board_ownermap *ownermap, struct board *b)
 	} foreach_point_end;
 }
 
+void
+board_ownermap_fill_area(struct board_ownermap *ownermap, struct board *b, enum stone *owner)
+{
+	ownermap->playouts++;
+	foreach_point(b) {
+		ownermap->map[c][owner[c]]++;
+	} foreach_point_end;
+}
+
 void
 board_ownermap_merge(int bsize2, struct board_ownermap *dst, struct board_ownermap *src)
 {
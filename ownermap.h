@@ -24,6 +24,9 @@ struct board_ownermap {
 void board_ownermap_init(struct board_ownermap *ownermap);
 void board_print_ownermap(struct board *b, FILE *f, struct board_ownermap *ownermap);
 void board_ownermap_fill(struct board_ownermap *ownermap, struct board *b);
+/* Same with final owners of all points given by @owner (area scoring,
+ * stones known to be dead). */
+void board_ownermap_fill_area(struct board_ownermap *ownermap, struct board *b, enum stone *owner);
 void board_ownermap_merge(int bsize2, struct board_ownermap *dst, struct board_ownermap *src);
 
 
@@ -18,6 +18,7 @@
 #include "engines/joseki.h"
 #include "engines/dcnn.h"
 #include "t-unit/test.h"
+#include "t-predict/predict.h"
 #include "uct/uct.h"
 #include "distributed/distributed.h"
 #include "gtp.h"
@@ -78,6 +79,18 @@ init_engine(enum engine_id engine, char *e_arg, struct board *b)
 	return e;
 }
 
+/* Engines that can run in several threads at once (--predict-threads):
+ * no search state in globals. */
+static bool
+predict_threads_ok(enum engine_id engine)
+{
+	return (engine == E_REPLAY || engine == E_PATTERNPLAY
+#ifdef DCNN
+		|| engine == E_DCNN
+#endif
+		);
+}
+
 static void
 usage()
 {
@@ -87,6 +100,8 @@ usage()
 		"  -c, --chatfile FILE               set kgs chatfile \n"
                 "      --compile-flags               show pachi's compile flags \n"
 		"  -d, --debug-level LEVEL           set debug level \n"
+		"      --dcnn-calibrate              record dcnn activation ranges, write golast.int8 on exit \n"
+		"      --dcnn-int8                   use int8 dcnn (golast.int8) \n"
 		"  -D                                don't log board diagrams \n"
 		"  -e, --engine ENGINE               select engine (default uct). Supported engines: \n"
 		"                                    uct, dcnn, patternplay, replay, random, montecarlo, distributed \n"
@@ -98,6 +113,7 @@ usage()
 		"  -l, --log-port [HOST:]LOG_PORT    log to remote host instead of stderr \n"
 		"      --no-dcnn                     disable dcnn \n"
 		"  -o  --log-file FILE               log to FILE instead of stderr \n"
+		"      --predict-threads N           evaluate pachi-predict positions with N threads \n"
 		"  -r, --rules RULESET               rules to use: (default chinese) \n"
 		"                                    japanese|chinese|aga|new_zealand|simplified_ing \n"
 		"  -s, --seed RANDOM_SEED            set random seed \n"
@@ -145,10 +161,15 @@ show_version(FILE *s)
 #define OPT_NO_DCNN       257
 #define OPT_VERBOSE_CAFFE 258
 #define OPT_COMPILE_FLAGS 259
+#define OPT_DCNN_INT8     260
+#define OPT_DCNN_CALIBRATE 261
+#define OPT_PREDICT_THREADS 262
 static struct option longopts[] = {
 	{ "fuseki-time", required_argument, 0, OPT_FUSEKI_TIME },
 	{ "chatfile",    required_argument, 0, 'c' },
 	{ "compile-flags", no_argument,     0, OPT_COMPILE_FLAGS },
+	{ "dcnn-calibrate", no_argument,    0, OPT_DCNN_CALIBRATE },
+	{ "dcnn-int8",   no_argument,       0, OPT_DCNN_INT8 },
 	{ "debug-level", required_argument, 0, 'd' },
 	{ "engine",      required_argument, 0, 'e' },
 	{ "fbook",       required_argument, 0, 'f' },
@@ -157,6 +178,7 @@ static struct option longopts[] = {
 	{ "log-file",    required_argument, 0, 'o' },
 	{ "log-port",    required_argument, 0, 'l' },
 	{ "no-dcnn",     no_argument,       0, OPT_NO_DCNN },
+	{ "predict-threads", required_argument, 0, OPT_PREDICT_THREADS },
 	{ "rules",       required_argument, 0, 'r' },
 	{ "seed",        required_argument, 0, 's' },
 	{ "time",        required_argument, 0, 't' },
@@ -181,6 +203,7 @@ int main(int argc, char *argv[])
 	char *ruleset = NULL;
 	FILE *file = NULL;
 	bool verbose_caffe = false;
+	int predict_threads = 0;
 
 	setlinebuf(stdout);
 	setlinebuf(stderr);
@@ -244,6 +267,15 @@ int main(int argc, char *argv[])
 			case OPT_NO_DCNN:
 				disable_dcnn();
 				break;
+			case OPT_DCNN_INT8:
+				dcnn_use_int8();
+				break;
+			case OPT_DCNN_CALIBRATE:
+				dcnn_use_calibration();
+				break;
+			case OPT_PREDICT_THREADS:
+				predict_threads = atoi(optarg);
+				break;
 			case 'r':
 				ruleset = strdup(optarg);
 				break;
@@ -311,6 +343,15 @@ int main(int argc, char *argv[])
 	char *e_arg = NULL;
 	if (optind < argc)	e_arg = argv[optind];
     //参数读取完成，就开始初始化引擎了
+	if (predict_threads > 0) {
+		if (!predict_threads_ok(engine))
+			die("--predict-threads: engine keeps global search state, use patternplay, replay or dcnn\n");
+		predict_init(predict_threads, engine_init[engine], e_arg);
+		/* Workers have their own engines, gtp only replays
+		 * the games: don't load the real engine for that. */
+		engine = E_RANDOM;
+		e_arg = NULL;
+	}
 	struct engine *e = init_engine(engine, e_arg, b);
 
 	if (gtp_port)		open_gtp_connection(&gtp_sock, gtp_port);
@@ -339,6 +380,7 @@ int main(int argc, char *argv[])
 		if (!gtp_port) break;
 		open_gtp_connection(&gtp_sock, gtp_port);
 	}
+	predict_done();
 	engine_done(e);
 	chat_done();
 	free(testfile);
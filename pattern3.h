@@ -58,6 +58,9 @@ static hash3_t pattern3_hash(struct board *b, coord_t c);
 /* Check if we match any 3x3 pattern centered on given move. */
 static bool pattern3_move_here(struct pattern3s *p, struct board *b, struct move *m, char *idx);
 
+/* Get pattern value (color bits and index, 0 if none) matched at @c. */
+static unsigned char pattern3_value_here(struct pattern3s *p, struct board *b, coord_t c);
+
 /* Generate all transpositions of given pattern, stored in an
  * hash3_t[8] array. */
 void pattern3_transpose(hash3_t pat, hash3_t (*transp)[8]);
@@ -101,20 +104,27 @@ hash3_to_hash(hash3_t pat)
 	return h;
 }
 
-static inline bool
-pattern3_move_here(struct pattern3s *p, struct board *b, struct move *m, char *idx)
+static inline unsigned char
+pattern3_value_here(struct pattern3s *p, struct board *b, coord_t c)
 {
 #ifdef BOARD_PAT3
-	hash3_t pat = b->pat3[m->coord];
+	hash3_t pat = b->pat3[c];
 #else
-	hash3_t pat = pattern3_hash(b, m->coord);
+	hash3_t pat = pattern3_hash(b, c);
 #endif
 	hash_t h = hash3_to_hash(pat);
 	while (p->hash[h & pattern3_hash_mask].pattern != pat
 	       && p->hash[h & pattern3_hash_mask].value != 0)
 		h++;
-	if (p->hash[h & pattern3_hash_mask].value & m->color) {
-		*idx = p->hash[h & pattern3_hash_mask].value >> 2;
+	return p->hash[h & pattern3_hash_mask].value;
+}
+
+static inline bool
+pattern3_move_here(struct pattern3s *p, struct board *b, struct move *m, char *idx)
+{
+	unsigned char value = pattern3_value_here(p, b, m->coord);
+	if (value & m->color) {
+		*idx = value >> 2;
 		return true;
 	} else {
 		return false;
@@ -55,11 +55,23 @@ playout_permit(struct playout_policy *p, struct board *b, coord_t coord, enum st
 	return playout_permit_move(p, b, &m, 0);
 }
 
+static inline bool
+playout_frozen(struct playout_setup *setup, coord_t coord)
+{
+	return setup->frozen && !is_pass(coord) && setup->frozen[coord] != S_NONE;
+}
+
+struct permit_data {
+	struct playout_policy *policy;
+	struct playout_setup *setup;
+};
+
 static bool
 permit_handler(struct board *b, struct move *m, void *data)
 {
-	struct playout_policy *policy = data;
-	return playout_permit_move(policy, b, m, 1);
+	struct permit_data *pd = data;
+	return (playout_permit_move(pd->policy, b, m, 1) &&
+		!playout_frozen(pd->setup, m->coord));
 }
 
 //随机落子
@@ -73,17 +85,23 @@ play_random_move(struct playout_setup *setup,
 	if (setup->prepolicy_hook) {
 		coord = setup->prepolicy_hook(policy, setup, b, color);
 		// fprintf(stderr, "prehook: %s\n", coord2sstr(coord, b));
+		if (playout_frozen(setup, coord))
+			coord = pass;
 	}
 
 	if (is_pass(coord)) {
 		coord = policy->choose(policy, setup, b, color);
 		coord = playout_check_move(policy, b, coord, color);
 		// fprintf(stderr, "policy: %s\n", coord2sstr(coord, b));
+		if (playout_frozen(setup, coord))
+			coord = pass;
 	}
 
 	if (is_pass(coord) && setup->postpolicy_hook) {
 		coord = setup->postpolicy_hook(policy, setup, b, color);
 		// fprintf(stderr, "posthook: %s\n", coord2sstr(coord, b));
+		if (playout_frozen(setup, coord))
+			coord = pass;
 	}
     //对随机方案的判断
 	if (is_pass(coord)) {
@@ -95,7 +113,8 @@ play_random_move(struct playout_setup *setup,
 /*显然，如果策略正在跟踪内部板状态，则决不能发生这种情况。*/
 		assert(!policy->setboard || policy->setboard_randomok);
         //在棋盘上落子，可以修改落子位置，并且判断是否可以
-		board_play_random(b, color, &coord, permit_handler, policy);
+		struct permit_data pd = { .policy = policy, .setup = setup };
+		board_play_random(b, color, &coord, permit_handler, &pd);
 
 	} else {
 		struct move m;
@@ -112,86 +131,252 @@ play_random_move(struct playout_setup *setup,
 
 	return coord;
 }
+
+/* Empty regions touching both colours up to this size are dame. */
+#define SETTLE_DAME_MAX 4
+/* Check settled positions only every few moves, the check is not free. */
+#define SETTLE_PERIOD 4
+
+/* Flood empty region from @c into @region[] marking @owner[] (points
+ * with S_MAX are unvisited), returns bitmask of bordering colours.
+ * Stops early once the region is known to be too big a mixed one. */
+static int
+settle_region(struct board *b, coord_t c, coord_t *region, int *n, enum stone *owner, bool bounded)
+{
+	int colors = 0;
+	*n = 0;
+	region[(*n)++] = c;
+	owner[c] = S_NONE;
+	for (int j = 0; j < *n; j++) {
+		if (bounded && colors == ((1 << S_BLACK) | (1 << S_WHITE)) && *n > SETTLE_DAME_MAX)
+			break;
+		foreach_neighbor(b, region[j], {
+			enum stone s = board_at(b, c);
+			if (s == S_BLACK || s == S_WHITE)
+				colors |= 1 << s;
+			else if (s == S_NONE && owner[c] == S_MAX) {
+				owner[c] = S_NONE;
+				region[(*n)++] = c;
+			}
+		});
+	}
+	return colors;
+}
+
+/* Is the position settled, i.e. every empty region bordered by one
+ * colour only, except small dame regions between groups with two
+ * liberties in their own territory, and no group capturable in its
+ * own eye? From here on playouts would mostly fill territory and
+ * dame, so the area score is (nearly) what board_fast_score() would
+ * give at the end. Owners of empty points (S_NONE for dame) are
+ * stored in @owner, @frozen points (if any) count for their owner.
+ * @hint remembers a point of the last big contested
+ * region, usually still there next time. */
+bool
+playout_settled(struct board *b, coord_t *hint, enum stone *owner, enum stone *frozen)
+{
+	coord_t region[b->flen];
+	int n;
+
+	/* Frozen points are already decided, don't flood them. */
+	for (int i = 0; i < b->flen; i++)
+		owner[b->f[i]] = (frozen && frozen[b->f[i]] != S_NONE ? frozen[b->f[i]] : S_MAX);
+
+	if (!is_pass(*hint) && board_at(b, *hint) == S_NONE && owner[*hint] == S_MAX) {
+		int colors = settle_region(b, *hint, region, &n, owner, true);
+		if (colors == ((1 << S_BLACK) | (1 << S_WHITE)) && n > SETTLE_DAME_MAX)
+			return false;
+		for (int j = 0; j < n; j++)
+			owner[region[j]] = S_MAX;
+	}
+
+	for (int i = 0; i < b->flen; i++) {
+		if (owner[b->f[i]] != S_MAX)
+			continue;
+		int colors = settle_region(b, b->f[i], region, &n, owner, false);
+		enum stone color = S_NONE;
+		if (colors == ((1 << S_BLACK) | (1 << S_WHITE))) {
+			if (n > SETTLE_DAME_MAX) {
+				*hint = b->f[i];
+				return false;
+			}
+		} else if (colors) {
+			color = colors & (1 << S_BLACK) ? S_BLACK : S_WHITE;
+		}
+		for (int j = 0; j < n; j++)
+			owner[region[j]] = color;
+	}
+
+	/* A small mixed region may be the last outside liberties of a dead
+	 * group rather than dame: every group next to dame needs two
+	 * liberties in its own territory (no single eye), or it is still
+	 * to be settled by playing on. */
+	for (int i = 0; i < b->flen; i++) {
+		if (owner[b->f[i]] != S_NONE)
+			continue;
+		foreach_neighbor(b, b->f[i], {
+			group_t g = group_at(b, c);
+			if (!g)
+				continue;
+			enum stone color = board_at(b, c);
+			int eyelibs = 0;
+			for (int j = 0; j < board_group_info(b, g).libs && eyelibs < 2; j++)
+				eyelibs += owner[board_group_info(b, g).lib[j]] == color;
+			if (eyelibs < 2)
+				return false;
+		});
+	}
+
+	/* Group in atari with last liberty in its own eye gets captured. */
+	for (int i = 0; i < b->clen; i++) {
+		group_t g = b->c[i];
+		if (owner[board_group_info(b, g).lib[0]] == board_at(b, g))
+			return false;
+	}
+	return true;
+}
+
+/* Final owner of every point in @owner: stones, empty points as found
+ * by playout_settled() if @settled (one-point eyes only otherwise), and
+ * @frozen points (if any) for their owner. */
+static void
+playout_final_owners(struct board *b, enum stone *owner, bool settled, enum stone *frozen)
+{
+	foreach_point(b) {
+		enum stone color = board_at(b, c);
+		if (frozen && frozen[c] != S_NONE)
+			color = frozen[c];
+		else if (color == S_NONE && settled)
+			color = owner[c];
+		else if (color == S_NONE && b->rules != RULES_STONES_ONLY)
+			color = board_get_one_point_eye(b, c);
+		owner[c] = color;
+	} foreach_point_end;
+}
+
+/* board_fast_score() with final owners from playout_final_owners(). */
+static floating_t
+playout_area_score(struct board *b, enum stone *owner)
+{
+	int scores[S_MAX];
+	memset(scores, 0, sizeof(scores));
+
+	foreach_point(b) {
+		scores[owner[c]]++;
+	} foreach_point_end;
+
+	return b->komi + (b->rules != RULES_SIMING ? b->handicap : 0) + scores[S_WHITE] - scores[S_BLACK];
+}
+
 //随机游戏策略
 //比如，setup的部分参数，policy也是引擎里的 都在引擎初始化的时候做出的
-int
-play_random_game(struct playout_setup *setup,
-                 struct board *b, enum stone starting_color,
-		 struct playout_amafmap *amafmap,
-		 struct board_ownermap *ownermap,
-		 struct playout_policy *policy)
+void
+playout_game_start(struct playout_game *g, struct playout_setup *setup,
+		   struct board *b, enum stone starting_color,
+		   struct playout_amafmap *amafmap,
+		   struct board_ownermap *ownermap,
+		   struct playout_policy *policy)
 {
 	assert(setup && policy);
-    //
-	int gamelen = setup->gamelen - b->moves;
+	*g = (struct playout_game) {
+		.setup = setup, .b = b, .amafmap = amafmap, .ownermap = ownermap, .policy = policy,
+		.starting_color = starting_color, .color = starting_color,
+		.gamelen = setup->gamelen - b->moves,
+		.passes = is_pass(b->last_move.coord) && b->moves > 0,
+		.dame_hint = pass,
+	};
 
 	if (policy->setboard)
 		policy->setboard(policy, b);
-#ifdef DEBUGL_BY_PLAYOUT
-	int debug_level_orig = debug_level;
-	debug_level = policy->debug_level;
-#endif
+}
+
+bool
+playout_game_step(struct playout_game *g)
+{
+	struct playout_setup *setup = g->setup;
+	struct playout_policy *policy = g->policy;
+	struct board *b = g->b;
+	enum stone color = g->color;
 
-	enum stone color = starting_color;//出事颜色
+	if (!g->gamelen-- || g->passes >= 2)
+		return false;
 
-	int passes = is_pass(b->last_move.coord) && b->moves > 0;
-    //步数随机的长度
-	while (gamelen-- && passes < 2) {
-		coord_t coord = play_random_move(setup, b, color, policy);
-        //下面是一个围棋局面的判断处理
+	coord_t coord = play_random_move(setup, b, color, policy);
+	//下面是一个围棋局面的判断处理
 
 #if 0
-		/* For UCT, superko test here is downright harmful since
-		 * in superko-likely situation we throw away literally
-		 * 95% of our playouts; UCT will deal with this fine by
-		 * itself. */
-		if (unlikely(b->superko_violation)) {
-			/* We ignore superko violations that are suicides. These
-			 * are common only at the end of the game and are
-			 * rather harmless. (They will not go through as a root
-			 * move anyway.) */
-			if (group_at(b, coord)) {
-				if (DEBUGL(3)) {
-					fprintf(stderr, "Superko fun at %d,%d in\n", coord_x(coord, b), coord_y(coord, b));
-					if (DEBUGL(4))
-						board_print(b, stderr);
-				}
-				return 0;
-			} else {
-				if (DEBUGL(6)) {
-					fprintf(stderr, "Ignoring superko at %d,%d in\n", coord_x(coord, b), coord_y(coord, b));
+	/* For UCT, superko test here is downright harmful since
+	 * in superko-likely situation we throw away literally
+	 * 95% of our playouts; UCT will deal with this fine by
+	 * itself. */
+	if (unlikely(b->superko_violation)) {
+		/* We ignore superko violations that are suicides. These
+		 * are common only at the end of the game and are
+		 * rather harmless. (They will not go through as a root
+		 * move anyway.) */
+		if (group_at(b, coord)) {
+			if (DEBUGL(3)) {
+				fprintf(stderr, "Superko fun at %d,%d in\n", coord_x(coord, b), coord_y(coord, b));
+				if (DEBUGL(4))
 					board_print(b, stderr);
-				}
-				b->superko_violation = false;
 			}
+			return 0;
+		} else {
+			if (DEBUGL(6)) {
+				fprintf(stderr, "Ignoring superko at %d,%d in\n", coord_x(coord, b), coord_y(coord, b));
+				board_print(b, stderr);
+			}
+			b->superko_violation = false;
 		}
+	}
 #endif
 
-		if (PLDEBUGL(7)) {
-			fprintf(stderr, "%s %s\n", stone2str(color), coord2sstr(coord, b));
-			if (PLDEBUGL(8))
-				board_print(b, stderr);
-		}
+	if (PLDEBUGL(7)) {
+		fprintf(stderr, "%s %s\n", stone2str(color), coord2sstr(coord, b));
+		if (PLDEBUGL(8))
+			board_print(b, stderr);
+	}
 
-		if (unlikely(is_pass(coord))) {
-			passes++;
-		} else {
-			passes = 0;
-		}
-		if (amafmap) {
-			assert(amafmap->gamelen < MAX_GAMELEN);
-			amafmap->is_ko_capture[amafmap->gamelen] = board_playing_ko_threat(b);
-			amafmap->game[amafmap->gamelen++] = coord;
-		}
+	if (unlikely(is_pass(coord))) {
+		g->passes++;
+	} else {
+		g->passes = 0;
+	}
+	if (g->amafmap) {
+		struct playout_amafmap *amafmap = g->amafmap;
+		assert(amafmap->gamelen < MAX_GAMELEN);
+		amafmap->is_ko_capture[amafmap->gamelen] = board_playing_ko_threat(b);
+		amafmap->game[amafmap->gamelen++] = coord;
+	}
 
-		if (setup->mercymin && abs(b->captures[S_BLACK] - b->captures[S_WHITE]) > setup->mercymin)
-			break;
-        //颜色变换
-		color = stone_other(color);
+	if (setup->mercymin && abs(b->captures[S_BLACK] - b->captures[S_WHITE]) > setup->mercymin)
+		return false;
+
+	if (setup->settle_moves && b->moves >= setup->settle_moves && !(b->moves % SETTLE_PERIOD)
+	    && b->rules != RULES_STONES_ONLY) {
+		enum stone owner[board_size2(b)];
+		if (playout_settled(b, &g->dame_hint, owner, setup->frozen)) {
+			g->settled = true;
+			return false;
+		}
 	}
+	//颜色变换
+	g->color = stone_other(color);
+	return true;
+}
 
-	floating_t score = board_fast_score(b);
-	int result = (starting_color == S_WHITE ? score * 2 : - (score * 2));
+int
+playout_game_result(struct playout_game *g)
+{
+	struct board *b = g->b;
+	enum stone *frozen = g->setup->frozen;
+	enum stone owner[board_size2(b)];
+	bool settled = g->settled && playout_settled(b, &g->dame_hint, owner, frozen);
+	bool area = settled || frozen;
+	if (area)
+		playout_final_owners(b, owner, settled, frozen);
+	floating_t score = area ? playout_area_score(b, owner) : board_fast_score(b);
+	int result = (g->starting_color == S_WHITE ? score * 2 : - (score * 2));
 
 	if (DEBUGL(6)) {
 		fprintf(stderr, "Random playout result: %d (W %f)\n", result, score);
@@ -199,13 +384,37 @@ play_random_game(struct playout_setup *setup,
 			board_print(b, stderr);
 	}
 
-	if (ownermap)
-		board_ownermap_fill(ownermap, b);
+	if (g->ownermap) {
+		if (area)
+			board_ownermap_fill_area(g->ownermap, b, owner);
+		else
+			board_ownermap_fill(g->ownermap, b);
+	}
+
+	return result;
+}
 
+int
+play_random_game(struct playout_setup *setup,
+                 struct board *b, enum stone starting_color,
+		 struct playout_amafmap *amafmap,
+		 struct board_ownermap *ownermap,
+		 struct playout_policy *policy)
+{
+	struct playout_game g;
+	playout_game_start(&g, setup, b, starting_color, amafmap, ownermap, policy);
 #ifdef DEBUGL_BY_PLAYOUT
-	debug_level = debug_level_orig;
+	int debug_level_orig = debug_level;
+	debug_level = policy->debug_level;
 #endif
 
+	//步数随机的长度
+	while (playout_game_step(&g));
+	int result = playout_game_result(&g);
+
+#ifdef DEBUGL_BY_PLAYOUT
+	debug_level = debug_level_orig;
+#endif
 	return result;
 }
 
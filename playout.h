@@ -88,6 +88,13 @@ struct playout_setup {
     /*在比赛中最大限度的移动。*/
 /*捕获之间终止播放的最小差异。0表示不检查。*/
 	int mercymin;
+	/* From this move number on, stop as soon as the position is
+	 * settled (see playout_game_step()). 0 means don't check. */
+	int settle_moves;
+	/* Points proven settled (see tactics/benson.h), indexed by coord:
+	 * owner color, or S_NONE. Nobody plays there and they are scored
+	 * for their owner. NULL if not used. */
+	enum stone *frozen;
 
 	void *hook_data; // for hook to reference its state
 	playouth_prepolicy prepolicy_hook;
@@ -110,6 +117,22 @@ struct playout_amafmap {
 };
 
 
+/* Playout being played, for callers that want to advance several
+ * playouts in lockstep (see playout_game_step()). */
+struct playout_game {
+	struct playout_setup *setup;
+	struct board *b;
+	struct playout_amafmap *amafmap;
+	struct board_ownermap *ownermap;
+	struct playout_policy *policy;
+	enum stone starting_color, color;
+	int gamelen, passes;
+	/* Stopped early in a settled position. */
+	bool settled;
+	/* Dame point found by the last settled check. */
+	coord_t dame_hint;
+};
+
 /* >0: starting_color wins, <0: starting_color loses; the actual
  * number is a DOUBLE of the score difference
  * 0: superko inside the game tree (XXX: jigo not handled) */
@@ -119,6 +142,23 @@ int play_random_game(struct playout_setup *setup,
 		     struct board_ownermap *ownermap,
 		     struct playout_policy *policy);
 
+/* play_random_game() split in steps: start, play one move at a time
+ * until playout_game_step() returns false, then get the result (same
+ * convention as play_random_game()). */
+void playout_game_start(struct playout_game *g, struct playout_setup *setup,
+			struct board *b, enum stone starting_color,
+			struct playout_amafmap *amafmap,
+			struct board_ownermap *ownermap,
+			struct playout_policy *policy);
+bool playout_game_step(struct playout_game *g);
+int playout_game_result(struct playout_game *g);
+
+/* Is the position settled enough to score by area right away? Owners
+ * of empty points (S_NONE for dame) are stored in @owner. @hint is a
+ * point to check first (pass for none), @frozen points (if any) are
+ * already decided. */
+bool playout_settled(struct board *b, coord_t *hint, enum stone *owner, enum stone *frozen);
+
 coord_t play_random_move(struct playout_setup *setup,
 		         struct board *b, enum stone color,
 		         struct playout_policy *policy);
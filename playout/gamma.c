@@ -0,0 +1,371 @@
+/* Full-board playout policy: every free point carries a weight (gamma)
+ * made of its 3x3 pattern and a few tactical features and the move is
+ * picked from all of them according to these weights. */
+
+/* The weights are kept in a probdist for each color and updated
+ * incrementally: after each move only points whose 3x3 neighborhood
+ * changed or which are liberties of a group whose liberties changed
+ * get recomputed. Changed points are found by comparing the board
+ * with a snapshot around the last moves (flooding over captures), so
+ * we don't need to see every move played on the board. Legality and
+ * self-ataris are only checked for the picked move. */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEBUG
+#include "board.h"
+#include "debug.h"
+#include "pattern3.h"
+#include "playout.h"
+#include "playout/gamma.h"
+#include "playout/moggy.h"
+#include "probdist.h"
+#include "random.h"
+#include "tactics/selfatari.h"
+
+#define PLDEBUGL(n) DEBUGL_(p->debug_level, n)
+
+/* Cap on a single point weight, keeps probdist totals within fixp_t. */
+#define GAMMA_MAX 100.0
+
+/* Note that the context can be shared by multiple threads! */
+
+struct gamma_policy {
+	struct pattern3s patterns;
+	double pat3_gammas[PAT3_N];
+	double capture_gamma, escape_gamma, atari_gamma;
+	bool selfatari;
+	int tries;
+};
+
+/* Per simulation state, b->ps */
+struct gamma_state {
+	/* b->moves at last update. */
+	int moves;
+	/* Board snapshot at last update. */
+	unsigned char stone[BOARD_MAX_COORDS];
+	/* Dirty points of the current update, valid if stamped with gen. */
+	unsigned int gen;
+	unsigned int stamp[BOARD_MAX_COORDS];
+	coord_t dirty[BOARD_MAX_COORDS];
+	int ndirty;
+	/* Points with a tactical bonus; rechecked on each update as
+	 * their group may have merged into one whose liberty list
+	 * doesn't have them anymore. */
+	coord_t tactical[BOARD_MAX_COORDS];
+	int ntactical;
+
+	fixp_t items[S_MAX - 1][BOARD_MAX_COORDS];
+	fixp_t rowtotals[S_MAX - 1][BOARD_MAX_SIZE + 2];
+	struct probdist pd[S_MAX - 1];
+};
+
+#define gamma_pd(ps, color) (&(ps)->pd[(color) - 1])
+
+
+static void
+gamma_update_point(struct gamma_policy *pp, struct board *b, struct gamma_state *ps, coord_t coord)
+{
+	if (board_at(b, coord) != S_NONE) {
+		probdist_set(gamma_pd(ps, S_BLACK), coord, 0);
+		probdist_set(gamma_pd(ps, S_WHITE), coord, 0);
+		return;
+	}
+
+	/* Features are computed for both colors at once. */
+	bool atari[S_MAX] = { false }, twolibs[S_MAX] = { false };
+	foreach_neighbor(b, coord, {
+		if (board_at(b, c) != S_BLACK && board_at(b, c) != S_WHITE)
+			continue;
+		int libs = board_group_info(b, group_at(b, c)).libs;
+		atari[board_at(b, c)] |= (libs == 1);
+		twolibs[board_at(b, c)] |= (libs == 2);
+	});
+	unsigned char pat = pattern3_value_here(&pp->patterns, b, coord);
+
+	bool tactical = false;
+	for (enum stone color = S_BLACK; color <= S_WHITE; color++) {
+		enum stone other = stone_other(color);
+		fixp_t w = 0;
+		/* Own eye or suicide, don't bother. */
+		if (!board_is_one_point_eye(b, coord, color)
+		    && (atari[other] || !board_is_eyelike(b, coord, other))) {
+			double g = 1.0;
+			if (pat & color)    g *= pp->pat3_gammas[pat >> 2];
+			if (atari[other])   g *= pp->capture_gamma;
+			if (atari[color])   g *= pp->escape_gamma;
+			if (twolibs[other]) g *= pp->atari_gamma;
+			w = double_to_fixp(g < GAMMA_MAX ? g : GAMMA_MAX);
+			tactical |= atari[other] | atari[color] | twolibs[other];
+		}
+		probdist_set(gamma_pd(ps, color), coord, w);
+	}
+	if (tactical)
+		ps->tactical[ps->ntactical++] = coord;
+}
+
+static void
+gamma_rebuild(struct gamma_policy *pp, struct board *b, struct gamma_state *ps)
+{
+	for (int i = 0; i < S_MAX - 1; i++) {
+		memset(ps->items[i], 0, sizeof(ps->items[i]));
+		memset(ps->rowtotals[i], 0, sizeof(ps->rowtotals[i]));
+		ps->pd[i] = (struct probdist) { .b = b, .items = ps->items[i], .rowtotals = ps->rowtotals[i], .total = 0 };
+	}
+	foreach_point(b) {
+		ps->stone[c] = board_at(b, c);
+	} foreach_point_end;
+	ps->ntactical = 0;
+	foreach_free_point(b) {
+		gamma_update_point(pp, b, ps, c);
+	} foreach_free_point_end;
+	ps->moves = b->moves;
+}
+
+static inline void
+gamma_mark_dirty(struct gamma_state *ps, coord_t c)
+{
+	if (ps->stamp[c] == ps->gen)
+		return;
+	ps->stamp[c] = ps->gen;
+	ps->dirty[ps->ndirty++] = c;
+}
+
+/* Point @coord changed color: its 3x3 neighborhood and the liberties of
+ * all groups around it need to be recomputed. */
+static void
+gamma_point_changed(struct board *b, struct gamma_state *ps, coord_t coord)
+{
+	gamma_mark_dirty(ps, coord);
+	foreach_8neighbor(b, coord) {
+		gamma_mark_dirty(ps, c);
+	} foreach_8neighbor_end;
+
+	group_t groups[5] = { group_at(b, coord) };
+	int ngroups = 1;
+	foreach_neighbor(b, coord, {
+		groups[ngroups++] = group_at(b, c);
+	});
+	for (int i = 0; i < ngroups; i++) {
+		if (!groups[i])
+			continue;
+		struct group *gi = &board_group_info(b, groups[i]);
+		int libs = (gi->libs < GROUP_KEEP_LIBS ? gi->libs : GROUP_KEEP_LIBS);
+		for (int j = 0; j < libs; j++)
+			gamma_mark_dirty(ps, gi->lib[j]);
+	}
+}
+
+/* Find points that changed since last update (the last moves and
+ * whatever they captured) and update weights around them. */
+static void
+gamma_sync(struct gamma_policy *pp, struct board *b, struct gamma_state *ps)
+{
+	int moves = b->moves - ps->moves;
+	if (!moves)
+		return;
+	if (moves < 0 || moves > 2) {
+		gamma_rebuild(pp, b, ps);
+		return;
+	}
+
+	if (unlikely(++ps->gen == 0)) {
+		memset(ps->stamp, 0, sizeof(ps->stamp));
+		ps->gen = 1;
+	}
+	ps->ndirty = 0;
+	for (int i = 0; i < ps->ntactical; i++)
+		gamma_mark_dirty(ps, ps->tactical[i]);
+	ps->ntactical = 0;
+
+	coord_t changed[BOARD_MAX_COORDS];
+	int nchanged = 0;
+	coord_t seeds[2] = { b->last_move.coord, moves > 1 ? b->last_move2.coord : pass };
+	for (int i = 0; i < 2; i++) {
+		if (is_pass(seeds[i]) || is_resign(seeds[i]))
+			continue;
+		coord_t s = seeds[i];
+		if (board_at(b, s) != ps->stone[s]) {
+			ps->stone[s] = board_at(b, s);
+			changed[nchanged++] = s;
+		}
+		foreach_neighbor(b, s, {
+			if (board_at(b, c) != ps->stone[c]) {
+				ps->stone[c] = board_at(b, c);
+				changed[nchanged++] = c;
+			}
+		});
+	}
+	/* Flood over captured stones. */
+	for (int i = 0; i < nchanged; i++) {
+		coord_t x = changed[i];
+		gamma_point_changed(b, ps, x);
+		foreach_neighbor(b, x, {
+			if (board_at(b, c) != ps->stone[c]) {
+				ps->stone[c] = board_at(b, c);
+				changed[nchanged++] = c;
+			}
+		});
+	}
+
+	for (int i = 0; i < ps->ndirty; i++)
+		if (board_at(b, ps->dirty[i]) != S_OFFBOARD)
+			gamma_update_point(pp, b, ps, ps->dirty[i]);
+	ps->moves = b->moves;
+}
+
+
+static coord_t
+playout_gamma_choose(struct playout_policy *p, struct playout_setup *s, struct board *b, enum stone to_play)
+{
+	struct gamma_policy *pp = p->data;
+	struct gamma_state *ps = b->ps;
+	gamma_sync(pp, b, ps);
+
+	struct probdist *pd = gamma_pd(ps, to_play);
+	/* Rejected moves are muted for this pick only. */
+	coord_t ignore[pp->tries + 1];
+	int nignore = 0;
+	ignore[0] = pass;
+
+	coord_t coord = pass;
+	for (int i = 0; i < pp->tries && probdist_total(pd) > 0; i++) {
+		coord_t c = probdist_pick(pd, ignore);
+		if (board_is_valid_play(b, to_play, c)
+		    && (!pp->selfatari || !is_bad_selfatari(b, to_play, c))) {
+			coord = c;
+			break;
+		}
+		if (PLDEBUGL(5))
+			fprintf(stderr, "gamma: rejecting %s\n", coord2sstr(c, b));
+
+		/* Keep ignore[] sorted and pass-terminated. */
+		probdist_mute(pd, c);
+		int j = nignore++;
+		for (; j > 0 && ignore[j - 1] > c; j--)
+			ignore[j] = ignore[j - 1];
+		ignore[j] = c;
+		ignore[nignore] = pass;
+	}
+
+	for (int i = 0; i < nignore; i++)
+		probdist_unmute(pd, ignore[i]);
+	return coord;
+}
+
+static void
+playout_gamma_setboard(struct playout_policy *p, struct board *b)
+{
+	if (b->ps)
+		return;
+	struct gamma_state *ps = malloc2(sizeof(struct gamma_state));
+	ps->gen = 0;
+	memset(ps->stamp, 0, sizeof(ps->stamp));
+	b->ps = ps;
+	gamma_rebuild(p->data, b, ps);
+}
+
+bool
+playout_gamma_check(struct playout_policy *p, struct board *b)
+{
+	struct gamma_policy *pp = p->data;
+	struct gamma_state *ps = b->ps;
+	gamma_sync(pp, b, ps);
+
+	struct gamma_state *fresh = malloc2(sizeof(*fresh));
+	fresh->gen = 0;
+	memset(fresh->stamp, 0, sizeof(fresh->stamp));
+	gamma_rebuild(pp, b, fresh);
+
+	bool ok = true;
+	for (enum stone color = S_BLACK; color <= S_WHITE; color++) {
+		foreach_point(b) {
+			fixp_t w = gamma_pd(ps, color)->items[c], w2 = gamma_pd(fresh, color)->items[c];
+			if (w == w2)
+				continue;
+			if (DEBUGL(2))
+				fprintf(stderr, "gamma: %s %s weight %.3f, rebuild %.3f\n", stone2str(color),
+					coord2sstr(c, b), fixp_to_double(w), fixp_to_double(w2));
+			ok = false;
+		} foreach_point_end;
+		if (probdist_total(gamma_pd(ps, color)) != probdist_total(gamma_pd(fresh, color))) {
+			if (DEBUGL(2))
+				fprintf(stderr, "gamma: %s total %.3f, rebuild %.3f\n", stone2str(color),
+					fixp_to_double(probdist_total(gamma_pd(ps, color))),
+					fixp_to_double(probdist_total(gamma_pd(fresh, color))));
+			ok = false;
+		}
+	}
+	free(fresh);
+	return ok;
+}
+
+
+struct playout_policy *
+playout_gamma_init(char *arg, struct board *b)
+{
+	struct playout_policy *p = calloc2(1, sizeof(*p));
+	struct gamma_policy *pp = calloc2(1, sizeof(*pp));
+	p->data = pp;
+	p->setboard = playout_gamma_setboard;
+	/* We resync from the board, so random moves are fine. */
+	p->setboard_randomok = true;
+	p->choose = playout_gamma_choose;
+
+	/* Moggy's pattern gammas, rescaled relative to a plain move. */
+	double pat3_gammas_default[PAT3_N] = {
+		11.4, 11.6, 7.4, 5.4, 8.4, 6.6, 5.2, 4.8, 17.4,
+		3.4, 5.0, 3.2, 4.2, 12.4, 9.8
+	};
+	memcpy(pp->pat3_gammas, pat3_gammas_default, sizeof(pp->pat3_gammas));
+	pp->capture_gamma = 30;
+	pp->escape_gamma = 10;
+	pp->atari_gamma = 2;
+	pp->selfatari = true;
+	pp->tries = 8;
+
+	if (arg) {
+		char *optspec, *next = arg;
+		while (*next) {
+			optspec = next;
+			next += strcspn(next, ":");
+			if (*next) { *next++ = 0; } else { *next = 0; }
+
+			char *optname = optspec;
+			char *optval = strchr(optspec, '=');
+			if (optval) *optval++ = 0;
+
+			if (!strcasecmp(optname, "debug") && optval) {
+				p->debug_level = atoi(optval);
+			} else if (!strcasecmp(optname, "capture") && optval) {
+				pp->capture_gamma = atof(optval);
+			} else if (!strcasecmp(optname, "escape") && optval) {
+				pp->escape_gamma = atof(optval);
+			} else if (!strcasecmp(optname, "atari") && optval) {
+				pp->atari_gamma = atof(optval);
+			} else if (!strcasecmp(optname, "selfatari")) {
+				pp->selfatari = optval && *optval == '0' ? false : true;
+			} else if (!strcasecmp(optname, "tries") && optval) {
+				pp->tries = atoi(optval);
+			} else if (!strcasecmp(optname, "pat3gammas") && optval) {
+				/* PAT3_N %-separated floating point values */
+				for (int i = 0; *optval && i < PAT3_N; i++) {
+					pp->pat3_gammas[i] = atof(optval);
+					optval += strcspn(optval, "%");
+					if (*optval) optval++;
+				}
+			} else
+				die("playout-gamma: Invalid policy argument %s or missing value\n", optname);
+		}
+	}
+	if (pp->tries < 1)
+		pp->tries = 1;
+
+	pattern3s_init(&pp->patterns, moggy_patterns_src, PAT3_N);
+
+	return p;
+}
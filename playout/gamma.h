@@ -0,0 +1,16 @@
+#ifndef PACHI_PLAYOUT_GAMMA_H
+#define PACHI_PLAYOUT_GAMMA_H
+
+#include <stdbool.h>
+
+struct board;
+struct playout_policy;
+
+struct playout_policy *playout_gamma_init(char *arg, struct board *b);
+
+/* Bring the incrementally updated weights of @b up to date and compare
+ * them with a full rebuild (for t-unit). Policy must have been set up
+ * for @b (setboard). */
+bool playout_gamma_check(struct playout_policy *p, struct board *b);
+
+#endif
@@ -3,8 +3,10 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #define DEBUG
 #include "board.h"
@@ -52,8 +54,6 @@ enum mq_tag {
 };
 
 
-#define PAT3_N 15
-
 /* Note that the context can be shared by multiple threads! */
 
 struct moggy_policy {
@@ -96,6 +96,9 @@ struct moggy_policy {
 	/* XXX: Tune. */
 	bool fullchoose;
 	double mq_prob[MQ_MAX], tenuki_prob;
+
+	/* Collect rule statistics (see moggy_stats_print()). */
+	bool stats;
 };
 
 /* Per simulation state (moggy_policy is shared by all threads) */
@@ -105,7 +108,154 @@ struct moggy_state {
 	coord_t last_selfatari[S_MAX];
 };
 
-static char moggy_patterns_src[PAT3_N][11] = {
+
+/* Rule statistics: how often each rule runs, finds something, gets its
+ * move played and what it costs. Counters are per thread and get folded
+ * into the totals when the thread exits, i.e. at the end of each search
+ * for uct threads. */
+
+enum moggy_rule {
+	MR_KO,
+	MR_LCAPTURE,
+	MR_LADDER,
+	MR_PUNISH_SA,
+	MR_ATARI,
+	MR_NLIB,
+	MR_EYEFIX,
+	MR_NAKADE,
+	MR_PATTERN,
+	MR_CAPTURE,
+	MR_JOSEKI,
+	MR_FILLBOARD,
+	MR_PERMIT_SA,
+	MR_PERMIT_EYEFILL,
+	MR_MAX
+};
+
+static const char *moggy_rule_names[MR_MAX] = {
+	"ko", "lcapture", "ladder", "punish_sa", "atari", "nlib", "eyefix",
+	"nakade", "pattern", "capture", "joseki", "fillboard",
+	"permit_sa", "permit_eyefill",
+};
+
+/* Rule credited for a move picked with a given tag in fullchoose. */
+static const enum moggy_rule mq_tag_rule[MQ_MAX] = {
+	[MQ_KO] = MR_KO, [MQ_LATARI] = MR_LCAPTURE, [MQ_L2LIB] = MR_ATARI,
+	[MQ_LNLIB] = MR_NLIB, [MQ_PAT3] = MR_PATTERN, [MQ_GATARI] = MR_CAPTURE,
+	[MQ_JOSEKI] = MR_JOSEKI, [MQ_NAKADE] = MR_NAKADE,
+};
+
+struct moggy_rule_stats {
+	/* Rule ran / found candidates (permit: rejected the move) /
+	 * its move got picked (permit: redirected to another move). */
+	unsigned long invoked, hits, chosen;
+	unsigned long long cycles;
+};
+
+static struct moggy_rule_stats moggy_stats_total[MR_MAX];
+static pthread_mutex_t moggy_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t moggy_stats_key;
+static pthread_once_t moggy_stats_once = PTHREAD_ONCE_INIT;
+static __thread struct moggy_rule_stats *moggy_stats;
+
+/* Add thread counters @s to the totals and clear them.
+ * Caller holds moggy_stats_lock. */
+static void
+moggy_stats_add(struct moggy_rule_stats *s)
+{
+	for (int r = 0; r < MR_MAX; r++) {
+		moggy_stats_total[r].invoked += s[r].invoked;
+		moggy_stats_total[r].hits += s[r].hits;
+		moggy_stats_total[r].chosen += s[r].chosen;
+		moggy_stats_total[r].cycles += s[r].cycles;
+	}
+	memset(s, 0, MR_MAX * sizeof(*s));
+}
+
+static void
+moggy_stats_fold(void *data)
+{
+	pthread_mutex_lock(&moggy_stats_lock);
+	moggy_stats_add(data);
+	pthread_mutex_unlock(&moggy_stats_lock);
+	free(data);
+}
+
+static void
+moggy_stats_key_init(void)
+{
+	pthread_key_create(&moggy_stats_key, moggy_stats_fold);
+}
+
+static struct moggy_rule_stats *
+moggy_stats_thread(void)
+{
+	if (unlikely(!moggy_stats)) {
+		pthread_once(&moggy_stats_once, moggy_stats_key_init);
+		moggy_stats = calloc2(MR_MAX, sizeof(*moggy_stats));
+		pthread_setspecific(moggy_stats_key, moggy_stats);
+	}
+	return moggy_stats;
+}
+
+static inline unsigned long long
+moggy_stats_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline unsigned long long
+rule_start(struct moggy_policy *pp)
+{
+	return pp->stats ? moggy_stats_clock() : 0;
+}
+
+static inline void
+rule_done(struct moggy_policy *pp, enum moggy_rule r, unsigned long long t0, bool hit, bool chosen)
+{
+	if (likely(!pp->stats))
+		return;
+	struct moggy_rule_stats *s = &moggy_stats_thread()[r];
+	s->invoked++;
+	s->hits += hit;
+	s->chosen += chosen;
+	s->cycles += moggy_stats_clock() - t0;
+}
+
+void
+moggy_stats_print(FILE *f)
+{
+	pthread_mutex_lock(&moggy_stats_lock);
+	/* Playouts run by the calling thread itself (montecarlo,
+	 * replay engines) are never folded by the key destructor. */
+	if (moggy_stats)
+		moggy_stats_add(moggy_stats);
+	fprintf(f, "%-15s %12s %12s %12s %10s\n", "rule", "invoked", "hits", "chosen", "cycles/inv");
+	for (int r = 0; r < MR_MAX; r++) {
+		struct moggy_rule_stats *s = &moggy_stats_total[r];
+		fprintf(f, "%-15s %12lu %12lu %12lu %10llu\n", moggy_rule_names[r],
+			s->invoked, s->hits, s->chosen, s->invoked ? s->cycles / s->invoked : 0);
+	}
+	pthread_mutex_unlock(&moggy_stats_lock);
+}
+
+void
+moggy_stats_reset(void)
+{
+	pthread_mutex_lock(&moggy_stats_lock);
+	if (moggy_stats)
+		memset(moggy_stats, 0, MR_MAX * sizeof(*moggy_stats));
+	memset(moggy_stats_total, 0, sizeof(moggy_stats_total));
+	pthread_mutex_unlock(&moggy_stats_lock);
+}
+
+char moggy_patterns_src[PAT3_N][11] = {
 	/* hane pattern - enclosing hane */	/* 0.52 */
 	"XOX"
 	"..."
@@ -611,15 +761,24 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 	struct moggy_state *ps = b->ps;
 	enum stone other_color = stone_other(to_play);
 
+	/* Roll all the rates at once. */
+	enum { R_KO, R_LADDER, R_SELFATARI, R_ATARI, R_NLIB, R_EYEFIX,
+	       R_NAKADE, R_PATTERN, R_CAPTURE, R_JOSEKI, R_MAX };
+	uint16_t roll[R_MAX];
+	fast_random_block(roll, R_MAX, 100);
+
 	if (PLDEBUGL(5))
 		board_print(b, stderr);
 
 	/* Ko fight check */
 	if (!is_pass(b->last_ko.coord) && is_pass(b->ko.coord)
 	    && b->moves - b->last_ko_age < pp->koage
-	    && pp->korate > fast_random(100)) {
-		if (board_is_valid_play(b, to_play, b->last_ko.coord)
-		    && !is_bad_selfatari(b, to_play, b->last_ko.coord))
+	    && pp->korate > roll[R_KO]) {
+		unsigned long long t0 = rule_start(pp);
+		bool ok = board_is_valid_play(b, to_play, b->last_ko.coord)
+			  && !is_bad_selfatari(b, to_play, b->last_ko.coord);
+		rule_done(pp, MR_KO, t0, ok, ok);
+		if (ok)
 			return b->last_ko.coord;
 	}
 
@@ -627,16 +786,20 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 	if (!is_pass(b->last_move.coord)) {
 		/* Local group in atari? */
 		if (true) {  // pp->lcapturerate check in local_atari_check()
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
-			if (local_atari_check(p, b, &b->last_move, &q) && 
-			    q.moves > 0)
+			bool hit = local_atari_check(p, b, &b->last_move, &q) && q.moves > 0;
+			rule_done(pp, MR_LCAPTURE, t0, hit, hit);
+			if (hit)
 				return mq_pick(&q);
 		}
 
 		/* Local group trying to escape ladder? */
-		if (pp->ladderrate > fast_random(100)) {
+		if (pp->ladderrate > roll[R_LADDER]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			local_ladder_check(p, b, &b->last_move, &q);
+			rule_done(pp, MR_LADDER, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
@@ -644,54 +807,66 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 		/* Did we just reject selfatari move as opponent ?
 		 * Check if his group can be laddered / put in atari */
 		if (ps->last_selfatari[other_color] &&
-		    pp->atarirate > fast_random(100)) {
+		    pp->atarirate > roll[R_SELFATARI]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			struct move m = { .coord = ps->last_selfatari[other_color], .color = other_color };			
 			ps->last_selfatari[other_color] = 0;  /* Clear */
 			local_2lib_capture_check(p, b, &m, &q);
+			rule_done(pp, MR_PUNISH_SA, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Local group can be PUT in atari? */
-		if (pp->atarirate > fast_random(100)) {
+		if (pp->atarirate > roll[R_ATARI]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			local_2lib_check(p, b, &b->last_move, &q);
+			rule_done(pp, MR_ATARI, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Local group reduced some of our groups to 3 libs? */
-		if (pp->nlibrate > fast_random(100)) {
+		if (pp->nlibrate > roll[R_NLIB]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			local_nlib_check(p, b, &b->last_move, &q);
+			rule_done(pp, MR_NLIB, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Some other semeai-ish shape checks */
-		if (pp->eyefixrate > fast_random(100)) {
+		if (pp->eyefixrate > roll[R_EYEFIX]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			eye_fix_check(p, b, &b->last_move, to_play, &q);
+			rule_done(pp, MR_EYEFIX, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_pick(&q);
 		}
 
 		/* Nakade check */
-		if (pp->nakaderate > fast_random(100)
+		if (pp->nakaderate > roll[R_NAKADE]
 		    && immediate_liberty_count(b, b->last_move.coord) > 0) {
+			unsigned long long t0 = rule_start(pp);
 			coord_t nakade = nakade_check(p, b, &b->last_move, to_play);
+			rule_done(pp, MR_NAKADE, t0, !is_pass(nakade), !is_pass(nakade));
 			if (!is_pass(nakade))
 				return nakade;
 		}
 
 		/* Check for patterns we know */
-		if (pp->patternrate > fast_random(100)) {
+		if (pp->patternrate > roll[R_PATTERN]) {
+			unsigned long long t0 = rule_start(pp);
 			struct move_queue q; q.moves = 0;
 			fixp_t gammas[MQL];
 			apply_pattern(p, b, &b->last_move,
 			                  pp->pattern2 && b->last_move2.coord >= 0 ? &b->last_move2 : NULL,
 					  &q, gammas);
+			rule_done(pp, MR_PATTERN, t0, q.moves > 0, q.moves > 0);
 			if (q.moves > 0)
 				return mq_gamma_pick(&q, gammas);
 		}
@@ -700,24 +875,30 @@ playout_moggy_seqchoose(struct playout_policy *p, struct playout_setup *s, struc
 	/* Global checks */
 
 	/* Any groups in atari? */
-	if (pp->capturerate > fast_random(100)) {
+	if (pp->capturerate > roll[R_CAPTURE]) {
+		unsigned long long t0 = rule_start(pp);
 		struct move_queue q; q.moves = 0;
 		global_atari_check(p, b, to_play, &q);
+		rule_done(pp, MR_CAPTURE, t0, q.moves > 0, q.moves > 0);
 		if (q.moves > 0)
 			return mq_pick(&q);
 	}
 
 	/* Joseki moves? */
-	if (pp->josekirate > fast_random(100)) {
+	if (pp->josekirate > roll[R_JOSEKI]) {
+		unsigned long long t0 = rule_start(pp);
 		struct move_queue q; q.moves = 0;
 		joseki_check(p, b, to_play, &q);
+		rule_done(pp, MR_JOSEKI, t0, q.moves > 0, q.moves > 0);
 		if (q.moves > 0)
 			return mq_pick(&q);
 	}
 
 	/* Fill board */
 	if (pp->fillboardtries > 0) {
+		unsigned long long t0 = rule_start(pp);
 		coord_t c = fillboard_check(p, b);
+		rule_done(pp, MR_FILLBOARD, t0, !is_pass(c), !is_pass(c));
 		if (!is_pass(c))
 			return c;
 	}
@@ -783,6 +964,15 @@ mq_tagged_choose(struct playout_policy *p, struct board *b, enum stone to_play,
 	return pass;
 }
 
+static unsigned int
+mq_tag_sum(struct move_queue *q)
+{
+	unsigned int sum = 0;
+	for (unsigned int i = 0; i < q->moves; i++)
+		sum += q->tag[i];
+	return sum;
+}
+
 static coord_t
 playout_moggy_fullchoose(struct playout_policy *p, struct playout_setup *s, struct board *b, enum stone to_play)
 {
@@ -792,49 +982,61 @@ playout_moggy_fullchoose(struct playout_policy *p, struct playout_setup *s, stru
 	if (PLDEBUGL(5))
 		board_print(b, stderr);
 
+	/* Candidates found by each rule are counted right after it runs.
+	 * Suggestions of a move already queued only add tag bits. */
+#define FULL_RULE(rule_, check_) do { \
+		unsigned long long t0 = rule_start(pp); \
+		unsigned int moves0 = q.moves, tags0 = pp->stats ? mq_tag_sum(&q) : 0; \
+		check_; \
+		rule_done(pp, rule_, t0, q.moves > moves0 || (pp->stats && mq_tag_sum(&q) != tags0), false); \
+	} while (0)
+
 	/* Ko fight check */
 	if (pp->korate > 0 && !is_pass(b->last_ko.coord) && is_pass(b->ko.coord)
 	    && b->moves - b->last_ko_age < pp->koage) {
-		if (board_is_valid_play(b, to_play, b->last_ko.coord)
-		    && !is_bad_selfatari(b, to_play, b->last_ko.coord))
-			mq_add(&q, b->last_ko.coord, 1<<MQ_KO);
+		FULL_RULE(MR_KO,
+			  if (board_is_valid_play(b, to_play, b->last_ko.coord)
+			      && !is_bad_selfatari(b, to_play, b->last_ko.coord))
+				  mq_add(&q, b->last_ko.coord, 1<<MQ_KO));
 	}
 
 	/* Local checks */
 	if (!is_pass(b->last_move.coord)) {
 		/* Local group in atari? */
 		if (pp->lcapturerate > 0)
-			local_atari_check(p, b, &b->last_move, &q);
+			FULL_RULE(MR_LCAPTURE, local_atari_check(p, b, &b->last_move, &q));
 
 		/* Local group trying to escape ladder? */
 		if (pp->ladderrate > 0)
-			local_ladder_check(p, b, &b->last_move, &q);
+			FULL_RULE(MR_LADDER, local_ladder_check(p, b, &b->last_move, &q));
 
 		/* Local group can be PUT in atari? */
 		if (pp->atarirate > 0)
-			local_2lib_check(p, b, &b->last_move, &q);
+			FULL_RULE(MR_ATARI, local_2lib_check(p, b, &b->last_move, &q));
 
 		/* Local group reduced some of our groups to 3 libs? */
 		if (pp->nlibrate > 0)
-			local_nlib_check(p, b, &b->last_move, &q);
+			FULL_RULE(MR_NLIB, local_nlib_check(p, b, &b->last_move, &q));
 
 		/* Some other semeai-ish shape checks */
 		if (pp->eyefixrate > 0)
-			eye_fix_check(p, b, &b->last_move, to_play, &q);
+			FULL_RULE(MR_EYEFIX, eye_fix_check(p, b, &b->last_move, to_play, &q));
 
 		/* Nakade check */
 		if (pp->nakaderate > 0 && immediate_liberty_count(b, b->last_move.coord) > 0) {
-			coord_t nakade = nakade_check(p, b, &b->last_move, to_play);
-			if (!is_pass(nakade))
-				mq_add(&q, nakade, 1<<MQ_NAKADE);
+			FULL_RULE(MR_NAKADE,
+				  coord_t nakade = nakade_check(p, b, &b->last_move, to_play);
+				  if (!is_pass(nakade))
+					  mq_add(&q, nakade, 1<<MQ_NAKADE));
 		}
 
 		/* Check for patterns we know */
 		if (pp->patternrate > 0) {
 			fixp_t gammas[MQL];
-			apply_pattern(p, b, &b->last_move,
-					pp->pattern2 && b->last_move2.coord >= 0 ? &b->last_move2 : NULL,
-					&q, gammas);
+			FULL_RULE(MR_PATTERN,
+				  apply_pattern(p, b, &b->last_move,
+						pp->pattern2 && b->last_move2.coord >= 0 ? &b->last_move2 : NULL,
+						&q, gammas));
 			/* FIXME: Use the gammas. */
 		}
 	}
@@ -843,11 +1045,11 @@ playout_moggy_fullchoose(struct playout_policy *p, struct playout_setup *s, stru
 
 	/* Any groups in atari? */
 	if (pp->capturerate > 0)
-		global_atari_check(p, b, to_play, &q);
+		FULL_RULE(MR_CAPTURE, global_atari_check(p, b, to_play, &q));
 
 	/* Joseki moves? */
 	if (pp->josekirate > 0)
-		joseki_check(p, b, to_play, &q);
+		FULL_RULE(MR_JOSEKI, joseki_check(p, b, to_play, &q));
 
 #if 0
 	/* Average length of the queue is 1.4 move. */
@@ -857,17 +1059,34 @@ playout_moggy_fullchoose(struct playout_policy *p, struct playout_setup *s, stru
 	printf("\n");
 #endif
 
-	if (q.moves > 0)
-		return mq_tagged_choose(p, b, to_play, &q);
+	if (q.moves > 0) {
+		coord_t c = mq_tagged_choose(p, b, to_play, &q);
+		if (pp->stats && !is_pass(c)) {
+			/* Credit the rules that suggested it (q has merged tags now). */
+			struct moggy_rule_stats *st = moggy_stats_thread();
+			for (unsigned int i = 0; i < q.moves; i++) {
+				if (q.move[i] != c)
+					continue;
+				for (int j = 0; j < MQ_MAX; j++)
+					if (q.tag[i] & (1<<j))
+						st[mq_tag_rule[j]].chosen++;
+				break;
+			}
+		}
+		return c;
+	}
 
 	/* Fill board */
 	if (pp->fillboardtries > 0) {
+		unsigned long long t0 = rule_start(pp);
 		coord_t c = fillboard_check(p, b);
+		rule_done(pp, MR_FILLBOARD, t0, !is_pass(c), !is_pass(c));
 		if (!is_pass(c))
 			return c;
 	}
 
 	return pass;
+#undef FULL_RULE
 }
 
 
@@ -1054,6 +1273,7 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 	 * They suck in general, but this also permits us to actually
 	 * handle seki in the playout stage. */
 
+	unsigned long long t0 = rule_start(pp);
 	int bad_selfatari = (pp->selfatarirate > fast_random(100) ? 
 			     is_bad_selfatari(b, m->color, m->coord) :
 			     is_really_bad_selfatari(b, m->color, m->coord));
@@ -1065,15 +1285,21 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 			ps->last_selfatari[m->color] = m->coord;
 			/* Ok, try the other liberty of the atari'd group. */
 			coord_t c = selfatari_cousin(b, m->color, m->coord, NULL);
-			if (!permit_move(c)) return false;
+			if (!permit_move(c)) {
+				rule_done(pp, MR_PERMIT_SA, t0, true, false);
+				return false;
+			}
 			if (PLDEBUGL(5))
 				fprintf(stderr, "___ Redirecting to other lib %s\n",
 					coord2sstr(c, b));
 			m->coord = c;
+			rule_done(pp, MR_PERMIT_SA, t0, true, true);
 			return true;
 		}
+		rule_done(pp, MR_PERMIT_SA, t0, true, false);
 		return false;
 	}
+	rule_done(pp, MR_PERMIT_SA, t0, false, false);
 
 	/* Check if we don't seem to be filling our eye. This should
 	 * happen only for false eyes, but some of them are in fact
@@ -1084,6 +1310,7 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 			fprintf(stderr, "skipping eyefill test\n");
 		goto eyefill_skip;
 	}
+	t0 = rule_start(pp);
 	bool eyefill = board_is_eyelike(b, m->coord, m->color);
 	/* If saving a group in atari don't interfere ! */
 	if (eyefill && !board_get_atari_neighbor(b, m->coord, m->color)) {
@@ -1098,6 +1325,7 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 						fprintf(stderr, "___ Redirecting to capture %s\n",
 							coord2sstr(c, b));
 					m->coord = c;
+					rule_done(pp, MR_PERMIT_EYEFILL, t0, true, true);
 					return true;
 				}
 			case 2: /* Try to switch to some 2-lib neighbor. */
@@ -1106,12 +1334,14 @@ playout_moggy_permit(struct playout_policy *p, struct board *b, struct move *m,
 					if (!permit_move(l))
 						continue;
 					m->coord = l;
+					rule_done(pp, MR_PERMIT_EYEFILL, t0, true, true);
 					return true;
 				}
 				break;
 			}
 		} foreach_diag_neighbor_end;
 	}
+	rule_done(pp, MR_PERMIT_EYEFILL, t0, false, false);
 
 eyefill_skip:
 	if (breaking_3_stone_seki(b, m->coord, m->color))
@@ -1289,6 +1519,10 @@ playout_moggy_init(char *arg, struct board *b, struct joseki_dict *jdict)
 				}
 			} else if (!strcasecmp(optname, "tenukiprob") && optval) {
 				pp->tenuki_prob = atof(optval);
+			} else if (!strcasecmp(optname, "stats")) {
+				/* Collect rule statistics, see
+				 * pachi-playout_stats gtp command. */
+				pp->stats = !optval || atoi(optval);
 			} else
 				die("playout-moggy: Invalid policy argument %s or missing value\n", optname);
 		}
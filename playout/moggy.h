@@ -1,10 +1,22 @@
 #ifndef PACHI_PLAYOUT_MOGGY_H
 #define PACHI_PLAYOUT_MOGGY_H
 
+#include <stdio.h>
+
 struct board;
 struct playout_policy;
 struct joseki_dict;
 
+/* 3x3 patterns used by moggy (and the gamma policy). */
+#define PAT3_N 15
+extern char moggy_patterns_src[PAT3_N][11];
+
 struct playout_policy *playout_moggy_init(char *arg, struct board *b, struct joseki_dict *jdict);
 
+/* Rule statistics collected with the "stats" moggy option, summed over
+ * all threads that have exited so far (uct threads exit at the end of
+ * each search) and the calling thread (montecarlo, replay engines). */
+void moggy_stats_print(FILE *f);
+void moggy_stats_reset(void);
+
 #endif
@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "debug.h"
+#include "move.h"
+#include "poscache.h"
+
+#define POSCACHE_WAYS 4
+
+/* Quantization: [0,1] -> 0..QMAX, QNAN for NAN. */
+#define QMAX 65534
+#define QNAN 65535
+
+struct poscache_entry {
+	/* Odd while being written. */
+	unsigned int seq;
+	unsigned char ref;
+	hash_t key;
+	uint16_t probs[];
+};
+
+struct poscache {
+	int n;
+	int sets;
+	size_t entry_size;
+	char *entries;
+
+	int hits, misses;
+};
+
+#define poscache_entry(pc, i) ((struct poscache_entry *) ((pc)->entries + (size_t)(i) * (pc)->entry_size))
+
+/* Key 0 is reserved for empty entries. */
+#define poscache_fixkey(key) ((key) | 1)
+
+
+struct poscache *
+poscache_init(int entries, int n)
+{
+	struct poscache *pc = calloc2(1, sizeof(*pc));
+	pc->n = n;
+	pc->sets = 1;
+	while (pc->sets * POSCACHE_WAYS < entries)
+		pc->sets <<= 1;
+	pc->entry_size = (sizeof(struct poscache_entry) + n * sizeof(uint16_t) + 7) & ~7;
+	pc->entries = calloc2(pc->sets * POSCACHE_WAYS, pc->entry_size);
+	return pc;
+}
+
+void
+poscache_done(struct poscache *pc)
+{
+	free(pc->entries);
+	free(pc);
+}
+
+bool
+poscache_get(struct poscache *pc, hash_t key, float probs[])
+{
+	key = poscache_fixkey(key);
+	int set = (key >> 32) & (pc->sets - 1);
+	for (int w = 0; w < POSCACHE_WAYS; w++) {
+		struct poscache_entry *e = poscache_entry(pc, set * POSCACHE_WAYS + w);
+		unsigned int seq = *(volatile unsigned int *)&e->seq;
+		if (seq & 1)
+			continue;
+		__sync_synchronize();
+		if (e->key != key)
+			continue;
+		for (int i = 0; i < pc->n; i++)
+			probs[i] = (e->probs[i] == QNAN ? NAN : (float)e->probs[i] / QMAX);
+		__sync_synchronize();
+		if (*(volatile unsigned int *)&e->seq != seq)
+			continue;  /* Torn read, entry got replaced meanwhile. */
+
+		e->ref = 1;
+		__sync_fetch_and_add(&pc->hits, 1);
+		return true;
+	}
+	__sync_fetch_and_add(&pc->misses, 1);
+	return false;
+}
+
+void
+poscache_put(struct poscache *pc, hash_t key, float probs[])
+{
+	key = poscache_fixkey(key);
+	int set = (key >> 32) & (pc->sets - 1);
+
+	/* Already there (another thread was faster) or free entry ? */
+	struct poscache_entry *victim = NULL;
+	for (int w = 0; w < POSCACHE_WAYS; w++) {
+		struct poscache_entry *e = poscache_entry(pc, set * POSCACHE_WAYS + w);
+		if (e->key == key)
+			return;
+		if (!e->key && !victim)
+			victim = e;
+	}
+
+	/* Clock: evict the first entry not referenced since last sweep. */
+	for (int w = 0; !victim && w < 2 * POSCACHE_WAYS; w++) {
+		struct poscache_entry *e = poscache_entry(pc, set * POSCACHE_WAYS + w % POSCACHE_WAYS);
+		if (e->ref)
+			e->ref = 0;
+		else
+			victim = e;
+	}
+	assert(victim);
+
+	unsigned int seq = victim->seq;
+	if (seq & 1 || !__sync_bool_compare_and_swap(&victim->seq, seq, seq + 1))
+		return;  /* Someone else is writing here. */
+
+	victim->key = key;
+	for (int i = 0; i < pc->n; i++) {
+		assert(isnan(probs[i]) || (probs[i] >= 0 && probs[i] <= 1));
+		victim->probs[i] = (isnan(probs[i]) ? QNAN : (uint16_t)(probs[i] * QMAX + 0.5));
+	}
+	victim->ref = 1;
+	__sync_synchronize();
+	victim->seq = seq + 2;
+}
+
+void
+poscache_print_stats(struct poscache *pc, char *name)
+{
+	int total = pc->hits + pc->misses;
+	fprintf(stderr, "%s cache: %d hits, %d misses (%.1f%% hits)\n",
+		name, pc->hits, pc->misses, total ? pc->hits * 100.0 / total : 0.);
+}
+
+hash_t
+poscache_key(struct board *b, enum stone color, int nlast)
+{
+	coord_t last[4] = { b->last_move.coord, b->last_move2.coord,
+			    b->last_move3.coord, b->last_move4.coord };
+	assert(nlast <= 4);
+
+	hash_t key = b->hash ^ (color == S_BLACK ? 0x5bd1e9955bd1e995ULL : 0);
+	for (int i = 0; i < nlast; i++)
+		key = (key ^ (hash_t)(last[i] + 3)) * 0x9e3779b97f4a7c15ULL;
+	key = (key ^ (hash_t)(b->ko.coord + 3)) * 0x9e3779b97f4a7c15ULL;
+	return key;
+}
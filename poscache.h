@@ -0,0 +1,39 @@
+#ifndef PACHI_POSCACHE_H
+#define PACHI_POSCACHE_H
+
+/* Bounded cache of per-position move probabilities (dcnn output,
+ * pattern ratings), keyed by position hash. */
+
+/* The cache is set-associative with clock-like replacement: each
+ * entry has a reference bit set on hits, insertion evicts the first
+ * unreferenced entry of the set (clearing the bits on the way).
+ * Probabilities are stored quantized to 16 bits.
+ * Lookups are lock-free (entries are protected by a sequence counter
+ * and a torn read is just a miss); concurrent insertions into the
+ * same entry are simply dropped. */
+
+#include <stdint.h>
+#include "board.h"
+
+struct poscache;
+
+/* Cache of @entries entries (rounded up to a power of two)
+ * of @n probabilities each. */
+struct poscache *poscache_init(int entries, int n);
+void poscache_done(struct poscache *pc);
+
+/* Lookup @key, on hit copy the probabilities to @probs. NAN values
+ * are preserved. Thread safe. */
+bool poscache_get(struct poscache *pc, hash_t key, float probs[]);
+/* Store probabilities (all in [0,1] or NAN) for @key. Thread safe. */
+void poscache_put(struct poscache *pc, hash_t key, float probs[]);
+
+/* Print hit/miss counters to stderr. */
+void poscache_print_stats(struct poscache *pc, char *name);
+
+/* Key for position @b with @color to play. The last @nlast moves (up
+ * to 4) and the ko are mixed in as well since evaluations usually
+ * depend on them. */
+hash_t poscache_key(struct board *b, enum stone color, int nlast);
+
+#endif
@@ -28,7 +28,7 @@ probdist_pick(struct probdist *restrict pd, coord_t *restrict ignore)
 		r++; assert(r < board_size(pd->b));
 
 		c += board_size(pd->b);
-		while (!is_pass(*ignore) && *ignore <= c)
+		while (!is_pass(*ignore) && *ignore < c)
 			ignore++;
 	}
 
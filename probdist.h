@@ -44,6 +44,9 @@ static void probdist_set(struct probdist *pd, coord_t c, fixp_t val);
  * must restore the totals afterwards. */
 static void probdist_mute(struct probdist *pd, coord_t c);
 
+/* Put muted item back into the totals. */
+static void probdist_unmute(struct probdist *pd, coord_t c);
+
 /* Pick a random item. ignore is a pass-terminated sorted array of items
  * that are not to be considered (and whose values are not in @total). */
 coord_t probdist_pick(struct probdist *pd, coord_t *ignore);
@@ -76,4 +79,11 @@ probdist_mute(struct probdist *pd, coord_t c)
 	pd->rowtotals[coord_y(c, pd->b)] -= pd->items[c];
 }
 
+static inline void
+probdist_unmute(struct probdist *pd, coord_t c)
+{
+	pd->total += pd->items[c];
+	pd->rowtotals[coord_y(c, pd->b)] += pd->items[c];
+}
+
 #endif
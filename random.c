@@ -1,10 +1,59 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "random.h"
 
 
-/* Simple Park-Miller for floating point; LCG as used in glibc and other places */
-/*用于浮点的简单Park Miller；用于glibc和其他地方的lcg*/
+/* xoshiro256** (Blackman & Vigna), seeded through splitmix64 so that
+ * close seeds (thread seeds, force_seed) still give unrelated streams. */
+
+struct random_state {
+	uint64_t s[4];
+	unsigned long seed;
+};
+
+/* State for the default seed (29264), used until fast_srandom(). */
+#define RANDOM_STATE_INIT  { { 0xd77f80bdf45ea0efULL, 0x3b80ea921a2d4308ULL, \
+			       0x2b0b6ff148e10370ULL, 0xc58517fe6ad13fe6ULL }, 29264 }
+
+static inline uint64_t
+splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static void
+random_state_seed(struct random_state *r, unsigned long seed)
+{
+	uint64_t x = seed;
+	for (int i = 0; i < 4; i++)
+		r->s[i] = splitmix64(&x);
+	r->seed = seed;
+}
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t
+random_state_next(struct random_state *r)
+{
+	uint64_t *s = r->s;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
 
 
 /********************************************************************************************/
@@ -14,33 +63,24 @@
  * mingw-w64's __thread is painfully slow. */
 
 static int tls_index = -1;
-//在主函数之前运行
+
 static void __attribute__((constructor))
 init_fast_random()
 {
 	tls_index = TlsAlloc();
-	fast_srandom(29264);
 }
 
-void
-fast_srandom(unsigned long seed_)
-{
-	TlsSetValue(tls_index, (void*)(intptr_t)seed_);
-}
-
-unsigned long
-fast_getseed(void)
-{
-	return (unsigned long)(intptr_t)TlsGetValue(tls_index);
-}
-
-uint16_t
-fast_random(unsigned int max)
+static inline struct random_state *
+random_state(void)
 {
-	unsigned long pmseed = fast_getseed();
-	pmseed = ((pmseed * 1103515245) + 12345) & 0x7fffffff;
-	fast_srandom(pmseed);
-	return ((pmseed & 0xffff) * max) >> 16;
+	struct random_state *r = TlsGetValue(tls_index);
+	if (unlikely(!r)) {
+		static const struct random_state init = RANDOM_STATE_INIT;
+		r = malloc2(sizeof(*r));
+		*r = init;
+		TlsSetValue(tls_index, r);
+	}
+	return r;
 }
 
 
@@ -49,41 +89,15 @@ fast_random(unsigned int max)
 
 /********************************************************************************************/
 #ifndef NO_THREAD_LOCAL
-//线程中的随机变量，为了完成线程的独立性
-//随机的初始值 在计算过程中是多线程的，为了还原现场
-//每个线程有一个独立的随机种子
-static __thread unsigned long pmseed = 29264;
+/* Each thread has its own generator, initially all seeded the same. */
+static __thread struct random_state tls_state = RANDOM_STATE_INIT;
 
-void
-fast_srandom(unsigned long seed_)
+static inline struct random_state *
+random_state(void)
 {
-	pmseed = seed_;
+	return &tls_state;
 }
 
-unsigned long
-fast_getseed(void)
-{
-	return pmseed;
-}
-//他要生成一个不大于max的随机数 列成一个公式(x×max)/(2^16) < max 
-uint16_t
-fast_random(unsigned int max)
-{
-    //寻找的一个尽可能长的循环节，每个状态只出现一次，在这个序列环中不会出现分叉
-    //运用加法的情况是乘法无法跳出0状态
-	pmseed = ((pmseed * 1103515245) + 12345) & 0x7fffffff;
-	return ((pmseed & 0xffff) * max) >> 16;
-}
-
-float
-fast_frandom(void)
-{
-	/* Construct (1,2) IEEE floating_t from our random integer */
-	/* http://rgba.org/articles/sfrand/sfrand.htm */
-	union { unsigned long ul; floating_t f; } p;
-	p.ul = (((pmseed *= 16807) & 0x007fffff) - 1) | 0x3f800000;
-	return p.f - 1.0f;
-}
 
 #else
 
@@ -95,48 +109,72 @@ fast_frandom(void)
 
 #include <pthread.h>
 
-static pthread_key_t seed_key;
+static pthread_key_t state_key;
 
 static void __attribute__((constructor))
 random_init(void)
 {
-	pthread_key_create(&seed_key, NULL);
-	fast_srandom(29264UL);
+	pthread_key_create(&state_key, free);
+}
+
+static inline struct random_state *
+random_state(void)
+{
+	struct random_state *r = pthread_getspecific(state_key);
+	if (unlikely(!r)) {
+		static const struct random_state init = RANDOM_STATE_INIT;
+		r = malloc2(sizeof(*r));
+		*r = init;
+		pthread_setspecific(state_key, r);
+	}
+	return r;
 }
 
+#endif
+#endif
+
+
+/********************************************************************************************/
+
 void
-fast_srandom(unsigned long seed_)
+fast_srandom(unsigned long seed)
 {
-	pthread_setspecific(seed_key, (void *)seed_);
+	random_state_seed(random_state(), seed);
 }
 
 unsigned long
 fast_getseed(void)
 {
-	return (unsigned long)pthread_getspecific(seed_key);
+	return random_state()->seed;
+}
+
+uint64_t
+fast_random64(void)
+{
+	return random_state_next(random_state());
 }
 
 uint16_t
 fast_random(unsigned int max)
 {
-	unsigned long pmseed = (unsigned long)pthread_getspecific(seed_key);
-	pmseed = ((pmseed * 1103515245) + 12345) & 0x7fffffff;
-	pthread_setspecific(seed_key, (void *)pmseed);
-	return ((pmseed & 0xffff) * max) >> 16;
+	/* Multiply-shift on the high bits, no division. */
+	return ((random_state_next(random_state()) >> 32) * max) >> 32;
 }
 
 float
 fast_frandom(void)
 {
-	/* Construct (1,2) IEEE floating_t from our random integer */
-	/* http://rgba.org/articles/sfrand/sfrand.htm */
-	unsigned long pmseed = (unsigned long)pthread_getspecific(seed_key);
-	pmseed *= 16807;
-	union { unsigned long ul; floating_t f; } p;
-	p.ul = ((pmseed & 0x007fffff) - 1) | 0x3f800000;
-	pthread_setspecific(seed_key, (void *)pmseed);
-	return p.f - 1.0f;
+	/* 24 random bits, exactly representable. */
+	return (random_state_next(random_state()) >> 40) * (1.0f / 16777216.0f);
 }
 
-#endif
-#endif
+void
+fast_random_block(uint16_t *rolls, int n, unsigned int max)
+{
+	struct random_state *r = random_state();
+	for (int i = 0; i < n; i += 4) {
+		uint64_t x = random_state_next(r);
+		for (int j = 0; j < 4 && i + j < n; j++, x >>= 16)
+			rolls[i + j] = ((x & 0xffff) * max) >> 16;
+	}
+}
@@ -5,9 +5,16 @@
 
 #include "util.h"
 
+/* Per-thread generators. Seeding a thread with fast_srandom() makes its
+ * stream reproducible; different seeds give independent streams. */
 void fast_srandom(unsigned long seed);
+/* Seed last set in this thread. */
 unsigned long fast_getseed(void);
 
+/* Raw 64 random bits. */
+uint64_t fast_random64(void);
+
+/* Random number in [0..max), max <= 65536. */
 /* Note that only 16bit numbers can be returned. */
 /*请注意，只能返回16位数字。*/
 uint16_t fast_random(unsigned int max);
@@ -18,15 +25,16 @@ static uint32_t fast_irandom(unsigned int max);
 /* Get random number in [0..1] range. */
 float fast_frandom();
 
+/* Fill @rolls with @n random numbers in [0..max), max <= 65536.
+ * Cheaper than @n fast_random() calls (four rolls per draw), useful
+ * to roll all playout policy rates at once. */
+void fast_random_block(uint16_t *rolls, int n, unsigned int max);
+
 
 static inline uint32_t
 fast_irandom(unsigned int max)
 {
-	if (max <= 65536)
-		return fast_random(max);
-	int himax = (max - 1) / 65536;
-	uint16_t hi = fast_random(himax + 1);
-	return ((uint32_t)hi << 16) | fast_random(hi < himax ? 65536 : max % 65536);
+	return ((fast_random64() >> 32) * (uint64_t)max) >> 32;
 }
 
 #endif
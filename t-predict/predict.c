@@ -1,6 +1,7 @@
 #define DEBUG
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include "board.h"
 #include "debug.h"
 #include "timeinfo.h"
@@ -261,6 +262,184 @@ predict_stats(struct board *b, struct move *m, coord_t *best_c, float *best_r)
 	return NULL;
 }
 
+static void
+predict_best_moves(struct board *b, struct engine *engine, struct time_info *ti, struct move *m,
+		   coord_t *best_c, float *best_r)
+{
+	for (int i = 0; i < PREDICT_TOPN; i++)
+		best_c[i] = pass;
+	engine->best_moves(engine, b, ti, m->color, best_c, best_r, PREDICT_TOPN);
+	//print_dcnn_best_moves(b, best_c, best_r, PREDICT_TOPN);
+
+	// Play correct expected move
+	if (board_play(b, m) < 0) {
+		fprintf(stderr, "ILLEGAL EXPECTED MOVE: [%s, %s]\n", coord2sstr(m->coord, b), stone2str(m->color));
+		abort();
+	}
+}
+
+static void
+predict_log(struct board *b, struct move *m, coord_t *best_c)
+{
+	fprintf(stderr, "WINNER is %s in the actual game.\n", coord2sstr(m->coord, b));		
+	if (best_c[0] == m->coord)
+		fprintf(stderr, "Move %3i: Predict: Correctly predicted %s %s\n", b->moves,
+			(m->color == S_BLACK ? "b" : "w"), coord2sstr(best_c[0], b));
+	else
+		fprintf(stderr, "Move %3i: Predict: Wrong prediction: %s %s != %s\n", b->moves,
+			(m->color == S_BLACK ? "b" : "w"), coord2sstr(best_c[0], b), coord2sstr(m->coord, b));
+}
+
+
+/* Parallel mode: the gtp thread keeps replaying the games while worker
+ * threads, each with its own engine instance, evaluate the positions.
+ * Jobs are numbered in game order and their stats are collected in that
+ * order, whatever order they complete in, so the report is the same as
+ * with one thread. It comes with the next predict reply. */
+
+struct predict_job {
+	struct board b;		/* Position before the move */
+	struct move m;
+	struct time_info ti;
+	bool done;
+	float   best_r[PREDICT_TOPN];
+	coord_t best_c[PREDICT_TOPN];
+};
+
+#define PREDICT_QUEUE 64
+
+static int predict_threads = 0;
+static engine_init_t predict_engine_init;
+static char *predict_engine_arg;
+
+/* Jobs not collected yet, indexed by job number. */
+static struct predict_job *queue[PREDICT_QUEUE];
+static int jobs_queued = 0, jobs_taken = 0, jobs_collected = 0;
+static bool quit = false;
+static pthread_t *workers;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;   /* Job queued or quit */
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;    /* Job collected */
+static char *report = NULL;
+
+/* Engine init may set up global data (dcnn, patterns), one at a time. */
+static pthread_mutex_t engine_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Collect stats of finished jobs in game order, queue_lock held. */
+static void
+predict_collect()
+{
+	while (jobs_collected < jobs_taken) {
+		struct predict_job *job = queue[jobs_collected % PREDICT_QUEUE];
+		if (!job->done)
+			break;
+		predict_log(&job->b, &job->m, job->best_c);
+		char *str = predict_stats(&job->b, &job->m, job->best_c, job->best_r);
+		if (str) {  free(report);  report = str;  }
+		free(job);
+		jobs_collected++;
+		pthread_cond_broadcast(&done_cond);
+	}
+}
+
+static void *
+predict_worker(void *arg)
+{
+	struct engine *engine = NULL;
+
+	pthread_mutex_lock(&queue_lock);
+	while (true) {
+		while (jobs_taken == jobs_queued && !quit)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+		if (jobs_taken == jobs_queued)
+			break;
+		struct predict_job *job = queue[jobs_taken++ % PREDICT_QUEUE];
+		pthread_mutex_unlock(&queue_lock);
+
+		if (!engine) {
+			char *earg = predict_engine_arg ? strdup(predict_engine_arg) : NULL;
+			pthread_mutex_lock(&engine_lock);
+			engine = predict_engine_init(earg, &job->b);
+			pthread_mutex_unlock(&engine_lock);
+			free(earg);
+		}
+
+		for (int i = 0; i < PREDICT_TOPN; i++)
+			job->best_r[i] = 0.0;
+		predict_best_moves(&job->b, engine, &job->ti, &job->m, job->best_c, job->best_r);
+
+		pthread_mutex_lock(&queue_lock);
+		job->done = true;
+		predict_collect();
+	}
+	pthread_mutex_unlock(&queue_lock);
+
+	if (engine)  engine_done(engine);
+	return NULL;
+}
+
+void
+predict_init(int threads, engine_init_t engine_init, char *engine_arg)
+{
+	assert(threads > 0);
+	predict_threads = threads;
+	predict_engine_init = engine_init;
+	predict_engine_arg = engine_arg ? strdup(engine_arg) : NULL;
+	workers = malloc2(threads * sizeof(*workers));
+	for (int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, predict_worker, NULL);
+}
+
+void
+predict_done()
+{
+	if (!predict_threads)
+		return;
+
+	pthread_mutex_lock(&queue_lock);
+	quit = true;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+	for (int i = 0; i < predict_threads; i++)
+		pthread_join(workers[i], NULL);
+	free(workers);
+	free(predict_engine_arg);
+	predict_threads = 0;
+
+	/* Last report didn't make it through gtp. */
+	if (report) {
+		printf("%s\n", report);
+		free(report);  report = NULL;
+	}
+}
+
+static char *
+predict_move_parallel(struct board *b, struct time_info *ti, struct move *m)
+{
+	struct predict_job *job = malloc2(sizeof(*job));
+	board_copy(&job->b, b);
+	job->m = *m;
+	job->ti = *time_info_genmove(b, ti, m->color);
+	job->done = false;
+
+	/* Replay goes on right away. */
+	if (board_play(b, m) < 0) {
+		fprintf(stderr, "ILLEGAL EXPECTED MOVE: [%s, %s]\n", coord2sstr(m->coord, b), stone2str(m->color));
+		abort();
+	}
+
+	pthread_mutex_lock(&queue_lock);
+	while (jobs_queued - jobs_collected == PREDICT_QUEUE)
+		pthread_cond_wait(&done_cond, &queue_lock);
+	queue[jobs_queued++ % PREDICT_QUEUE] = job;
+	pthread_cond_signal(&queue_cond);
+
+	char *str = report;
+	report = NULL;
+	pthread_mutex_unlock(&queue_lock);
+	return str;
+}
+
 char *
 predict_move(struct board *b, struct engine *engine, struct time_info *ti, struct move *m)
 {
@@ -273,6 +452,8 @@ predict_move(struct board *b, struct engine *engine, struct time_info *ti, struc
 
 	if (DEBUGL(5))
 		fprintf(stderr, "predict move %d,%d,%d\n", m->color, coord_x(m->coord, b), coord_y(m->coord, b));
+	if (predict_threads)
+		return predict_move_parallel(b, ti, m);
 	if (DEBUGL(1) && debug_boardprint)
 		engine_board_print(engine, b, stderr);
 
@@ -280,25 +461,9 @@ predict_move(struct board *b, struct engine *engine, struct time_info *ti, struc
 
 	float   best_r[PREDICT_TOPN] = { 0.0, };
 	coord_t best_c[PREDICT_TOPN];
-	for (int i = 0; i < PREDICT_TOPN; i++)
-		best_c[i] = pass;
 	struct time_info *ti_genmove = time_info_genmove(b, ti, color);
-	engine->best_moves(engine, b, ti_genmove, color, best_c, best_r, PREDICT_TOPN);
-	//print_dcnn_best_moves(b, best_c, best_r, PREDICT_TOPN);
-
-	// Play correct expected move
-	if (board_play(b, m) < 0) {
-		fprintf(stderr, "ILLEGAL EXPECTED MOVE: [%s, %s]\n", coord2sstr(m->coord, b), stone2str(m->color));
-		abort();
-	}
-
-	fprintf(stderr, "WINNER is %s in the actual game.\n", coord2sstr(m->coord, b));		
-	if (best_c[0] == m->coord)
-		fprintf(stderr, "Move %3i: Predict: Correctly predicted %s %s\n", b->moves,
-			(color == S_BLACK ? "b" : "w"), coord2sstr(best_c[0], b));
-	else
-		fprintf(stderr, "Move %3i: Predict: Wrong prediction: %s %s != %s\n", b->moves,
-			(color == S_BLACK ? "b" : "w"), coord2sstr(best_c[0], b), coord2sstr(m->coord, b));
+	predict_best_moves(b, engine, ti_genmove, m, best_c, best_r);
+	predict_log(b, m, best_c);
 
 	if (DEBUGL(1) && debug_boardprint)
 		engine_board_print(engine, b, stderr);
@@ -1,8 +1,19 @@
 #ifndef PACHI_PREDICT_PREDICT_H
 #define PACHI_PREDICT_PREDICT_H
 
+#include "engine.h"
+
 /* See if engine guesses move m, and return stats string from time to time.
  * Returned string must be freed */
 char *predict_move(struct board *b, struct engine *engine, struct time_info *ti, struct move *m);
 
+/* Evaluate positions in parallel with @threads worker threads, each
+ * with its own engine created by @engine_init(@engine_arg), so the
+ * engine must not keep state in globals.
+ * Stats are collected in game order but lag a little behind the game
+ * replay. */
+void predict_init(int threads, engine_init_t engine_init, char *engine_arg);
+/* Wait for pending positions and print final stats. */
+void predict_done();
+
 #endif
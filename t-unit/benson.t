@@ -0,0 +1,49 @@
+
+% Two eyes, dead stone inside
+boardsize 7
+X X X X . . .
+X O . X . . .
+X X X X . . .
+. X . X . . .
+X X X X . . .
+. . . . . . .
+. . . . . . .
+
+benson b5 x
+benson b6 x
+benson c6 x
+benson a4 x
+benson e5 .
+benson a2 .
+
+
+% One eye only
+boardsize 5
+. X . . .
+X X . . .
+. . . . .
+. . . . .
+. . . . .
+
+benson b5 .
+benson a5 .
+
+
+% Seki between alive walls
+boardsize 7
+X X O O X O O
+X X O O X O O
+X X O O X O O
+X X O O X O O
+. X O O X O .
+X X O . X O O
+. X O . X O .
+
+benson b4 x
+benson a1 x
+benson f4 o
+benson g3 o
+benson c4 .
+benson d1 .
+benson c4 seki
+benson e4 seki
@@ -0,0 +1,49 @@
+% Dead stone, its liberties are not dame
+boardsize 5
+. O . X .
+X X X X .
+. . . X .
+. . . X .
+. . . X .
+
+settle a5 -
+settle c5 -
+
+% Dead stones on the edge, two point mixed regions
+boardsize 7
+. . O O . . X
+X X X X X X X
+. . . . . . .
+. . . . . . .
+. . . . . . .
+. . . . . . .
+. . . . . . .
+
+settle a7 -
+settle e7 -
+
+% One eye only, next to dame
+boardsize 5
+. O . X .
+O O X X .
+O O X . .
+X X X . .
+. . . . .
+
+settle c5 -
+
+% Real dame between two living groups
+boardsize 5
+. X . O .
+X X . O O
+. X X O .
+X X . O O
+. X . O .
+
+settle c5 .
+settle c4 .
+settle c2 .
+settle a5 x
+settle a3 x
+settle e3 o
+settle e1 o
@@ -12,12 +12,15 @@
 #include "tactics/ladder.h"
 #include "tactics/1lib.h"
 #include "tactics/seki.h"
+#include "tactics/benson.h"
 #include "util.h"
 #include "random.h"
 #include "playout.h"
 #include "timeinfo.h"
 #include "playout/moggy.h"
+#include "playout/gamma.h"
 #include "engines/replay.h"
+#include "distributed/wire.h"
 #include "ownermap.h"
 
 /* Running tests over gtp ? */
@@ -382,6 +385,70 @@ test_two_eyes(struct board *b, char *arg)
 }
 
 
+/* Static status of @coord (see tactics/benson.h):
+ *   benson coord x|o       unconditionally black / white
+ *   benson coord .         not proven
+ *   benson coord seki      group in simple seki */
+static bool
+test_benson(struct board *b, char *arg)
+{
+	next_arg(arg);
+	coord_t c = str2coord(arg, board_size(b));
+	next_arg(arg);
+	char *expected = arg;
+	args_end();
+
+	PRINT_TEST(b, "benson %s %s...\t", coord2sstr(c, b), expected);
+
+	enum stone owner[board_size2(b)];
+	benson_owner_map(b, owner);
+	bool rres;
+	if (!strcasecmp(expected, "seki")) {
+		assert(group_at(b, c));
+		rres = group_in_simple_seki(b, group_at(b, c), owner);
+	} else {
+		if (strlen(expected) != 1 || !strchr("xo.", tolower(*expected)))
+			die("Expected x/o/./seki after coord %s\n", coord2sstr(c, b));
+		rres = (tolower(stone2char(owner[c])) == tolower(*expected));
+	}
+
+	PRINT_RES(rres);
+	return   rres;
+}
+
+
+/* Settled check ending playouts early (see playout_settled()):
+ *   settle coord x|o|.     settled, empty @coord owned by black / white / dame
+ *   settle coord -         not settled */
+static bool
+test_settle(struct board *b, char *arg)
+{
+	next_arg(arg);
+	coord_t c = str2coord(arg, board_size(b));
+	next_arg(arg);
+	char *expected = arg;
+	args_end();
+
+	PRINT_TEST(b, "settle %s %s...\t", coord2sstr(c, b), expected);
+
+	if (strlen(expected) != 1 || !strchr("xo.-", tolower(*expected)))
+		die("Expected x/o/./- after coord %s\n", coord2sstr(c, b));
+	assert(board_at(b, c) == S_NONE);
+
+	enum stone owner[board_size2(b)];
+	coord_t hint = pass;
+	bool settled = playout_settled(b, &hint, owner, NULL);
+	bool rres;
+	if (*expected == '-')
+		rres = !settled;
+	else
+		rres = settled && (tolower(stone2char(owner[c])) == tolower(*expected));
+
+	PRINT_RES(rres);
+	return   rres;
+}
+
+
 /* Sample moves played by moggy in a given position.
  * Board last move matters quite a lot and must be set.
  * 
@@ -518,6 +585,147 @@ test_moggy_status(struct board *b, char *arg)
 	return ret;
 }
 
+/* Play @games gamma playouts from this position, checking after every
+ * move that the incrementally updated weights match a full rebuild (see
+ * playout/gamma.c). Some moves are played behind the policy's back so
+ * that it catches up with two moves at once. */
+static bool
+test_gamma_incremental(struct board *b, char *arg)
+{
+	next_arg(arg);
+	int games = atoi(arg);
+	args_end();
+
+	PRINT_TEST(b, "gamma_incremental %i...\t", games);
+
+	enum stone color = (is_pass(b->last_move.coord) ? S_BLACK : stone_other(b->last_move.color));
+	struct playout_policy *policy = playout_gamma_init(NULL, b);
+	struct playout_setup setup = { .gamelen = MAX_GAMELEN };
+
+	bool rres = true;
+	for (int i = 0; i < games && rres; i++) {
+		struct board b2;
+		board_copy(&b2, b);
+		policy->setboard(policy, &b2);
+
+		enum stone to_play = color;
+		int passes = 0;
+		for (int moves = 0; moves < MAX_GAMELEN && passes < 2 && rres; moves++) {
+			coord_t c;
+			bool behind = !fast_random(4);
+			if (behind)
+				board_play_random(&b2, to_play, &c, NULL, NULL);
+			else
+				c = play_random_move(&setup, &b2, to_play, policy);
+			passes = (is_pass(c) ? passes + 1 : 0);
+			to_play = stone_other(to_play);
+			if (!behind)
+				rres = playout_gamma_check(policy, &b2);
+		}
+		board_done_noalloc(&b2);
+	}
+
+	playout_policy_done(policy);
+	PRINT_RES(rres);
+	return   rres;
+}
+
+/* Check that @n decoded stats are a prefix of @ref (values within
+ * the 16 bits quantization of WIRE_PACKED). */
+static bool
+wire_same(struct incr_stats *ref, struct incr_stats *stats, int n)
+{
+	for (int i = 0; i < n; i++)
+		if (stats[i].coord_path != ref[i].coord_path
+		    || stats[i].incr.playouts != ref[i].incr.playouts
+		    || fabs(stats[i].incr.value - ref[i].incr.value) > 1.0 / 65535)
+			return false;
+	return true;
+}
+
+/* Decode a copy of in[0..size-1] in a buffer of exactly @size bytes,
+ * so that reads past the end show up with -fsanitize=address. */
+static int
+wire_decode_copy(enum wire_format f, uint8_t *in, int size, struct incr_stats *stats, int max_nodes, void *tmp)
+{
+	uint8_t *copy = malloc2(size ? size : 1);
+	memcpy(copy, in, size);
+	int n = wire_decode(f, copy, size, stats, max_nodes, tmp);
+	free(copy);
+	return n;
+}
+
+/* Round trip @nodes random stats through wire format raw|packed|lz4,
+ * then decode every truncation and random corruptions of the encoded
+ * stats: they must be rejected or decode to sane stats. */
+static bool
+test_wire(struct board *b, char *arg)
+{
+	next_arg(arg);
+	char *name = arg;
+	next_arg(arg);
+	int nodes = atoi(arg);
+	args_end();
+
+	PRINT_TEST(b, "wire %s %i...\t", name, nodes);
+
+	enum wire_format f = (!strcmp(name, "raw") ? WIRE_RAW :
+			      !strcmp(name, "packed") ? WIRE_PACKED : WIRE_LZ4);
+	if (f > WIRE_MAX) {
+		if (DEBUGL(1))  fprintf(stderr, "no LZ4 support, skipped ");
+		PRINT_RES(true);
+		return true;
+	}
+
+	struct incr_stats *ref = malloc2(nodes * sizeof(*ref));
+	struct incr_stats *stats = malloc2(nodes * sizeof(*stats));
+	uint8_t *enc = malloc2(wire_max_size(nodes));
+	void *tmp = malloc2(wire_tmp_size(nodes));
+
+	/* Mostly small path deltas as in a real tree, some big ones. */
+	path_t path = 0;
+	for (int i = 0; i < nodes; i++) {
+		path += fast_random(8) ? 1 + fast_random(1000) : 1 + (path_t)(fast_random64() >> 24);
+		ref[i].coord_path = path;
+		ref[i].incr.playouts = 1 + fast_irandom(fast_random(2) ? 100 : 1000000);
+		ref[i].incr.value = fast_frandom();
+	}
+
+	int size = wire_encode(f, ref, nodes, enc, tmp);
+	bool rres = wire_decode_copy(f, enc, size, stats, nodes, tmp) == nodes
+		    && wire_same(ref, stats, nodes);
+	if (nodes > 0)
+		rres &= wire_decode_copy(f, enc, size, stats, nodes - 1, tmp) == -1;
+	if (!rres && DEBUGL(2))  fprintf(stderr, "round trip failed ");
+
+	/* Truncated: rejected, or a prefix of the stats (but lz4 has
+	 * the packed size). */
+	for (int len = 1; len < size && rres; len++) {
+		int n = wire_decode_copy(f, enc, len, stats, nodes, tmp);
+		rres = n == -1 || (f != WIRE_LZ4 && n < nodes && wire_same(ref, stats, n));
+		if (!rres && DEBUGL(2))  fprintf(stderr, "truncated to %d/%d bytes: %d nodes ", len, size, n);
+	}
+
+	/* Corrupt: raw can't tell, packed and lz4 must give sane stats. */
+	uint8_t *bad = malloc2(size ? size : 1);
+	for (int i = 0; i < 2000 && size && rres; i++) {
+		memcpy(bad, enc, size);
+		for (int k = 1 + fast_random(3); k; k--)
+			bad[fast_irandom(size)] ^= 1 << fast_random(8);
+		int n = wire_decode_copy(f, bad, size, stats, nodes, tmp);
+		rres = n >= -1 && n <= nodes;
+		for (int j = 0; j < n && f != WIRE_RAW && rres; j++)
+			rres = stats[j].coord_path > (j ? stats[j - 1].coord_path : 0)
+				&& stats[j].incr.playouts > 0
+				&& stats[j].incr.value >= 0 && stats[j].incr.value <= 1;
+		if (!rres && DEBUGL(2))  fprintf(stderr, "corrupt input: %d nodes ", n);
+	}
+
+	free(bad); free(tmp); free(enc); free(stats); free(ref);
+	PRINT_RES(rres);
+	return   rres;
+}
+
 bool board_undo_stress_test(struct board *orig, char *arg);
 
 typedef bool (*t_unit_func)(struct board *board, char *arg);
@@ -537,6 +745,10 @@ static t_unit_cmd commands[] = {
 	{ "useful_ladder",          test_useful_ladder,     1 },
 	{ "can_countercap",         test_can_countercap,    1 },
 	{ "two_eyes",               test_two_eyes,          1 },
+	{ "benson",                 test_benson,            1 },
+	{ "settle",                 test_settle,            1 },
+	{ "gamma_incremental",      test_gamma_incremental, 1 },
+	{ "wire",                   test_wire,              1 },
 	{ "moggy moves",            test_moggy_moves,       0 },
 	{ "moggy status",           test_moggy_status,      1 },
 	{ "board_undo_stress_test", board_undo_stress_test, 0 },
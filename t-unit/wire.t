@@ -0,0 +1,10 @@
+% Distributed engine stats wire formats (distributed/wire.h)
+wire raw 0
+wire raw 1
+wire raw 300
+wire packed 0
+wire packed 1
+wire packed 300
+wire lz4 0
+wire lz4 1
+wire lz4 300
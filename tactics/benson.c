@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUICK_BOARD_CODE
+
+#define DEBUG
+#include "board.h"
+#include "debug.h"
+#include "mq.h"
+#include "tactics/benson.h"
+#include "tactics/selfatari.h"
+
+/* Benson's algorithm, for color X:
+ *  - Regions are maximal connected sets of non-X points (empty points
+ *    and opponent stones), so they are enclosed by X chains.
+ *  - Region R is vital to chain C if all empty points of R are
+ *    liberties of C.
+ *  - Repeatedly drop chains with less than two vital regions, and
+ *    regions bordering a dropped chain.
+ * Remaining chains can't be captured even if X never plays again. */
+
+/* Region R borders chain C. */
+struct benson_link {
+	int region;
+	group_t chain;
+	/* Empty points of R that are liberties of C. */
+	int libs;
+};
+
+void
+benson_unconditional(struct board *b, enum stone color, enum stone *owner)
+{
+	int size2 = board_size2(b);
+	int region_at[size2];	/* Region index + 1, 0 for X stones. */
+	coord_t points[size2];	/* Points of all regions, region by region. */
+	int rstart[size2 + 1], rempty[size2], rlinks[size2];
+	bool rsmall[size2], rhealthy[size2];
+	struct benson_link links[4 * size2];
+	int nregions = 0, npoints = 0, nlinks = 0;
+
+	/* Per chain (indexed by group_t) */
+	int lastregion[size2], linkidx[size2], vital[size2];
+	coord_t lastpoint[size2];
+	bool alive[size2];
+
+	memset(region_at, 0, sizeof(region_at));
+	memset(lastregion, 0, sizeof(lastregion));
+	memset(alive, 0, sizeof(alive));
+
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		if (s == color && group_at(b, c) == c)
+			alive[c] = true;
+		if (s == S_OFFBOARD || s == color || region_at[c])
+			continue;
+
+		/* Flood new region, collecting chains around it. */
+		int r = nregions++;
+		rstart[r] = npoints;
+		rempty[r] = rlinks[r] = 0;
+		rsmall[r] = rhealthy[r] = true;
+		region_at[c] = r + 1;
+		points[npoints++] = c;
+		for (int i = rstart[r]; i < npoints; i++) {
+			coord_t p = points[i];
+			bool empty = (board_at(b, p) == S_NONE);
+			bool touches = false;
+			if (empty)
+				rempty[r]++;
+			foreach_neighbor(b, p, {
+				enum stone s2 = board_at(b, c);
+				if (s2 == S_OFFBOARD)
+					continue;
+				if (s2 != color) {
+					if (!region_at[c]) {
+						region_at[c] = r + 1;
+						points[npoints++] = c;
+					}
+					continue;
+				}
+				touches = true;
+				group_t g = group_at(b, c);
+				if (lastregion[g] != r + 1) {
+					lastregion[g] = r + 1;
+					lastpoint[g] = pass;
+					linkidx[g] = nlinks;
+					links[nlinks].region = r;
+					links[nlinks].chain = g;
+					links[nlinks++].libs = 0;
+					rlinks[r]++;
+				}
+				if (empty && lastpoint[g] != p) {
+					lastpoint[g] = p;
+					links[linkidx[g]].libs++;
+				}
+			});
+			/* Interior point, opponent might make an eye here. */
+			if (empty && !touches)
+				rsmall[r] = false;
+		}
+	} foreach_point_end;
+	rstart[nregions] = npoints;
+
+	bool changed;
+	do {
+		changed = false;
+		for (int i = 0; i < nlinks; i++)
+			vital[links[i].chain] = 0;
+		for (int i = 0; i < nlinks; i++) {
+			struct benson_link *l = &links[i];
+			if (rhealthy[l->region] && rempty[l->region] && l->libs == rempty[l->region])
+				vital[l->chain]++;
+		}
+		for (int i = 0; i < nlinks; i++) {
+			group_t g = links[i].chain;
+			if (alive[g] && vital[g] < 2) {
+				alive[g] = false;
+				changed = true;
+			}
+		}
+		for (int i = 0; i < nlinks; i++) {
+			struct benson_link *l = &links[i];
+			if (!alive[l->chain] && rhealthy[l->region]) {
+				rhealthy[l->region] = false;
+				changed = true;
+			}
+		}
+	} while (changed);
+
+	foreach_point(b) {
+		if (board_at(b, c) == color && alive[group_at(b, c)])
+			owner[c] = color;
+	} foreach_point_end;
+
+	for (int r = 0; r < nregions; r++) {
+		if (!rhealthy[r] || !rsmall[r] || !rlinks[r])
+			continue;
+		for (int i = rstart[r]; i < rstart[r + 1]; i++)
+			owner[points[i]] = color;
+	}
+}
+
+void
+benson_owner_map(struct board *b, enum stone *owner)
+{
+	for (int i = 0; i < board_size2(b); i++)
+		owner[i] = S_NONE;
+	benson_unconditional(b, S_BLACK, owner);
+	benson_unconditional(b, S_WHITE, owner);
+
+	if (DEBUGL(6)) {
+		fprintf(stderr, "benson:\n");
+		foreach_point(b) {
+			if (board_at(b, c) == S_OFFBOARD)
+				continue;
+			fprintf(stderr, "%c%s", stone2char(owner[c]),
+				coord_x(c, b) == board_size(b) - 2 ? "\n" : " ");
+		} foreach_point_end;
+	}
+}
+
+/* All groups touching @g other than @g1, @g2 unconditionally alive ? */
+static bool
+neighbors_alive(struct board *b, group_t g, group_t g1, group_t g2, enum stone *owner)
+{
+	foreach_in_group(b, g) {
+		foreach_neighbor(b, c, {
+			group_t n = group_at(b, c);
+			if (!n || n == g1 || n == g2)
+				continue;
+			if (owner[c] != board_at(b, c))
+				return false;
+		});
+	} foreach_in_group_end;
+	return true;
+}
+
+bool
+group_in_simple_seki(struct board *b, group_t g, enum stone *owner)
+{
+	if (board_group_info(b, g).libs != 2)
+		return false;
+	enum stone color = board_at(b, g);
+	enum stone other_color = stone_other(color);
+	coord_t lib0 = board_group_info(b, g).lib[0];
+	coord_t lib1 = board_group_info(b, g).lib[1];
+
+	/* Opponent group with the same two liberties. */
+	group_t h = 0;
+	foreach_neighbor(b, lib0, {
+		group_t n = group_at(b, c);
+		if (board_at(b, c) != other_color || board_group_info(b, n).libs != 2)
+			continue;
+		if (board_group_info(b, n).lib[0] == lib1 || board_group_info(b, n).lib[1] == lib1)
+			h = n;
+	});
+	if (!h)
+		return false;
+
+	/* Neither side can approach. */
+	coord_t libs[2] = { lib0, lib1 };
+	for (int i = 0; i < 2; i++)
+		if (!is_selfatari(b, color, libs[i]) || !is_selfatari(b, other_color, libs[i]))
+			return false;
+
+	return (neighbors_alive(b, g, g, h, owner) &&
+		neighbors_alive(b, h, g, h, owner));
+}
+
+bool
+benson_final_status(struct board *b, struct move_queue *dead)
+{
+	enum stone owner[board_size2(b)];
+	benson_owner_map(b, owner);
+	dead->moves = 0;
+
+	foreach_point(b) {
+		enum stone s = board_at(b, c);
+		if (s == S_OFFBOARD)
+			continue;
+
+		if (s == S_NONE) {
+			if (owner[c] != S_NONE)
+				continue;
+			/* Dame: must touch both colors. */
+			if (!neighbor_count_at(b, c, S_BLACK) || !neighbor_count_at(b, c, S_WHITE))
+				return false;
+			continue;
+		}
+
+		group_t g = group_at(b, c);
+		if (g != c)  /* foreach_group, effectively */
+			continue;
+		if (owner[c] == s)
+			continue;
+		if (owner[c] == stone_other(s)) {
+			mq_add(dead, g, 0);
+			continue;
+		}
+		if (!group_in_simple_seki(b, g, owner))
+			return false;
+	} foreach_point_end;
+
+	return true;
+}
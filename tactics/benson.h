@@ -0,0 +1,30 @@
+#ifndef PACHI_TACTICS_BENSON_H
+#define PACHI_TACTICS_BENSON_H
+
+/* Static life and death: Benson's unconditional life and simple seki.
+ * Exact but only covers settled shapes; everything it doesn't prove is
+ * left to playouts. */
+
+struct move_queue;
+
+/* Benson's algorithm for @color: mark in @owner[] the stones of @color
+ * that can't be captured even if @color passes forever, and the regions
+ * they enclose where every empty point touches them (opponent can't make
+ * an eye there, so stones inside are dead). Other entries are left alone. */
+void benson_unconditional(struct board *b, enum stone color, enum stone *owner);
+
+/* benson_unconditional() for both colors, @owner[] is S_NONE for points
+ * not proven. @owner must have board_size2(b) entries. */
+void benson_owner_map(struct board *b, enum stone *owner);
+
+/* Is @g in a simple seki: it shares its only two liberties with an
+ * opponent group, neither side can fill one without self-atari, and all
+ * other groups touching them are unconditionally alive in @owner[] ? */
+bool group_in_simple_seki(struct board *b, group_t g, enum stone *owner);
+
+/* Is the position statically final, i.e. every group unconditionally
+ * alive, dead inside unconditional territory or in simple seki, and every
+ * other empty point dame ? If so, dead groups are stored in @dead. */
+bool benson_final_status(struct board *b, struct move_queue *dead);
+
+#endif /* PACHI_TACTICS_BENSON_H */
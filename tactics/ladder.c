@@ -229,6 +229,50 @@ middle_ladder_walk(struct board *b, group_t laddered, enum stone lcolor,
 
 static __thread int length = 0;
 
+/* Middle ladder reading results are cached per thread: the same ladders
+ * get read over and over (priors, playout policy, patterns). Entries are
+ * keyed by board hash + laddered group, so they go stale by themselves
+ * as the position changes. Direct mapped, collisions just overwrite. */
+#define LADDER_CACHE_BITS 12
+#define LADDER_CACHE_SIZE (1 << LADDER_CACHE_BITS)
+
+struct ladder_cache_entry {
+	hash_t key;
+	int length;
+};
+
+static __thread struct ladder_cache_entry ladder_cache[LADDER_CACHE_SIZE];
+
+static hash_t
+ladder_cache_key(struct board *b, group_t laddered, enum stone lcolor)
+{
+	hash_t key = b->hash ^ (lcolor == S_BLACK ? 0x5bd1e9955bd1e995ULL : 0);
+	key = (key ^ (hash_t)group_base(laddered)) * 0x9e3779b97f4a7c15ULL;
+	/* Ko (and who took it) matters, see middle_ladder_walk(). */
+	if (b->ko.coord != pass)
+		key = (key ^ (hash_t)(b->ko.coord + (b->last_move.coord << 16))) * 0x9e3779b97f4a7c15ULL;
+	return key | 1;  /* 0 is empty */
+}
+
+/* Play out the ladder and return its length, 0 if it doesn't work. */
+static int
+middle_ladder_length(struct board *b, group_t laddered, enum stone lcolor)
+{
+	hash_t key = ladder_cache_key(b, laddered, lcolor);
+	struct ladder_cache_entry *e = &ladder_cache[(key >> 32) & (LADDER_CACHE_SIZE - 1)];
+	if (e->key == key)
+		return e->length;
+
+	/* We could escape by countercapturing a group. */
+	struct move_queue ccq = { .moves = 0 };
+	can_countercapture(b, laddered, &ccq, 0);
+
+	int len = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+	e->key = key;
+	e->length = len;
+	return len;
+}
+
 bool
 is_middle_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lcolor)
 {
@@ -248,12 +292,7 @@ is_middle_ladder(struct board *b, coord_t coord, group_t laddered, enum stone lc
 	/* A fair chance for a ladder. Group in atari, with some but limited
 	 * space to escape. Time for the expensive stuff - play it out and
 	 * start selective 2-liberty search. */
-
-	/* We could escape by countercapturing a group. */
-	struct move_queue ccq = { .moves = 0 };
-	can_countercapture(b, laddered, &ccq, 0);
-
-	length = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+	length = middle_ladder_length(b, laddered, lcolor);
 
 	if (DEBUGL(6) && length) {
 		fprintf(stderr, "is_ladder(): stones: %i  length: %i\n",
@@ -274,11 +313,7 @@ is_middle_ladder_any(struct board *b, coord_t coord, group_t laddered, enum ston
 	if (is_selfatari(b, lcolor, coord))
 		return true;
 	
-	/* We could escape by countercapturing a group. */
-	struct move_queue ccq = { .moves = 0 };
-	can_countercapture(b, laddered, &ccq, 0);
-	
-	length = middle_ladder_walk(b, laddered, lcolor, &ccq, pass, 0);
+	length = middle_ladder_length(b, laddered, lcolor);
 	return (length != 0);
 }
 
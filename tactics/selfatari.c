@@ -678,8 +678,8 @@ init_selfatari_state(struct board *b, enum stone color, coord_t to, struct selfa
 	});	
 }
 
-bool
-is_bad_selfatari_slow(struct board *b, enum stone color, coord_t to, int flags)
+static bool
+bad_selfatari_check(struct board *b, enum stone color, coord_t to, int flags)
 {
 	if (DEBUGL(5))
 		fprintf(stderr, "sar check %s %s\n", stone2str(color), coord2sstr(to, b));
@@ -721,6 +721,45 @@ is_bad_selfatari_slow(struct board *b, enum stone color, coord_t to, int flags)
 }
 
 
+/* Verdict cache: moggy asks about the same (position, move) several
+ * times per playout move (permit, pattern and ko checks, 1lib / 2lib
+ * tactics) and playouts starting from the same tree node go through
+ * the same positions. The verdict depends on the whole position (other
+ * liberties and nakade area can be far from @to), so key on b->hash. */
+
+#define SELFATARI_CACHE_BITS 12
+#define SELFATARI_CACHE_SIZE (1 << SELFATARI_CACHE_BITS)
+
+struct selfatari_cache_entry {
+	hash_t key;
+	bool bad;
+};
+
+static __thread struct selfatari_cache_entry selfatari_cache[SELFATARI_CACHE_SIZE];
+
+static hash_t
+selfatari_cache_key(struct board *b, enum stone color, coord_t to, int flags)
+{
+	hash_t key = b->hash ^ (color == S_BLACK ? 0x5bd1e9955bd1e995ULL : 0);
+	key = (key ^ (hash_t)(to + (flags << 16))) * 0x9e3779b97f4a7c15ULL;
+	return key | 1;  /* 0 is empty */
+}
+
+bool
+is_bad_selfatari_slow(struct board *b, enum stone color, coord_t to, int flags)
+{
+	hash_t key = selfatari_cache_key(b, color, to, flags);
+	struct selfatari_cache_entry *e = &selfatari_cache[(key >> 32) & (SELFATARI_CACHE_SIZE - 1)];
+	if (e->key == key)
+		return e->bad;
+
+	bool bad = bad_selfatari_check(b, color, to, flags);
+	e->key = key;
+	e->bad = bad;
+	return bad;
+}
+
+
 coord_t
 selfatari_cousin(struct board *b, enum stone color, coord_t coord, group_t *bygroup)
 {
@@ -0,0 +1,175 @@
+#!/bin/sh
+# distributed_bench: measure the distributed engine on a single host.
+#
+# Runs a master and N slaves connected through 127.0.0.1, with fixed
+# seeds and a fixed number of playouts per move, lets the master play
+# a few moves and reports for each move the playouts/s, the stats
+# nodes/s and KB/s exchanged with the slaves and the master cpu per
+# genmoves cycle. Use the master options sim_latency and sim_bandwidth
+# to simulate a real network, for example:
+#
+#	tools/distributed_bench.sh -n 8 -m sim_latency=1,sim_bandwidth=100 -o ref
+#	tools/distributed_bench.sh -n 8 -m shared_nodes=2048 -r ref
+#
+# The slaves run with threads=1 and fixed seeds, but the order in which
+# their replies reach the master still varies, and with it the moves.
+# The whole run is therefore repeated (-R, default 3): the averages are
+# given with their min-max over the repeats, and the moves differing
+# between repeats give the noise level. With -o the moves of all
+# repeats are saved to a file, with -r they are compared to those of a
+# previous run and reported as different only if they differ more than
+# the repeats of either run among themselves.
+#
+# Shared memory is disabled (shm=0) so that KB/s counts the binary
+# stats too; pass -m shm=1 to measure with it (KB/s is then the text
+# part only). A move for which the slaves already had at least the
+# requested playouts in the tree reused from the previous move ends at
+# once; such moves are listed separately and left out of the averages.
+#
+# Usage: distributed_bench.sh [-n SLAVES] [-g GAMES] [-k MOVES] [-b SIZE]
+#	[-R REPEATS] [-m MASTER_OPTS] [-s SLAVE_OPTS] [-o MOVES_FILE] [-r REF_FILE]
+
+slaves=4
+games=20000
+moves=6
+size=9
+repeats=3
+mopts=
+sopts=
+out=
+ref=
+while getopts n:g:k:b:R:m:s:o:r: opt; do
+	case $opt in
+		n) slaves=$OPTARG;;
+		g) games=$OPTARG;;
+		k) moves=$OPTARG;;
+		b) size=$OPTARG;;
+		R) repeats=$OPTARG;;
+		m) mopts=",$OPTARG";;
+		s) sopts=",$OPTARG";;
+		o) out=$OPTARG;;
+		r) ref=$OPTARG;;
+		*) sed -n '/^# Usage/,/^$/s/^# \{0,1\}//p' "$0"; exit 1;;
+	esac
+done
+
+pachi=${PACHI:-./pachi}
+tmp=${TMPDIR:-/tmp}/distributed_bench.$$
+mkdir -p $tmp || exit 1
+trap 'kill $pids 2>/dev/null; rm -rf $tmp' EXIT
+
+gtp()
+{
+	# Let the slaves connect first.
+	sleep 1
+	printf "boardsize $size\nclear_board\nkomi 7.5\n"
+	color=b
+	i=0
+	while [ $i -lt $moves ]; do
+		echo "genmove $color"
+		[ $color = b ] && color=w || color=b
+		i=$((i+1))
+	done
+	echo quit
+}
+
+# Count moves differing between lines @1 and @2 of moves files.
+moves_diff()
+{
+	echo "$1
+$2" | awk 'NR == 1 { n = split($0, a) } NR == 2 { for (i = 1; i <= n; i++) d += a[i] != $i; print d + 0 }'
+}
+
+# Print "min max" of the moves differing between the lines of
+# files @1 and @2, comparing distinct lines only if @1 = @2.
+moves_spread()
+{
+	min= max=
+	i=0
+	while read -r l1; do
+		i=$((i+1)) j=0
+		while read -r l2; do
+			j=$((j+1))
+			[ "$1" = "$2" ] && [ $j -le $i ] && continue
+			d=$(moves_diff "$l1" "$l2")
+			[ -z "$min" ] || [ $d -lt $min ] && min=$d
+			[ -z "$max" ] || [ $d -gt $max ] && max=$d
+		done <"$2"
+	done <"$1"
+	echo "${min:-0} ${max:-0}"
+}
+
+r=1
+while [ $r -le $repeats ]; do
+	port=$((20000 + ($$ * 16 + r) % 10000))
+	gtp | $pachi -s 1 -t =$games -d 2 -e distributed slave_port=$port,slaves_quit=1,shm=0$mopts \
+		>$tmp/master.out 2>$tmp/master$r.err &
+	master=$!
+	pids=$master
+	sleep 0.3
+	i=1
+	while [ $i -le $slaves ]; do
+		$pachi -s $((1000 + i)) -t =$games -d 0 -g 127.0.0.1:$port \
+			threads=1,pondering=0,slave$sopts >/dev/null 2>$tmp/slave$i.err &
+		pids="$pids $!"
+		i=$((i+1))
+	done
+	wait $master
+	kill $pids 2>/dev/null
+	sed -n 's/^= \([A-Za-z][0-9]*\|pass\|resign\)$/\1/p' $tmp/master.out | tr '\n' ' ' >>$tmp/moves
+	echo >>$tmp/moves
+	r=$((r+1))
+done
+
+awk -v games=$games '
+function minmax(name, v) {
+	if (!(name in mn) || v < mn[name]) mn[name] = v
+	if (!(name in mx) || v > mx[name]) mx[name] = v
+}
+function run_end() {
+	if (!n) return
+	printf "run %d average: %d games/s, %d nodes/s, %d KB/s, master cpu %.3f ms/iter\n",
+	       run, g / n, nd / n, kb / n, cpu / n
+	minmax("games", g / n); minmax("nodes", nd / n); minmax("kb", kb / n); minmax("cpu", cpu / n)
+	G += g / n; ND += nd / n; KB += kb / n; CPU += cpu / n; runs++
+}
+FNR == 1 { run_end(); run++; move = n = g = nd = kb = cpu = 0 }
+/^genmove [0-9]+ games in/ {
+	for (i = 1; i <= NF; i++) if ($i ~ /^\(/) { gs = substr($i, 2); break }
+	move++
+	# Reused tree: the slaves stopped right away.
+	reused = $2 < games / 2
+	if (reused)
+		printf "run %d move %d: reused tree, %d games in %s, excluded\n", run, move, $2, $5
+	else
+		printf "run %d move %d: %d games/s %d slaves", run, move, gs, $6
+}
+/ stats nodes\/s sent/ {
+	if (reused) { excluded++; next }
+	printf ", nodes/s %d+%d, KB/s %d+%d, master cpu %s ms/iter\n", $6, $8, $11, $13, $16
+	n++; g += gs; nd += $6 + $8; kb += $11 + $13; cpu += $16
+}
+END {
+	run_end()
+	if (!runs) { print "no moves played"; exit 1 }
+	printf "average of %d runs: %d games/s (%d-%d), %d nodes/s (%d-%d), %d KB/s (%d-%d),",
+	       runs, G / runs, mn["games"], mx["games"], ND / runs, mn["nodes"], mx["nodes"],
+	       KB / runs, mn["kb"], mx["kb"]
+	printf " master cpu %.3f ms/iter (%.3f-%.3f)\n", CPU / runs, mn["cpu"], mx["cpu"]
+	if (excluded) printf "%d moves with reused tree excluded\n", excluded
+}' $(i=1; while [ $i -le $repeats ]; do echo $tmp/master$i.err; i=$((i+1)); done)
+
+cat -n $tmp/moves | sed 's/^ *\([0-9]*\)\t/moves run \1: /'
+nmoves=$(head -1 $tmp/moves | wc -w)
+set -- $(moves_spread $tmp/moves $tmp/moves)
+echo "moves differing between runs: $1-$2/$nmoves"
+noise=$2
+
+[ -n "$out" ] && cp $tmp/moves "$out"
+if [ -n "$ref" ]; then
+	set -- $(moves_spread "$ref" "$ref")
+	[ $2 -gt $noise ] && noise=$2
+	set -- $(moves_spread $tmp/moves "$ref")
+	[ $1 -gt $noise ] && verdict="different" || verdict="within noise"
+	echo "moves differing from $ref: $1-$2/$nmoves, $verdict (runs differ by up to $noise)"
+fi
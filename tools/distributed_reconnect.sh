@@ -0,0 +1,74 @@
+#!/bin/sh
+# distributed_reconnect: check that a slave taking over the slot of a
+# lost slave does not count its own playouts twice.
+#
+# Runs a master and two slaves on 127.0.0.1 for one move, kills the
+# second slave during the search and connects a new one, which gets
+# the slot of the lost slave. The slaves share the stats of the root
+# children, so at the end of the move all slaves must report about the
+# same playouts for the best move. A slave receiving back its own stats
+# reports more. Exit status is 1 if the playouts of the slaves differ
+# by more than the tolerance.
+#
+# Usage: distributed_reconnect.sh [-g GAMES] [-t TOLERANCE_PERCENT] [-m MASTER_OPTS]
+
+games=60000
+tolerance=10
+mopts=
+while getopts g:t:m: opt; do
+	case $opt in
+		g) games=$OPTARG;;
+		t) tolerance=$OPTARG;;
+		m) mopts=",$OPTARG";;
+		*) sed -n '/^# Usage/,/^$/s/^# \{0,1\}//p' "$0"; exit 1;;
+	esac
+done
+
+pachi=${PACHI:-./pachi}
+port=$((20000 + $$ % 10000))
+tmp=${TMPDIR:-/tmp}/distributed_reconnect.$$
+mkdir -p $tmp || exit 1
+trap 'kill $pids 2>/dev/null; rm -rf $tmp' EXIT
+
+slave()
+{
+	$pachi -s $1 -t =$((2 * games)) -d 3 -g 127.0.0.1:$port \
+		threads=1,pondering=0,slave >/dev/null 2>$tmp/slave$1.err &
+	pids="$pids $!"
+}
+
+(sleep 1; printf "boardsize 9\nclear_board\nkomi 7.5\ngenmove b\nquit\n") |
+	$pachi -s 1 -t =$games -d 2 -e distributed slave_port=$port,slaves_quit=1$mopts \
+	>$tmp/master.out 2>$tmp/master.err &
+master=$!
+pids=$master
+sleep 0.3
+slave 1
+slave 2
+lost=$!
+sleep 3
+kill $lost
+sleep 0.5
+slave 3
+wait $master
+
+# Playouts of the best move in the last reply of a slave, from
+# "*** WINNER is E5 (5,5) with score 0.5053 (1997/1745:1745/1745 games)"
+best_playouts()
+{
+	sed -n 's/^\*\*\* WINNER is .* (\([0-9]*\)\/.*/\1/p' $tmp/slave$1.err | tail -1
+}
+
+p1=$(best_playouts 1)
+p3=$(best_playouts 3)
+echo "best move playouts: slave $p1, new slave $p3"
+if [ -z "$p1" ] || [ -z "$p3" ]; then
+	echo "FAILED: missing replies"
+	exit 1
+fi
+awk -v a=$p1 -v b=$p3 -v t=$tolerance 'BEGIN {
+	d = (a > b ? a - b : b - a) * 100 / (a < b ? a : b)
+	printf "difference %.1f%%\n", d
+	if (d > t) { print "FAILED"; exit 1 }
+	print "OK"
+}'
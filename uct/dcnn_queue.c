@@ -0,0 +1,207 @@
+#ifdef DCNN
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEBUG
+#include "board.h"
+#include "debug.h"
+#include "dcnn.h"
+#include "timeinfo.h"
+#include "uct/dcnn_queue.h"
+#include "uct/internal.h"
+#include "uct/prior.h"
+#include "uct/tree.h"
+
+/* How long the inference thread waits for a batch to fill up [s]. */
+#define DCNN_BATCH_WAIT 0.002
+
+struct dcnn_request {
+	hash_t key;
+	struct tree *t;
+	struct tree_node *node;
+	int parity;
+};
+
+struct dcnn_queue {
+	struct uct *u;
+	int batch;
+
+	/* Ring buffer of pending requests, input planes are kept
+	 * alongside in data[]. */
+	int size, head, count;
+	struct dcnn_request *req;
+	float *data;
+
+	bool busy;  /* Inference thread is evaluating a batch. */
+	bool quit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;  /* New request or quit. */
+	pthread_cond_t idle;  /* Batch done. */
+	pthread_t thread;
+
+	/* Statistics, reset by dcnn_queue_flush(). */
+	int evaluated, batches, dropped;
+};
+
+
+static void
+dcnn_queue_run_batch(struct dcnn_queue *q, struct dcnn_request *req, float *data, float *result, int n)
+{
+	dcnn_get_moves_batch(data, result, n);
+	for (int i = 0; i < n; i++) {
+		dcnn_cache_put(req[i].key, &result[i * 19 * 19]);
+		uct_prior_dcnn_children(q->u, req[i].t, req[i].node, &result[i * 19 * 19], req[i].parity);
+	}
+}
+
+static void *
+dcnn_queue_thread(void *q_)
+{
+	struct dcnn_queue *q = q_;
+	struct dcnn_request *req = malloc2(q->batch * sizeof(*req));
+	float *data = malloc2(q->batch * DCNN_DATA_SIZE * sizeof(float));
+	float *result = malloc2(q->batch * 19 * 19 * sizeof(float));
+
+	pthread_mutex_lock(&q->lock);
+	while (!q->quit) {
+		if (!q->count) {
+			pthread_cond_wait(&q->cond, &q->lock);
+			continue;
+		}
+
+		/* Give the workers a chance to fill the batch. */
+		if (q->count < q->batch) {
+			struct timespec ts;
+			double sec;
+			double time_limit = time_now() + DCNN_BATCH_WAIT;
+			ts.tv_nsec = (int)(modf(time_limit, &sec)*1000000000.0);
+			ts.tv_sec = (int)sec;
+			pthread_cond_timedwait(&q->cond, &q->lock, &ts);
+			if (q->quit || !q->count)
+				continue;
+		}
+
+		int n = (q->count < q->batch ? q->count : q->batch);
+		for (int i = 0; i < n; i++) {
+			int j = (q->head + i) % q->size;
+			req[i] = q->req[j];
+			memcpy(&data[i * DCNN_DATA_SIZE], &q->data[j * DCNN_DATA_SIZE], DCNN_DATA_SIZE * sizeof(float));
+		}
+		q->head = (q->head + n) % q->size;
+		q->count -= n;
+		q->busy = true;
+		pthread_mutex_unlock(&q->lock);
+
+		dcnn_queue_run_batch(q, req, data, result, n);
+
+		pthread_mutex_lock(&q->lock);
+		q->evaluated += n;
+		q->batches++;
+		q->busy = false;
+		pthread_cond_broadcast(&q->idle);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	free(req); free(data); free(result);
+	return NULL;
+}
+
+struct dcnn_queue *
+dcnn_queue_init(struct uct *u, int batch)
+{
+	struct dcnn_queue *q = calloc2(1, sizeof(*q));
+	q->u = u;
+	q->batch = batch;
+	/* Leave room for a few batches while one is being evaluated. */
+	q->size = 4 * batch;
+	q->req = calloc2(q->size, sizeof(*q->req));
+	q->data = malloc2(q->size * DCNN_DATA_SIZE * sizeof(float));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	pthread_cond_init(&q->idle, NULL);
+	pthread_create(&q->thread, NULL, dcnn_queue_thread, q);
+	return q;
+}
+
+void
+dcnn_queue_done(struct dcnn_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->quit = true;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+	pthread_cond_destroy(&q->idle);
+	free(q->req);
+	free(q->data);
+	free(q);
+}
+
+void
+dcnn_queue_submit(struct dcnn_queue *q, struct tree *t, struct tree_node *node,
+		  struct board *b, enum stone color, int parity)
+{
+	/* Seen this one already ? */
+	hash_t key = dcnn_cache_key(b, color);
+	float r[19 * 19];
+	if (dcnn_cache_get(key, r)) {
+		uct_prior_dcnn_children(q->u, t, node, r, tree_parity(t, parity));
+		return;
+	}
+
+	/* Prepare input outside of the lock. */
+	float data[DCNN_DATA_SIZE];
+	dcnn_board_planes(b, color, data);
+
+	pthread_mutex_lock(&q->lock);
+	if (q->count == q->size) {
+		/* The network can't keep up, the node will just
+		 * have to do with the regular priors for now. Let it
+		 * try again later, or when it becomes the root. */
+		q->dropped++;
+		pthread_mutex_unlock(&q->lock);
+		__sync_fetch_and_and(&node->hints, ~TREE_HINT_DCNN);
+		return;
+	}
+	int j = (q->head + q->count) % q->size;
+	q->req[j] = (struct dcnn_request) { .key = key, .t = t, .node = node, .parity = tree_parity(t, parity) };
+	memcpy(&q->data[j * DCNN_DATA_SIZE], data, sizeof(data));
+	q->count++;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+dcnn_queue_flush(struct dcnn_queue *q)
+{
+	struct uct *u = q->u;
+	pthread_mutex_lock(&q->lock);
+	/* The discarded nodes did not get their priors. */
+	for (int i = 0; i < q->count; i++) {
+		struct tree_node *node = q->req[(q->head + i) % q->size].node;
+		__sync_fetch_and_and(&node->hints, ~TREE_HINT_DCNN);
+	}
+	q->dropped += q->count;
+	q->count = 0;
+	while (q->busy)
+		pthread_cond_wait(&q->idle, &q->lock);
+
+	if (UDEBUGL(2) && (q->evaluated || q->dropped))
+		fprintf(stderr, "dcnn queue: %d nodes in %d batches (avg %.1f), %d dropped\n",
+			q->evaluated, q->batches,
+			q->batches ? (float)q->evaluated / q->batches : 0.,
+			q->dropped);
+	q->evaluated = q->batches = q->dropped = 0;
+	pthread_mutex_unlock(&q->lock);
+}
+
+#endif /* DCNN */
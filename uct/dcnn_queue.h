@@ -0,0 +1,45 @@
+#ifndef PACHI_UCT_DCNN_QUEUE_H
+#define PACHI_UCT_DCNN_QUEUE_H
+
+/* Asynchronous dcnn evaluation of non-root tree nodes. */
+
+/* A synchronous network call per expansion would stall the workers,
+ * so normally only the root gets dcnn priors. With the queue, a worker
+ * walking through an expanded node with enough playouts submits the
+ * position and keeps descending; the node children meanwhile live with
+ * the regular priors. A dedicated inference thread evaluates up to
+ * @batch queued positions in one forward pass and merges the dcnn priors
+ * into the children when the results arrive. */
+
+struct board;
+struct tree;
+struct tree_node;
+struct uct;
+struct dcnn_queue;
+
+#ifdef DCNN
+
+struct dcnn_queue *dcnn_queue_init(struct uct *u, int batch);
+void dcnn_queue_done(struct dcnn_queue *q);
+
+/* Queue position @b at expanded @node, @color to play. @parity is the
+ * one tree_expand_node() got. If the queue is full the request is
+ * dropped. Thread safe. */
+void dcnn_queue_submit(struct dcnn_queue *q, struct tree *t, struct tree_node *node,
+		       struct board *b, enum stone color, int parity);
+
+/* Drop pending requests and wait for the running batch to complete.
+ * Must be called once the workers are stopped, before tree nodes
+ * may be freed. */
+void dcnn_queue_flush(struct dcnn_queue *q);
+
+#else
+
+#define dcnn_queue_init(u, batch)  NULL
+#define dcnn_queue_done(q)  do { } while(0)
+#define dcnn_queue_submit(q, t, node, b, color, parity)  do { } while(0)
+#define dcnn_queue_flush(q)  do { } while(0)
+
+#endif
+
+#endif
@@ -19,6 +19,7 @@ struct uct_policy;
 struct uct_prior;
 struct uct_dynkomi;
 struct uct_pluginset;
+struct dcnn_queue;
 struct joseki_dict;
 
 /* How many games to consider at minimum before judging groups. */
@@ -53,6 +54,8 @@ struct uct {
 	size_t max_pruned_size;
 	size_t pruning_threshold;
 	int mercymin;
+	int playout_settle;
+	bool playout_freeze;
 	int significant_threshold;//有效阈值
 
 	int threads;
@@ -66,6 +69,10 @@ struct uct {
 	bool slave; /* Act as slave in distributed engine.在分布式引擎中充当从机 */
 	int max_slaves; /* Optional, -1 if not set 可选，如果未设置-1*/
 	int slave_index; /* 0..max_slaves-1, or -1 if not set 0..max_slaves-1或-1（如果未设置）*/
+	/* Part [share_start, share_end) of the children favored by this
+	 * slave, from slave_index or given by the master at each genmoves.
+	 * The full range [0,1) if not set: no child is favored. */
+	floating_t share_start, share_end;
 	enum stone my_color;
 
 	int fuseki_end;
@@ -119,14 +126,22 @@ struct uct {
 要加载的数据库。*/
 	bool want_pat;
 
+	int dcnn_batch; /* Async dcnn batch size, 0 if off */
+	int dcnn_expand_p; /* Playouts before a node is queued for dcnn */
+	struct dcnn_queue *dcnn_queue;
+
 	/* Used within frame of single genmove. */
     /*在单个genmove的框架内使用*/
 	struct board_ownermap ownermap;
+	/* Unconditionally settled points (see playout_setup.frozen),
+	 * if playout_freeze is set. */
+	enum stone frozen[BOARD_MAX_COORDS];
 	/* Used for coordination among slaves of the distributed engine. */
     /*用于分布式引擎的从机之间的协调*/
 	int stats_hbits;
 	int shared_nodes;
 	int shared_levels;
+	int dirty_levels; /* shared_levels capped for the node keys, set at search start */
 	double stats_delay; /* stored in seconds 以秒为单位存储*/
 	int played_own;
 	int played_all; /* games played by all slaves 所有奴隶玩的游戏*/
@@ -201,7 +201,7 @@ ucb1rave_descend(struct uct_policy *p, struct tree *tree, struct uct_descent *de
 		nconf = sqrt(log(descent->node->u.playouts + descent->node->prior.playouts));
 	struct uct *u = p->uct;
 	int vwin = 0;
-	if (u->max_slaves > 0 && u->slave_index >= 0)
+	if (u->share_end > u->share_start && (u->share_start > 0 || u->share_end < 1))
 		vwin = descent->node == tree->root ? b->root_virtual_win : b->virtual_win;
 	int child = 0;
 
@@ -211,9 +211,16 @@ ucb1rave_descend(struct uct_policy *p, struct tree *tree, struct uct_descent *de
 
 		/* In distributed mode, encourage different slaves to work on different
 		 * parts of the tree. We rely on the fact that children (if they exist)
-		 * are the same and in the same order in all slaves. */
-		if (vwin > 0 && ni->u.playouts > b->vwin_min_playouts && (child - u->slave_index) % u->max_slaves == 0)
-			urgency += vwin / (ni->u.playouts + vwin);
+		 * are the same and in the same order in all slaves. The golden ratio
+		 * spreads the children evenly over [0,1) so each slave gets a part
+		 * of the children in proportion to its share. */
+		if (vwin > 0 && ni->u.playouts > b->vwin_min_playouts) {
+			floating_t pos = child * 0.6180339887;
+			pos -= (int)pos;
+			if (pos >= u->share_start && pos < u->share_end)
+				urgency += vwin / (ni->u.playouts + vwin);
+		}
+		child++;
 
 		if (ni->u.playouts > 0 && b->explore_p > 0) {
 			urgency += b->explore_p * nconf / fast_sqrt(ni->u.playouts);
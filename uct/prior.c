@@ -9,6 +9,7 @@
 #include "debug.h"
 #include "engines/josekibase.h"
 #include "move.h"
+#include "poscache.h"
 #include "random.h"
 #include "tactics/ladder.h"
 #include "tactics/util.h"
@@ -17,6 +18,7 @@
 #include "uct/prior.h"
 #include "uct/tree.h"
 #include "dcnn.h"
+#include "uct/dcnn_queue.h"
 
 /* Applying heuristic values to the tree nodes, skewing the reading in
  * most interesting directions. */
@@ -33,6 +35,10 @@ struct uct_prior {
 	int dcnn_eqex;
 	int cfgdn; int *cfgd_eqex;
 	bool prune_ladders;
+
+	/* Pattern probabilities of recently seen positions. */
+	int pattern_cache_size;
+	struct poscache *pattern_cache;
 };
 
 void
@@ -94,6 +100,49 @@ uct_prior_dcnn(struct uct *u, struct tree_node *node, struct prior_map *map)
 	} foreach_free_point_end;
 }
 
+void
+uct_prior_dcnn_children(struct uct *u, struct tree *t, struct tree_node *node, float r[], int parity)
+{
+	if (!u->prior->dcnn_eqex)
+		return;
+
+	/* Like uct_prior_dcnn() but for an already expanded node.
+	 * Descents may read the priors meanwhile; seeing playouts
+	 * and value updated separately is harmless. */
+	for (struct tree_node *ni = node->children; ni; ni = ni->sibling) {
+		coord_t c = node_coord(ni);
+		if (is_pass(c))
+			continue;
+
+		float val = r[coord2dcnn_idx(c, t->board)];
+		if (isnan(val) || val < 0.001)
+			continue;
+		assert(val >= 0.0 && val <= 1.0);
+		struct move_stats s = { .playouts = sqrt(val) * u->prior->dcnn_eqex,
+					.value = parity > 0 ? 1 : 0 };
+		stats_merge(&ni->prior, &s);
+	}
+}
+
+void
+uct_prior_dcnn_root(struct uct *u, struct tree *t, struct board *b, enum stone color)
+{
+	struct tree_node *root = t->root;
+	if (!u->prior->dcnn_eqex || (root->hints & TREE_HINT_DCNN))
+		return;
+	root->hints |= TREE_HINT_DCNN;
+
+	if (u->dcnn_queue) {
+		/* Evaluated in the background while the search goes on. */
+		dcnn_queue_submit(u->dcnn_queue, t, root, b, color, 1);
+		return;
+	}
+
+	float r[19 * 19];
+	dcnn_get_moves(b, color, r);
+	uct_prior_dcnn_children(u, t, root, r, tree_parity(t, 1));
+}
+
 #else
 #define uct_prior_dcnn(u, node, map)  
 #endif /* DCNN */
@@ -185,24 +234,44 @@ uct_prior_pattern(struct uct *u, struct tree_node *node, struct prior_map *map)
 		return;
 
 	struct board *b = map->b;
-	struct pattern pats[b->flen];
-	floating_t probs[b->flen];
-	pattern_rate_moves(&u->pat, b, map->to_play, pats, probs);
-	if (UDEBUGL(5)) {
-		fprintf(stderr, "Pattern prior at node %s\n", coord2sstr(node->coord, b));
-		board_print(b, stderr);
-	}
-
-	for (int f = 0; f < b->flen; f++) {
-		if (isnan(probs[f]) || probs[f] < 0.001)
-			continue;
-		assert(!is_pass(b->f[f]));
+	struct poscache *pc = u->prior->pattern_cache;
+	/* Pattern features look at the last two moves. */
+	hash_t key = (pc ? poscache_key(b, map->to_play, 2) : 0);
+	float probs[board_size2(b)];
+
+	if (!pc || !poscache_get(pc, key, probs)) {
+		struct pattern pats[b->flen];
+		floating_t fprobs[b->flen];
+		pattern_rate_moves(&u->pat, b, map->to_play, pats, fprobs);
 		if (UDEBUGL(5)) {
-			char s[256]; pattern2str(s, &pats[f]);
-			fprintf(stderr, "\t%s: %.3f %s\n", coord2sstr(b->f[f], b), probs[f], s);
+			fprintf(stderr, "Pattern prior at node %s\n", coord2sstr(node->coord, b));
+			board_print(b, stderr);
+		}
+
+		foreach_point(b) { probs[c] = NAN; } foreach_point_end;
+		for (int f = 0; f < b->flen; f++) {
+			probs[b->f[f]] = fprobs[f];
+			if (UDEBUGL(5) && !isnan(fprobs[f]) && fprobs[f] >= 0.001) {
+				char s[256]; pattern2str(s, &pats[f]);
+				fprintf(stderr, "\t%s: %.3f %s\n", coord2sstr(b->f[f], b), fprobs[f], s);
+			}
 		}
-		add_prior_value(map, b->f[f], 1.0, sqrt(probs[f]) * u->prior->pattern_eqex);
+		if (pc)
+			poscache_put(pc, key, probs);
 	}
+
+	foreach_free_point(b) {
+		if (isnan(probs[c]) || probs[c] < 0.001)
+			continue;
+		add_prior_value(map, c, 1.0, sqrt(probs[c]) * u->prior->pattern_eqex);
+	} foreach_free_point_end;
+}
+
+void
+uct_prior_print_cache_stats(struct uct_prior *p)
+{
+	if (p->pattern_cache)
+		poscache_print_stats(p->pattern_cache, "pattern prior");
 }
 
 void
@@ -239,9 +308,10 @@ uct_prior(struct uct *u, struct tree_node *node, struct prior_map *map)
 	if (u->prior->b19_eqex)
 		uct_prior_b19(u, node, map);
 	
-	if (!node->parent)  // Use dcnn for root priors
-		if (u->prior->dcnn_eqex)
-			uct_prior_dcnn(u, node, map);
+	if (!node->parent && u->prior->dcnn_eqex) {  // Use dcnn for root priors
+		uct_prior_dcnn(u, node, map);
+		node->hints |= TREE_HINT_DCNN;
+	}
 	
 	if (u->prior->policy_eqex)
 		uct_prior_playout(u, node, map);
@@ -276,6 +346,7 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 	p->eqex = board_large(b) ? 20 : 14;
 
 	p->prune_ladders = true;
+	p->pattern_cache_size = 8192;
 
 	if (arg) {
 		char *optspec, *next = arg;
@@ -332,6 +403,11 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 			} else if (!strcasecmp(optname, "plugin") && optval) {
 				/* Unlike others, this is just a *recommendation*. */
 				p->plugin_eqex = atoi(optval);
+			} else if (!strcasecmp(optname, "pattern_cache") && optval) {
+				/* Number of positions whose pattern
+				 * probabilities are remembered, 0 to
+				 * disable. */
+				p->pattern_cache_size = atoi(optval);
 			} else if (!strcasecmp(optname, "prune_ladders")) {
 				p->prune_ladders = !optval || atoi(optval);
 #ifdef DCNN
@@ -368,6 +444,8 @@ uct_prior_init(char *arg, struct board *b, struct uct *u)
 
 	if (p->pattern_eqex)
 		u->want_pat = true;
+	if (p->pattern_eqex && p->pattern_cache_size > 0)
+		p->pattern_cache = poscache_init(p->pattern_cache_size, board_size2(b));
 
 	return p;
 }
@@ -377,5 +455,7 @@ uct_prior_done(struct uct_prior *p)
 {
 	assert(p->cfgd_eqex);
 	free(p->cfgd_eqex);
+	if (p->pattern_cache)
+		poscache_done(p->pattern_cache);
 	free(p);
 }
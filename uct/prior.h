@@ -31,10 +31,22 @@ struct prior_map {
 static void add_prior_value(struct prior_map *map, coord_t c, floating_t value, int playouts);
 
 void uct_prior(struct uct *u, struct tree_node *node, struct prior_map *map);
+#ifdef DCNN
+/* Merge dcnn result @r for @node position into its children priors
+ * (@parity is the tree parity of the children). */
+void uct_prior_dcnn_children(struct uct *u, struct tree *t, struct tree_node *node, float r[], int parity);
+/* Add dcnn priors to an already expanded root which doesn't have them
+ * (subtree promoted after a move, tree reused from pondering).
+ * @b is the root position, @color to play. */
+void uct_prior_dcnn_root(struct uct *u, struct tree *t, struct board *b, enum stone color);
+#else
+#define uct_prior_dcnn_root(u, t, b, color)  do { } while(0)
+#endif
 
 struct uct_prior;
 struct uct_prior *uct_prior_init(char *arg, struct board *b, struct uct *u);
 void uct_prior_done(struct uct_prior *p);
+void uct_prior_print_cache_stats(struct uct_prior *p);
 
 
 static inline void
@@ -15,8 +15,10 @@
 #include "move.h"
 #include "random.h"
 #include "timeinfo.h"
+#include "uct/dcnn_queue.h"
 #include "uct/dynkomi.h"
 #include "uct/internal.h"
+#include "uct/prior.h"
 #include "uct/search.h"
 #include "uct/tree.h"
 #include "uct/uct.h"
@@ -149,6 +151,8 @@ spawn_thread_manager(void *ctx_)
 		
 		if (tree_leaf_node(n) && !__sync_lock_test_and_set(&n->is_expanded, 1))
 			tree_expand_node(t, n, mctx->b, player_color, u, 1);
+		else if (!tree_leaf_node(n))
+			uct_prior_dcnn_root(u, t, mctx->b, player_color);
 	}
 	
 	/* Spawn threads... 开启线程*/
@@ -157,7 +161,7 @@ spawn_thread_manager(void *ctx_)
 		struct uct_thread_ctx *ctx = malloc2(sizeof(*ctx));
 		ctx->u = u; ctx->b = mctx->b; ctx->color = mctx->color;
 		mctx->t = ctx->t = t;
-		ctx->tid = ti; ctx->seed = fast_random(65536) + ti;
+		ctx->tid = ti; ctx->seed = fast_random64();
 		ctx->ti = mctx->ti;
 		pthread_attr_t a;
 		pthread_attr_init(&a);
@@ -199,6 +203,11 @@ spawn_thread_manager(void *ctx_)
 		pthread_mutex_unlock(&finish_serializer);//解锁串行结束锁
 	}
 
+	/* Pending dcnn requests point into the tree, which may change
+	 * once we return. */
+	if (u->dcnn_queue)
+		dcnn_queue_flush(u->dcnn_queue);
+
     //注意所有进程结束之后，ｍｉｕｔｅｓ锁还是被锁着呢 在pthread_cond_wait 中被锁着
 	pthread_mutex_unlock(&finish_mutex);
     //讲结果写入一个结构，进行返回
@@ -249,7 +258,7 @@ uct_search_start(struct uct *u, struct board *b, enum stone color,
 	assert(!thread_manager_running);
 	static struct uct_thread_ctx mctx;
     /*万能初始化方式*/
-	mctx = (struct uct_thread_ctx) { .u = u, .b = b, .color = color, .t = t, .seed = fast_random(65536), .ti = ti };
+	mctx = (struct uct_thread_ctx) { .u = u, .b = b, .color = color, .t = t, .seed = fast_random64(), .ti = ti };
 	s->ctx = &mctx;//将他的地址复制过去
     //获取两个互斥所
     //第一个串行结束锁
@@ -4,15 +4,19 @@
  * master. When receiving stats the hash table gives a pointer to the
  * tree node to update. When sending stats we remember in the tree
  * what was previously sent so that only the incremental part has to
- * be sent.  The incremental part is smaller and can be compressed.
- * The compression is not yet done in this version. */
+ * be sent.  The incremental part is smaller and can be compressed
+ * (see distributed/wire.h for the formats). On the master host the
+ * binary parts go through shared memory instead of the socket (see
+ * distributed/protocol.c). */
 
 /* Similarly the master only sends stats increments.
  * They include only contributions from other slaves. */
 
 /* The keys for the hash table are coordinate paths from
  * a root child to a given node. See distributed/distributed.h
- * for the encoding of a path to a 64 bit integer. */
+ * for the encoding of a path to a 64 bit integer. With hash keys
+ * (see node_keys in distributed.h) the hash table is filled at the
+ * start of each move and when reporting our own stats. */
 
 /* To allow the master to select the best move, slaves also send
  * absolute playout counts for the best top level nodes (children
@@ -31,6 +35,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define MAX_VERBOSE_LOGS 1000
 #define DEBUG
@@ -45,6 +54,7 @@
 #include "uct/search.h"
 #include "uct/slave.h"
 #include "uct/tree.h"
+#include "distributed/wire.h"
 
 
 /* UCT infrastructure for a distributed engine slave. */
@@ -55,6 +65,16 @@ static long parent_not_found = 0;
 static long parent_leaf = 0;
 static long node_not_found = 0;
 
+/* Stats format and node keys negotiated with the master,
+ * kept across engine resets. */
+static enum wire_format wire_format = WIRE_RAW;
+static enum node_keys node_keys = NODE_KEYS_PATH;
+
+/* Shared memory with the master if on the same host: stats from the
+ * master in shm[0..shm_size-1], ours in shm[shm_size..2*shm_size-1]. */
+static char *shm = NULL;
+static int shm_size;
+
 /* Hash table entry mapping path to node. */
 /*哈希表条目映射到节点的路径*/
 struct tree_hash {
@@ -88,16 +108,46 @@ void uct_htable_reset(struct tree *t)
 	if (DEBUG_MODE) h_counts.occupied = 0;
 }
 
+/* Expand @parent, a leaf at @parent_p, so that a slave which just
+ * joined (or a cold tree) can take the stats of the nodes sent by the
+ * master instead of dropping them. b is the board at the root. */
+static void
+expand_path(struct uct *u, struct board *b, struct tree_node *parent, path_t parent_p)
+{
+	coord_t moves[DIST_GAMELEN];
+	int n = 0;
+	for (path_t p = parent_p; p && n < DIST_GAMELEN; p = parent_path(p, b))
+		moves[n++] = leaf_coord(p, b);
+
+	struct board b2;
+	board_copy(&b2, b);
+	enum stone color = stone_other(u->t->root_color);
+	for (int i = n - 1; i >= 0; i--) {
+		struct move m = { .coord = moves[i], .color = color };
+		if (board_play(&b2, &m) < 0) {
+			board_done_noalloc(&b2);
+			return;
+		}
+		color = stone_other(color);
+	}
+	/* Same as the tree walk, the first thread expands the node. */
+	if (tree_leaf_node(parent) && !__sync_lock_test_and_set(&parent->is_expanded, 1))
+		tree_expand_node(u->t, parent, &b2, color, u, n % 2 ? -1 : 1);
+	board_done_noalloc(&b2);
+}
+
 /* Find a node given its coord path from root. Insert it in the
- * hash table if it is not already there.
+ * hash table if it is not already there. With coord paths, expand
+ * the parent if it is still a leaf.
  * Return the tree node, or NULL if the node cannot be found.
  * The tree is modified in background while this function is running.
  * prev is only used to optimize the tree search, given that calls to
  * tree_find_node are made with sorted coordinates (increasing levels
  * and increasing coord within a level). */
 static struct tree_node *
-tree_find_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
+tree_find_node(struct uct *u, struct board *b, struct incr_stats *is, struct tree_node *prev)
 {
+	struct tree *t = u->t;
 	assert(t && t->htable);
 	path_t path = is->coord_path;
 	/* pass and resign must never be inserted in the hash table. */
@@ -111,10 +161,17 @@ tree_find_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
 	if (DEBUGVV(7))
 		fprintf(stderr,
 			"find_node %"PRIpath" %s found %d hash %d playouts %d node %p\n", path,
-			path2sstr(path, t->board), found, hash, is->incr.playouts, hnode->node);
+			node_keys == NODE_KEYS_PATH ? path2sstr(path, t->board) : "",
+			found, hash, is->incr.playouts, hnode->node);
 
 	if (found) return hnode->node;
 
+	/* A hash key can't be decoded, we only know our own nodes. */
+	if (node_keys == NODE_KEYS_HASH) {
+		if (DEBUG_MODE) node_not_found++;
+		return NULL;
+	}
+
 	/* The master sends parents before children so the parent should
 	 * already be in the hash table. */
 	path_t parent_p = parent_path(path, t->board);
@@ -127,6 +184,9 @@ tree_find_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
 		parent = t->root;
 	}
 	struct tree_node *node = NULL;
+	if (parent && tree_leaf_node(parent) && !parent->is_expanded
+	    && t->nodes_size < u->max_tree_size)
+		expand_path(u, b, parent, parent_p);
 	if (parent) {
 		/* Search for the node in parent's children. */
 		coord_t leaf = leaf_coord(path, t->board);
@@ -154,24 +214,20 @@ tree_find_node(struct tree *t, struct incr_stats *is, struct tree_node *prev)
 	return node;
 }
 
-
-/* Read and discard any binary arguments. The number of
- * bytes to be skipped is given by @size in the command. */
+/* Remember the node for a hash key, for stats received later. With
+ * transpositions the first node found gets the stats. */
 static void
-discard_bin_args(char *args)
+tree_hash_insert(struct tree *t, path_t key, struct tree_node *node)
 {
-	char *s = strchr(args, '@');
-	int size = 0;
-	if (s) size = atoi(s+1);
-	while (size) {
-		char buf[64*1024];
-		int len = sizeof(buf);
-		if (len > size) len = size;
-		len = fread(buf, 1, len, stdin);
-		if (len <= 0) break;
-		size -= len;
-	}
+	int hash;
+	bool found;
+	find_hash(hash, t->htable, t->hbits, key, found, h_counts);
+	if (found) return;
+	t->htable[hash].coord_path = key;
+	t->htable[hash].node = node;
+	if (DEBUG_MODE) h_counts.inserts++, h_counts.occupied++;
 }
+
 //通知
 enum parse_code
 uct_notify(struct engine *e, struct board *b, int id, char *cmd, char *args, char **reply)
@@ -200,39 +256,90 @@ uct_notify(struct engine *e, struct board *b, int id, char *cmd, char *args, cha
 		if (!gtp_is_valid(e, cmd) && !is_repeated(cmd)) return P_OK;
 		return P_DONE_ERROR;
 	}
-	return reply_disabled(id) ? P_NOREPLY : P_OK;
+
+#ifndef _WIN32
+	/* Shared memory segment created by the master. */
+	if (!strcasecmp(cmd, "pachi-shm")) {
+		char name[64];
+		int size = 0;
+		*reply = "cannot map shared memory";
+		if (sscanf(args, "%63s %d", name, &size) != 2 || size <= 0)
+			return P_DONE_ERROR;
+		int fd = shm_open(name, O_RDWR, 0);
+		if (fd == -1) return P_DONE_ERROR;
+		void *p = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) return P_DONE_ERROR;
+		shm = p;
+		shm_size = size;
+		wire_format = WIRE_RAW;
+		*reply = "";
+		return P_DONE_OK;
+	}
+#endif
+
+	/* Stats format and node keys proposed by the master
+	 * at connection time. */
+	if (!strcasecmp(cmd, "pachi-wire")) {
+#ifndef _WIN32
+		/* New master connection. */
+		if (shm) munmap(shm, 2 * shm_size);
+		shm = NULL;
+#endif
+		static char buf[16];
+		int f = atoi(args);
+		wire_format = (f < WIRE_RAW) ? WIRE_RAW : (f > WIRE_MAX) ? WIRE_MAX : f;
+		node_keys = strstr(args, "hash") ? NODE_KEYS_HASH : NODE_KEYS_PATH;
+		snprintf(buf, sizeof(buf), "%d%s", wire_format,
+			 node_keys == NODE_KEYS_HASH ? " hash" : "");
+		*reply = buf;
+		return P_DONE_OK;
+	}
+	return (id >= 0 && reply_disabled(id)) ? P_NOREPLY : P_OK;
 }
 
 
 /* Read the move stats sent by the master, as a binary array of
- * incr_stats structs. The stats come sorted by increasing coord path.
- * To simplify the code, we assume that master and slave have the same
- * architecture (store values identically).
+ * incr_stats structs in the negotiated wire format. The stats come
+ * sorted by increasing coord path. With WIRE_RAW we assume that master
+ * and slave have the same architecture (store values identically).
  * Keep this code in sync with distributed/merge.c:output_stats()
  * Return true if ok, false if error. */
 static bool
-receive_stats(struct uct *u, int size)
+receive_stats(struct uct *u, struct board *b, int size)
 {
-	if (size % sizeof(struct incr_stats)) return false;
-	int nodes = size / sizeof(struct incr_stats);
-	if (nodes > (1 << u->stats_hbits)) return false;
+	int max_nodes = 1 << u->stats_hbits;
+	static struct incr_stats *stats = NULL;
+	static void *wire_buf = NULL, *wire_tmp = NULL;
+	if (!stats) {
+		stats = malloc2(max_nodes * sizeof(*stats));
+		wire_buf = malloc2(wire_max_size(max_nodes));
+		wire_tmp = malloc2(wire_tmp_size(max_nodes));
+	}
+	if (size > wire_max_size(max_nodes)) return false;
+	if (shm) {
+		if (size > shm_size) return false;
+		memcpy(wire_buf, shm, size);
+	} else if (fread(wire_buf, 1, size, stdin) != (size_t)size) {
+		return false;
+	}
+	int nodes = wire_decode(wire_format, wire_buf, size, stats, max_nodes, wire_tmp);
+	if (nodes <= 0) return false;
 
 	struct tree *t = u->t;
-	assert(nodes && t->htable);
+	assert(t->htable);
 	struct tree_node *prev = NULL;
 	double start_time = time_now();
 
 	for (int n = 0; n < nodes; n++) {
-		struct incr_stats is;
-		if (fread(&is, sizeof(struct incr_stats), 1, stdin) != 1)
-			return false;
+		struct incr_stats is = stats[n];
 
 		if (UDEBUGL(7))
 			fprintf(stderr, "read %5d/%d %6d %.3f %"PRIpath" %s\n", n, nodes,
 				is.incr.playouts, is.incr.value, is.coord_path,
-				path2sstr(is.coord_path, t->board));
+				node_keys == NODE_KEYS_PATH ? path2sstr(is.coord_path, t->board) : "");
 
-		struct tree_node *node = tree_find_node(t, &is, prev);
+		struct tree_node *node = tree_find_node(u, b, &is, prev);
 		if (!node) continue;
 
 		/* node_total += others_incr */
@@ -249,7 +356,7 @@ receive_stats(struct uct *u, int size)
 	return true;
 }
 
-/* A tree traversal fills this array, then the nodes with most increments are sent. */
+/* The dirty nodes fill this array, then the nodes with most increments are sent. */
 struct stats_candidate {
 	path_t coord_path;
 	int playout_incr;
@@ -264,46 +371,144 @@ struct stats_candidate {
 #define MAX_BUCKETS 1024
 static int bucket_count[MAX_BUCKETS];
 
-/* Traverse the tree rooted at node, and append incremental stats
- * for children to stats_queue. start_path is the coordinate path
- * for the top node. Stats for a node are only appended if enough playouts
- * have been made since the last send, and the level is not too deep.
- * Return the updated stats count. */
-static int
-append_stats(struct stats_candidate *stats_queue, struct tree_node *node, int stats_count,
-	     int max_count, path_t start_path, path_t max_path, int min_increment, struct board *b)
+/* Nodes at shared levels with new stats since the last report. The
+ * playouts append them lock-free (see uct_dirty_add()) to the active
+ * buffer, while the main thread reports from the other one. The top
+ * bit of dirty_state is the active buffer and the low bits count the
+ * appended nodes, so that the main thread taking over a buffer knows
+ * exactly how many nodes to expect. TREE_HINT_DIRTY keeps a node in
+ * at most one buffer. Nodes which do not fit are dropped and come
+ * back at their next playout, their stats are only delayed. */
+#define DIRTY_ACTIVE (1U << 31)
+static struct tree_node **dirty_buf[2];
+static int dirty_max = 0;
+static unsigned int dirty_state = 0;
+
+/* Return false if @node could not be appended. */
+static bool
+dirty_push(struct tree_node *node)
 {
-	/* The children field is set only after all children are created
-	 * so we can traverse the the tree while it is updated. */
-	for (struct tree_node *ni = node->children; ni; ni = ni->sibling) {
+	unsigned int s = __sync_fetch_and_add(&dirty_state, 1);
+	int i = s & ~DIRTY_ACTIVE;
+	if (i >= dirty_max) {
+		__sync_fetch_and_and(&node->hints, ~TREE_HINT_DIRTY);
+		return false;
+	}
+	dirty_buf[s >> 31][i] = node;
+	return true;
+}
 
-		if (is_pass(node_coord(ni))) continue;
-		if (ni->hints & TREE_HINT_INVALID) continue;
+/* Called by the playouts for each shared node they update. Nodes
+ * near the root are nearly always dirty already, check with a plain
+ * read first to keep their cache line shared between threads. */
+void
+uct_dirty_add(struct tree_node *node)
+{
+	if (node->hints & TREE_HINT_DIRTY)
+		return;
+	if (__sync_fetch_and_or(&node->hints, TREE_HINT_DIRTY) & TREE_HINT_DIRTY)
+		return;
+	dirty_push(node);
+}
 
-		int incr = ni->u.playouts - ni->pu.playouts;
-		if (incr < min_increment) continue;
+/* Switch the active buffer and return the previous one, with
+ * the number of nodes in @count. The buffer must be cleared
+ * with dirty_done() before the next switch. */
+static struct tree_node **
+dirty_take(int *count)
+{
+	unsigned int s;
+	do {
+		s = dirty_state;
+	} while (!__sync_bool_compare_and_swap(&dirty_state, s, (s & DIRTY_ACTIVE) ^ DIRTY_ACTIVE));
+
+	struct tree_node *volatile *buf = dirty_buf[s >> 31];
+	int n = s & ~DIRTY_ACTIVE;
+	if (n > dirty_max) n = dirty_max;
+	/* A playout may still be between dirty_push() increment and store. */
+	for (int i = 0; i < n; i++)
+		while (!buf[i]);
+	*count = n;
+	return (struct tree_node **)buf;
+}
 
-		/* min_increment should be tuned to avoid overflow. */
-		if (stats_count >= max_count) {
-			if (DEBUGL(0))
-				fprintf(stderr, "*** stats overflow %d nodes\n", stats_count);
-			return stats_count;
-		}
-		path_t child_path = append_child(start_path, node_coord(ni), b);
-		stats_queue[stats_count].playout_incr = incr;
-		stats_queue[stats_count].coord_path = child_path;
-		stats_queue[stats_count++].node = ni;
+static void
+dirty_done(struct tree_node **buf, int count)
+{
+	memset(buf, 0, count * sizeof(*buf));
+}
 
-		if (incr >= MAX_BUCKETS) incr = MAX_BUCKETS - 1;
-		bucket_count[incr]++;
+/* Forget the dirty nodes once the search is stopped, before
+ * the tree changes. */
+void
+uct_dirty_reset(void)
+{
+	if (!dirty_max) return;
+	int count;
+	struct tree_node **buf = dirty_take(&count);
+	for (int i = 0; i < count; i++)
+		buf[i]->hints &= ~TREE_HINT_DIRTY;
+	dirty_done(buf, count);
+}
+
+/* Compute in @key the coordinate path of @node, or with hash keys
+ * the hash of the moves to it. Return false if the node is not
+ * shared: deeper than @max_level or after a pass or invalid move. */
+static bool
+node_key(struct tree *t, struct tree_node *node, int max_level, path_t *key)
+{
+	struct tree_node *path[max_level];
+	int level = 0;
+	for (struct tree_node *n = node; n != t->root; n = n->parent) {
+		if (!n || level >= max_level) return false;
+		if (is_pass(node_coord(n)) || n->hints & TREE_HINT_INVALID) return false;
+		path[level++] = n;
+	}
+	if (!level) return false;
+
+	*key = 0;
+	hash_t hash = 0;
+	enum stone color = stone_other(t->root_color);
+	for (int i = level - 1; i >= 0; i--, color = stone_other(color)) {
+		if (node_keys == NODE_KEYS_HASH)
+			hash ^= hash_at(t->board, node_coord(path[i]), color);
+		else
+			*key = append_child(*key, node_coord(path[i]), t->board);
+	}
+	if (node_keys == NODE_KEYS_HASH) {
+		*key = hash_key(hash, level);
+		tree_hash_insert(t, *key, node);
+	}
+	return true;
+}
 
-		/* Do not recurse if level deep enough. */
-		if (child_path >= max_path) continue;
+/* At the start of a move the promoted tree may have stats not sent
+ * yet at the shared levels, make these nodes dirty. With hash keys
+ * also enter in the hash table the nodes having playouts, so that
+ * stats from the master for them are not lost before we touch them.
+ * Children of @node are at @level and played by @color, @hash is the
+ * xor of the moves to @node. Called before the search starts. */
+static void
+prepare_shared_nodes(struct tree *t, struct tree_node *node, hash_t hash, int level,
+		     int max_level, enum stone color)
+{
+	for (struct tree_node *ni = node->children; ni; ni = ni->sibling) {
+		if (is_pass(node_coord(ni)) || ni->hints & TREE_HINT_INVALID) continue;
+		if (ni->u.playouts <= 0) continue;
 
-		stats_count = append_stats(stats_queue, ni, stats_count, max_count,
-					   child_path, max_path, min_increment, b);
+		hash_t child_hash = 0;
+		if (node_keys == NODE_KEYS_HASH) {
+			child_hash = hash ^ hash_at(t->board, node_coord(ni), color);
+			tree_hash_insert(t, hash_key(child_hash, level), ni);
+		}
+		if (ni->u.playouts > ni->pu.playouts && !(ni->hints & TREE_HINT_DIRTY)) {
+			ni->hints |= TREE_HINT_DIRTY;
+			dirty_push(ni);
+		}
+		if (level < max_level)
+			prepare_shared_nodes(t, ni, child_hash, level + 1, max_level,
+					     stone_other(color));
 	}
-	return stats_count;
 }
 
 /* Used to sort by coord path the incremental stats to be sent. */
@@ -316,10 +521,12 @@ coord_cmp(const void *p1, const void *p2)
 }
 
 /* Select from stats_queue at most shared_nodes candidates with
- * biggest increments. Return a binary array sorted by coord path. */
+ * biggest increments. Return a binary array sorted by coord path.
+ * The candidates not sent are moved to the start of stats_queue,
+ * their number is returned in @unsent. */
 static struct incr_stats *
 select_best_stats(struct stats_candidate *stats_queue, int stats_count,
-		  int shared_nodes, int *byte_size)
+		  int shared_nodes, int *byte_size, int *unsent)
 {
 	static struct incr_stats *out_stats = NULL;
 	if (!out_stats)
@@ -337,9 +544,13 @@ select_best_stats(struct stats_candidate *stats_queue, int stats_count,
 	int min_count = bucket_count[min_incr] - (out_count - shared_nodes);
 	struct incr_stats *os = out_stats;
 	out_count = 0;
+	*unsent = 0;
 	for (int count = 0; count < stats_count; count++) {
 		int delta = stats_queue[count].playout_incr - min_incr;
-		if (delta < 0 || (delta == 0 && --min_count < 0)) continue;
+		if (delta < 0 || (delta == 0 && --min_count < 0)) {
+			stats_queue[(*unsent)++] = stats_queue[count];
+			continue;
+		}
 
 		struct tree_node *node = stats_queue[count].node;
 		os->incr = node->u;
@@ -357,66 +568,97 @@ select_best_stats(struct stats_candidate *stats_queue, int stats_count,
 			os++;
 			out_count++;
 		}
+		/* The next playout through the node makes it dirty again. */
+		__sync_fetch_and_and(&node->hints, ~TREE_HINT_DIRTY);
 		assert (out_count <= shared_nodes);
 	}
-	*byte_size = (char *)os - (char *)out_stats;
 
 	/* Sort the increments by increasing coord path (required by master).
+	 * Only the selected nodes are sorted, at most shared_nodes.
 	 * Can be done in linear time with radix sort if qsort is too slow. */
 	qsort(out_stats, out_count, sizeof(*os), coord_cmp);
+
+	/* Transpositions have the same hash key, send them as one node. */
+	if (node_keys == NODE_KEYS_HASH && out_count) {
+		int n = 1;
+		for (int i = 1; i < out_count; i++) {
+			if (out_stats[i].coord_path == out_stats[n - 1].coord_path)
+				stats_merge(&out_stats[n - 1].incr, &out_stats[i].incr);
+			else
+				out_stats[n++] = out_stats[i];
+		}
+		out_count = n;
+	}
+	*byte_size = out_count * sizeof(*out_stats);
 	return out_stats;
 }
 
 /* Get incremental stats updates for the distributed engine.
  * Return a binary array of incr_stats structs in coordinate order
  * (increasing levels and increasing coordinates within a level).
+ * The candidates are the dirty nodes, we do not traverse the tree.
  * This function is called only by the main thread, but may be
  * called while the tree is updated by the worker threads. Keep this
- * code in sync with distributed/merge.c:merge_new_stats(). */
+ * code in sync with distributed/merge.c:get_new_stats(). */
 static void *
 report_incr_stats(struct uct *u, int *stats_size)
 {
 	double start_time = time_now();
 
 	struct tree_node *root = u->t->root;
-	struct board *b = u->t->board;
 
-	/* The factor 3 below has experimentally been found to be
-	 * sufficient. At worst if we fill stats_queue we will
-	 * discard some stats updates but this is rare. */
-	int max_nodes = 3 * u->shared_nodes;
 	static struct stats_candidate *stats_queue = NULL;
-	if (!stats_queue) stats_queue = malloc2(max_nodes * sizeof(*stats_queue));
+	if (!stats_queue) stats_queue = malloc2(dirty_max * sizeof(*stats_queue));
 
 	memset(bucket_count, 0, sizeof(bucket_count));
 
-	/* Try to fill the output buffer with the most important
-         * nodes (highest increments), while still traversing
-	 * as little of the tree as possible. If we set min_increment
-	 * too low we waste time. If we set it too high we can't
-	 * fill the output buffer with the desired number of nodes.
-	 * The best min_increment results in stats_count just above 
-	 * shared_nodes. However perfect tuning is not necessary:
-	 * if we send too few nodes we just send shorter buffers
-	 * more frequently. */
-	static int min_increment = 1;
-	static int stats_count = 0;
-	if (stats_count > 2 * u->shared_nodes) {
-		min_increment++;
-	} else if (stats_count < u->shared_nodes / 2 && min_increment > 1) {
-		min_increment--;
+	int max_level = u->dirty_levels;
+
+	int dirty_count;
+	struct tree_node **dirty = dirty_take(&dirty_count);
+	int stats_count = 0;
+	for (int i = 0; i < dirty_count; i++) {
+		struct tree_node *node = dirty[i];
+		int incr = node->u.playouts - node->pu.playouts;
+		path_t key;
+		if (incr <= 0 || !node_key(u->t, node, max_level, &key)) {
+			__sync_fetch_and_and(&node->hints, ~TREE_HINT_DIRTY);
+			continue;
+		}
+		stats_queue[stats_count].playout_incr = incr;
+		stats_queue[stats_count].coord_path = key;
+		stats_queue[stats_count++].node = node;
+
+		if (incr >= MAX_BUCKETS) incr = MAX_BUCKETS - 1;
+		bucket_count[incr]++;
 	}
 
-	stats_count = append_stats(stats_queue, root, 0, max_nodes, 0,
-				   max_parent_path(u, b), min_increment, b);
+	int unsent;
+	void *buf = select_best_stats(stats_queue, stats_count, u->shared_nodes, stats_size, &unsent);
+	int nodes = *stats_size / sizeof(struct incr_stats);
+
+	/* Nodes not sent stay dirty, but leave room for the new ones. */
+	for (int i = 0; i < unsent; i++) {
+		if (i >= u->shared_nodes || !dirty_push(stats_queue[i].node))
+			__sync_fetch_and_and(&stats_queue[i].node->hints, ~TREE_HINT_DIRTY);
+	}
+	dirty_done(dirty, dirty_count);
 
-	void *buf = select_best_stats(stats_queue, stats_count, u->shared_nodes, stats_size);
+	if (wire_format != WIRE_RAW) {
+		static void *wire_buf = NULL, *wire_tmp = NULL;
+		if (!wire_buf) {
+			wire_buf = malloc2(wire_max_size(u->shared_nodes));
+			wire_tmp = malloc2(wire_tmp_size(u->shared_nodes));
+		}
+		*stats_size = wire_encode(wire_format, buf, nodes, wire_buf, wire_tmp);
+		buf = wire_buf;
+	}
 
 	if (DEBUGVV(2))
 		fprintf(stderr,
-			"min_incr %d games %d stats_queue %d/%d sending %d/%d in %.3fms\n",
-			min_increment, root->u.playouts - root->pu.playouts, stats_count,
-			max_nodes, *stats_size / (int)sizeof(struct incr_stats), u->shared_nodes,
+			"games %d dirty %d/%d candidates %d sending %d/%d (%d bytes) in %.3fms\n",
+			root->u.playouts - root->pu.playouts, dirty_count, dirty_max,
+			stats_count, nodes, u->shared_nodes, *stats_size,
 			(time_now() - start_time)*1000);
 	root->pu = root->u;
 	return buf;
@@ -483,7 +725,7 @@ report_stats(struct uct *u, struct board *b, coord_t c,
  * returns. It is stopped by receiving a play GTP command, triggering
  * uct_pondering_stop(). */
 /* genmoves gets in the args parameter
- * "played_games nodes main_time byoyomi_time byoyomi_periods byoyomi_stones @size"
+ * "played_games nodes main_time byoyomi_time byoyomi_periods byoyomi_stones [share=start:end] @size"
  * and reads a binary array of coord, playouts, value to get stats of other slaves,
  * except possibly for the first call at a given move number.
  * See report_stats() for the description of the return value. */
@@ -512,10 +754,43 @@ uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone
 		return NULL;
 	}
 
+	/* Part of the children to favor, in proportion to our speed. */
+	char *share = strstr(args, "share=");
+	double start, end;
+	if (share && sscanf(share + 6, "%lf:%lf", &start, &end) == 2) {
+		u->share_start = start;
+		u->share_end = end;
+	} else if (u->max_slaves > 0) {
+		/* Master stopped balancing, back to our slave_index share. */
+		u->share_start = (floating_t)u->slave_index / u->max_slaves;
+		u->share_end = (floating_t)(u->slave_index + 1) / u->max_slaves;
+	} else {
+		u->share_start = 0;
+		u->share_end = 1;
+	}
+
 	static struct uct_search_state s;
 	if (!thread_manager_running) {
 		/* This is the first genmoves issue, start the MCTS
 		 * now and let it run while we receive stats. */
+		if (u->shared_levels && !dirty_max) {
+			/* The factor 3 has experimentally been found to be
+			 * sufficient. At worst some stats are delayed. */
+			dirty_buf[0] = calloc2(3 * u->shared_nodes, sizeof(*dirty_buf[0]));
+			dirty_buf[1] = calloc2(3 * u->shared_nodes, sizeof(*dirty_buf[1]));
+			__sync_synchronize();
+			dirty_max = 3 * u->shared_nodes;
+		}
+		if (u->shared_levels) {
+			/* Coord paths must fit in a path_t. Deeper nodes
+			 * are not even made dirty, they would only cycle
+			 * through the dirty buffer. */
+			u->dirty_levels = u->shared_levels;
+			if (node_keys == NODE_KEYS_PATH && u->dirty_levels > max_path_levels(b))
+				u->dirty_levels = max_path_levels(b);
+			prepare_shared_nodes(u->t, u->t->root, 0, 1, u->dirty_levels,
+					     stone_other(u->t->root_color));
+		}
 		memset(&s, 0, sizeof(s));
 		uct_search_start(u, b, color, u->t, ti, &s);
 	}
@@ -527,7 +802,7 @@ uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone
 	if (sizep) size = atoi(sizep+1);
 	if (!size) {
 		time_sleep(u->stats_delay);
-	} else if (!receive_stats(u, size)) {
+	} else if (!receive_stats(u, b, size)) {
 		return NULL;
 	}
 
@@ -552,6 +827,13 @@ uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum stone
 			*stats_buf = report_incr_stats(u, stats_size);
 		}
 	}
-	char *reply = report_stats(u, b, best_coord, keep_looking, *stats_size);
+	int bin_size = *stats_size;
+	if (shm && bin_size) {
+		/* The master reads them once it gets the reply. */
+		if (bin_size <= shm_size) memcpy(shm + shm_size, *stats_buf, bin_size);
+		else bin_size = 0;
+		*stats_size = 0;
+	}
+	char *reply = report_stats(u, b, best_coord, keep_looking, bin_size);
 	return reply;
 }
@@ -13,5 +13,7 @@ char *uct_genmoves(struct engine *e, struct board *b, struct time_info *ti, enum
 		   char *args, bool pass_all_alive, void **stats_buf, int *stats_size);
 void *uct_htable_alloc(int hbits);
 void uct_htable_reset(struct tree *t);
+void uct_dirty_add(struct tree_node *node);
+void uct_dirty_reset(void);
 
 #endif
@@ -366,6 +366,7 @@ tree_prune(struct tree *dest, struct tree *src, struct tree_node *node,
 		dest->max_depth = n2->depth;
 	n2->children = NULL;
 	n2->is_expanded = false;
+	n2->hints &= ~TREE_HINT_DCNN;
 
 	if (node->depth >= depth && node->u.playouts < threshold)
 		return n2;
@@ -389,6 +390,7 @@ tree_prune(struct tree *dest, struct tree *src, struct tree_node *node,
 	}
 	if (!ni) {
 		n2->is_expanded = true;
+		n2->hints |= node->hints & TREE_HINT_DCNN;
 	} else {
 		n2->children = NULL; // avoid partially expanded nodes
 	}
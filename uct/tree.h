@@ -114,6 +114,8 @@ struct tree_node {
 	unsigned char d;
 
 #define TREE_HINT_INVALID 1 // don't go to this node, invalid move
+#define TREE_HINT_DCNN    2 // children got (or are getting) dcnn priors
+#define TREE_HINT_DIRTY   4 // in the dirty set of a distributed slave
 	unsigned char hints;
 
 	/* In case multiple threads walk the tree, is_expanded is set
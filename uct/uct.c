@@ -16,7 +16,9 @@
 #include "engines/josekibase.h"
 #include "playout.h"
 #include "playout/moggy.h"
+#include "playout/gamma.h"
 #include "playout/light.h"
+#include "tactics/benson.h"
 #include "tactics/util.h"
 #include "timeinfo.h"
 #include "uct/dynkomi.h"
@@ -29,6 +31,7 @@
 #include "uct/uct.h"
 #include "uct/walk.h"
 #include "dcnn.h"
+#include "uct/dcnn_queue.h"
 
 struct uct_policy *policy_ucb1_init(struct uct *u, char *arg);
 struct uct_policy *policy_ucb1amaf_init(struct uct *u, char *arg, struct board *board);
@@ -92,6 +95,8 @@ uct_prepare_move(struct uct *u, struct board *b, enum stone color)
 	}
 
 	board_ownermap_init(&u->ownermap);
+	if (u->playout_freeze)
+		benson_owner_map(b, u->frozen);
 	u->played_own = u->played_all = 0;
 }
 
@@ -131,22 +136,40 @@ pass_is_safe(struct uct *u, struct board *b, enum stone color, struct move_queue
 	return (score >= 0);
 }
 
+/* Position statically final (see benson_final_status()), dead groups
+ * in @mq: official score decides, no playouts needed. */
+static bool
+pass_is_safe_static(struct uct *u, struct board *b, enum stone color, struct move_queue *mq, char **msg)
+{
+	if (u->allow_losing_pass)
+		return true;
+
+	int dame;
+	floating_t score = board_official_score_and_dame(b, mq, &dame);
+	if (color == S_BLACK)  score = -score;
+	*msg = "losing on official score (static)";
+	return (score >= 0);
+}
+
 bool
 uct_pass_is_safe(struct uct *u, struct board *b, enum stone color, bool pass_all_alive, char **msg)
 {
-	/* Make sure enough playouts are simulated to get a reasonable dead group list. */
-	while (u->ownermap.playouts < GJ_MINGAMES)
-		uct_playout(u, b, color, u->t);
-
 	/* Save dead groups for final_status_list dead. */
 	struct move_queue unclear;
 	struct move_queue *mq = &u->dead_groups;
 	u->dead_groups_move = b->moves;
-	get_dead_groups(u, b, mq, &unclear);
-	
-	/* Unclear groups ? */
-	*msg = "unclear groups";
-	if (unclear.moves)  return false;
+	bool final = benson_final_status(b, mq);
+
+	if (!final) {
+		/* Make sure enough playouts are simulated to get a reasonable dead group list. */
+		while (u->ownermap.playouts < GJ_MINGAMES)
+			uct_playout(u, b, color, u->t);
+		get_dead_groups(u, b, mq, &unclear);
+
+		/* Unclear groups ? */
+		*msg = "unclear groups";
+		if (unclear.moves)  return false;
+	}
 	
 	if (pass_all_alive) {
 		*msg = "need to remove opponent dead groups first";
@@ -155,6 +178,9 @@ uct_pass_is_safe(struct uct *u, struct board *b, enum stone color, bool pass_all
 				return false;
 		mq->moves = 0; // our dead stones are alive when pass_all_alive is true
 	}
+
+	if (final)
+		return pass_is_safe_static(u, b, color, mq, msg);
 	
 	if (u->allow_losing_pass) {
 		*msg = "unclear point, clarify first";
@@ -327,6 +353,12 @@ uct_dead_group_list(struct engine *e, struct board *b, struct move_queue *mq)
 		return;
 	}
 	
+	/* Settled position, no need for playouts. */
+	if (benson_final_status(b, mq)) {
+		print_dead_groups(u, b, mq);
+		return;
+	}
+
 	/* Create mock state */
 	if (u->t)  reset_state(u);
 	// We need S_BLACK here, but don't clobber u->my_color with uct_genmove_setup() !
@@ -373,6 +405,7 @@ uct_done(struct engine *e)
 
 	if (u->policy) u->policy->done(u->policy);
 	if (u->random_policy) u->random_policy->done(u->random_policy);
+	if (u->dcnn_queue) dcnn_queue_done(u->dcnn_queue);
 	playout_policy_done(u->playout);
 	uct_prior_done(u->prior);
 	joseki_done(u->jdict);
@@ -470,7 +503,6 @@ uct_search(struct uct *u, struct board *b, struct time_info *ti, enum stone colo
 static void
 uct_pondering_start(struct uct *u, struct board *b0, struct tree *t, enum stone color)
 {
-	assert(!using_dcnn(b0));
 	if (UDEBUGL(1))
 		fprintf(stderr, "Starting to ponder with color %s\n", stone2str(stone_other(color)));
 	u->pondering = true;
@@ -485,6 +517,8 @@ uct_pondering_start(struct uct *u, struct board *b0, struct tree *t, enum stone
 	int res = board_play(b, &m);
 	assert(res >= 0);
 	setup_dynkomi(u, b, stone_other(m.color));
+	if (u->playout_freeze)
+		benson_owner_map(b, u->frozen);
 
 	/* Start MCTS manager thread "headless". */
     /*启动MCTS管理器线程“headless”。*/
@@ -504,6 +538,7 @@ uct_pondering_stop(struct uct *u)
 	/* Stop the thread manager. */
     //停止线程思考
 	struct uct_thread_ctx *ctx = uct_search_stop();
+	if (u->slave) uct_dirty_reset();
 	if (UDEBUGL(1)) {
 		if (u->pondering) fprintf(stderr, "(pondering) ");
         //写入停止思考时未收集的信息
@@ -578,15 +613,6 @@ genmove(struct engine *e, struct board *b, struct time_info *ti, enum stone colo
 	u->pass_all_alive |= pass_all_alive;
 	uct_pondering_stop(u);//该你思考的时候思考
 
-	if (using_dcnn(b)) {
-		// dcnn hack: reset state to make dcnn priors kick in.
-		// FIXME this makes pondering useless when using dcnn ...
-		if (u->t) {
-			u->initial_extra_komi = u->t->extra_komi;
-			reset_state(u);
-		}
-	}
-
 	uct_genmove_setup(u, b, color);
 
     /* Start the Monte Carlo Tree Search! */
@@ -603,6 +629,8 @@ genmove(struct engine *e, struct board *b, struct time_info *ti, enum stone colo
 		double mcts_time  = total_time - get_dcnn_time();
 		fprintf(stderr, "genmove in %0.2fs (%d games/s, %d games/s/thread)\n",
 			total_time, (int)(played_games/mcts_time), (int)(played_games/mcts_time/u->threads));
+		dcnn_print_cache_stats();
+		uct_prior_print_cache_stats(u->prior);
 	}
     //写入本次模拟的信息
 	uct_progress_status(u, u->t, color, played_games, best_coord);
@@ -788,6 +816,7 @@ uct_state_init(char *arg, struct board *b)
 	u->mercymin = 0;
 	u->significant_threshold = 50;//５０
 	u->expand_p = 8;
+	u->dcnn_expand_p = 200;
 	u->dumpthres = 0.01;
 	u->playout_amaf = true;
 	u->amaf_prior = false;
@@ -823,6 +852,8 @@ uct_state_init(char *arg, struct board *b)
 
 	u->max_slaves = -1;
 	u->slave_index = -1;
+	u->share_start = 0;
+	u->share_end = 1;
 	u->stats_delay = 0.01; // 10 ms
 	u->shared_levels = 1;
 
@@ -992,7 +1023,10 @@ uct_state_init(char *arg, struct board *b)
 				 * moggy is the default policy with large
 				 * amount of domain-specific knowledge and
 				 * heuristics. light is a simple uniformly
-				 * random move selection policy. */
+				 * random move selection policy. gamma picks
+				 * moves from the whole board weighted by
+				 * pattern and tactical features
+				 * (slower than moggy). */
                 /*随机模拟（播放）策略.moggy是默认策略领域特定知识和启发式方法的数量。光是一个简单的统一和移动选择政策。*/
 				char *playoutarg = strchr(optval, ':');
 				if (playoutarg)
@@ -1001,6 +1035,8 @@ uct_state_init(char *arg, struct board *b)
 					u->playout = playout_moggy_init(playoutarg, b, u->jdict);
 				} else if (!strcasecmp(optval, "light")) {
 					u->playout = playout_light_init(playoutarg, b);
+				} else if (!strcasecmp(optval, "gamma")) {
+					u->playout = playout_gamma_init(playoutarg, b);
 				} else
 					die("UCT: Invalid playout policy %s\n", optval);
 			} else if (!strcasecmp(optname, "prior") && optval) {
@@ -1019,6 +1055,21 @@ uct_state_init(char *arg, struct board *b)
 				 * accuracy. */
                 /*黑白截图的最小差异，以阻止播放-“仁慈规则”。以一定的准确性加速无望的决赛。*/
 				u->mercymin = atoi(optval);
+			} else if (!strcasecmp(optname, "playout_settle") && optval) {
+				/* From this move number on, score playouts
+				 * by area as soon as playout_settled() holds
+				 * (empty regions touch one colour only except
+				 * small dame between safe groups, no group
+				 * capturable in its own eye), instead of
+				 * filling territory to the end. Not faster
+				 * in practice. 0 disables (default). */
+				u->playout_settle = atoi(optval);
+			} else if (!strcasecmp(optname, "playout_freeze")) {
+				/* Don't play in (and score directly)
+				 * unconditionally alive groups and the
+				 * territory they enclose (Benson's
+				 * algorithm, computed once per move). */
+				u->playout_freeze = !optval || atoi(optval);
 			} else if (!strcasecmp(optname, "gamelen") && optval) {
 				/* Maximum length of single simulation
 				 * in moves. */
@@ -1029,6 +1080,18 @@ uct_state_init(char *arg, struct board *b)
 				 * visited this many times. */
                 /*在多次访问之后展开UCT节点。*/
 				u->expand_p = atoi(optval);
+#ifdef DCNN
+			} else if (!strcasecmp(optname, "dcnn_batch") && optval) {
+				/* Also get dcnn priors for non-root nodes,
+				 * evaluated asynchronously in batches of
+				 * this many positions. 0 to disable. */
+				u->dcnn_batch = atoi(optval);
+			} else if (!strcasecmp(optname, "dcnn_expand_p") && optval) {
+				/* With dcnn_batch, queue nodes for dcnn
+				 * evaluation once they got this many
+				 * playouts. */
+				u->dcnn_expand_p = atoi(optval);
+#endif
 			} else if (!strcasecmp(optname, "random_policy_chance") && optval) {
 				/* If specified (N), with probability 1/N, random_policy policy
 				 * descend is used instead of main policy descend; useful
@@ -1348,12 +1411,18 @@ uct_state_init(char *arg, struct board *b)
 				u->slave_index = atoi(optval);
 				char *p = strchr(optval, '/');
 				if (p) u->max_slaves = atoi(++p);
+				if (u->max_slaves > 0) {
+					u->share_start = (floating_t)u->slave_index / u->max_slaves;
+					u->share_end = (floating_t)(u->slave_index + 1) / u->max_slaves;
+				}
 			} else if (!strcasecmp(optname, "shared_nodes") && optval) {
 				/* Share at most shared_nodes between master and slave at each genmoves.
 				 * Must use the same value in master and slaves. */
 				u->shared_nodes = atoi(optval);
 			} else if (!strcasecmp(optname, "shared_levels") && optval) {
-				/* Share only nodes of level <= shared_levels. */
+				/* Share only nodes of level <= shared_levels. With coord
+				 * paths (the default node_keys) at most 7 levels on
+				 * 19x19, 9 on 9x9: deeper levels are ignored. */
 				u->shared_levels = atoi(optval);
 			} else if (!strcasecmp(optname, "stats_hbits") && optval) {
 				/* Set hash table size to 2^stats_hbits for the shared stats. */
@@ -1440,23 +1509,19 @@ uct_state_init(char *arg, struct board *b)
 	if (u->want_pat && !pat_setup)
 		patterns_init(&u->pat, NULL, false, true);
 	dcnn_init();
+	if (u->dcnn_batch > 0 && using_dcnn(b))
+		u->dcnn_queue = dcnn_queue_init(u, u->dcnn_batch);
 	log_nthreads(u);
 
 	if (u->slave) {
 		if (!u->stats_hbits) u->stats_hbits = DEFAULT_STATS_HBITS;
 		if (!u->shared_nodes) u->shared_nodes = DEFAULT_SHARED_NODES;
-		assert(u->shared_levels * board_bits2(b) <= 8 * (int)sizeof(path_t));
 	}
 
 	if (!u->dynkomi)
 		u->dynkomi = board_small(b) ? uct_dynkomi_init_none(u, NULL, b)
 			: uct_dynkomi_init_linear(u, NULL, b);
 
-	if (u->pondering_opt && using_dcnn(b)) {
-		warning("Can't use pondering with dcnn right now, pondering turned off.\n");
-		u->pondering_opt = false;
-	}
-
 	/* Some things remain uninitialized for now - the opening tbook
 	 * is not loaded and the tree not set up. */
 	/* This will be initialized in setup_state() at the first move
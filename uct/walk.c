@@ -15,9 +15,11 @@
 #include "probdist.h"
 #include "random.h"
 #include "tactics/util.h"
+#include "uct/dcnn_queue.h"
 #include "uct/dynkomi.h"
 #include "uct/internal.h"
 #include "uct/search.h"
+#include "uct/slave.h"
 #include "uct/tree.h"
 #include "uct/uct.h"
 #include "uct/walk.h"
@@ -280,15 +282,38 @@ uct_playout_postpolicy(struct playout_policy *playout, struct playout_setup *set
 }
 
 
-static int
-uct_leaf_node(struct uct *u, struct board *b, enum stone player_color,
-              struct playout_amafmap *amaf,
-	      struct uct_descent *descent, int *dlen,
-	      struct tree_node *significant[2],
-              struct tree *t, struct tree_node *n, enum stone node_color,
-	      char *spaces)
+/* State of one tree walk + playout (see uct_playout()). */
+struct uct_walk {
+	struct board b2;
+	struct playout_amafmap amaf;
+	/* Tree descent history. */
+	/* XXX: This is somewhat messy since @n and descent[dlen-1].node are
+	 * redundant. */
+	struct uct_descent descent[DESCENT_DLEN];
+	int dlen;
+	/* The last "significant" node along the descent (i.e. node
+	 * with higher than configured number of playouts). For black
+	 * and white. */
+	struct tree_node *significant[2];
+	struct tree_node *n;
+	enum stone node_color;
+	bool valid;
+	int result;
+
+	struct uct_playout_callback upc;
+	struct playout_setup ps;
+	struct playout_game game;
+};
+
+/* debug */
+static char spaces[] = "\0                                                      ";
+/* /debug */
+
+static void
+uct_leaf_start(struct uct *u, enum stone player_color, struct tree *t, struct uct_walk *w)
 {
-	enum stone next_color = stone_other(node_color);
+	struct tree_node *n = w->n;
+	enum stone next_color = stone_other(w->node_color);
 	int parity = (next_color == player_color ? 1 : -1);
 
 	if (UDEBUGL(7))
@@ -296,7 +321,7 @@ uct_leaf_node(struct uct *u, struct board *b, enum stone player_color,
 			spaces, n->u.playouts, coord2sstr(node_coord(n), t->board),
 			tree_node_get_value(t, -parity, n->u.value));
 
-	struct uct_playout_callback upc = {
+	w->upc = (struct uct_playout_callback) {
 		.uct = u,
 		.tree = t,
 		/* TODO: Don't necessarily restart the sequence walk when
@@ -304,24 +329,33 @@ uct_leaf_node(struct uct *u, struct board *b, enum stone player_color,
 		.lnode = NULL,
 	};
 
-	struct playout_setup ps = {
+	w->ps = (struct playout_setup) {
 		.gamelen = u->gamelen,
 		.mercymin = u->mercymin,
+		.settle_moves = u->playout_settle,
+		.frozen = u->playout_freeze ? u->frozen : NULL,
 		.prepolicy_hook = uct_playout_prepolicy,
 		.postpolicy_hook = uct_playout_postpolicy,
-		.hook_data = &upc,
+		.hook_data = &w->upc,
 	};
-    //随机下棋的结果
-	int result = play_random_game(&ps, b, next_color,
-	                              u->playout_amaf ? amaf : NULL,
-				      &u->ownermap, u->playout);
+	playout_game_start(&w->game, &w->ps, &w->b2, next_color,
+			   u->playout_amaf ? &w->amaf : NULL,
+			   &u->ownermap, u->playout);
+}
+
+static int
+uct_leaf_result(struct uct *u, enum stone player_color, struct tree *t, struct uct_walk *w)
+{
+	enum stone next_color = stone_other(w->node_color);
+	//随机下棋的结果
+	int result = playout_game_result(&w->game);
 	if (next_color == S_WHITE) {
 		/* We need the result from black's perspective. */
 		result = - result;
 	}
 	if (UDEBUGL(7))
 		fprintf(stderr, "%s -- [%d..%d] %s random playout result %d\n",
-		        spaces, player_color, next_color, coord2sstr(node_coord(n), t->board), result);
+		        spaces, player_color, next_color, coord2sstr(node_coord(w->n), t->board), result);
 
 	return result;
 }
@@ -457,15 +491,17 @@ record_local_sequence(struct uct *u, struct tree *t, struct board *endb,
 
 //一次蒙特卡洛树搜索
 //先走到叶子节点，从叶子节点走到其他节点，从
-int
-uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree *t)
+/* Walk the tree down to a leaf and play the moves on w->b2. Returns
+ * false if the walk hit an invalid node (w->result is 0 then). */
+static bool
+uct_walk_descend(struct uct *u, struct board *b, enum stone player_color, struct tree *t, struct uct_walk *w)
 {
-	struct board b2;
+	struct board *b2 = &w->b2;
     //棋盘复制
-	board_copy(&b2, b);
+	board_copy(b2, b);
 
-	struct playout_amafmap amaf;
-	amaf.gamelen = amaf.game_baselen = 0;
+	struct playout_amafmap *amaf = &w->amaf;
+	amaf->gamelen = amaf->game_baselen = 0;
 
 	/* Walk the tree until we find a leaf, then expand it and do
 	 * a random playout. */
@@ -482,32 +518,23 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		tree_expand_node(t, n, b, player_color, u, 1);
 	
 	/* Tree descent history.下降历史 */
-	/* XXX: This is somewhat messy since @n and descent[dlen-1].node are
-	 * redundant. */
-    /*XXX：这有点乱，因为@n和下降[dlen-1]，节点是多余的。*/
-	struct uct_descent descent[DESCENT_DLEN];//512
+	struct uct_descent *descent = w->descent;//512
 	descent[0].node = n; descent[0].lnode = NULL;
 	int dlen = 1;//初始值为１
 	/* Total value of the sequence. */
     /*序列的总值*/
 	struct move_stats seq_value = { .playouts = 0 };
-	/* The last "significant" node along the descent (i.e. node
-	 * with higher than configured number of playouts). For black
-	 * and white. */
     /*沿下降的最后一个“重要”节点（即展开次数高于配置的播放次数的节点）。黑色和白色。*/
-	struct tree_node *significant[2] = { NULL, NULL };//保存重要节点
+	struct tree_node **significant = w->significant;//保存重要节点
+	significant[0] = significant[1] = NULL;
 	if (n->u.playouts >= u->significant_threshold) //第一个是这个节点被玩的次数，有效阈值初始化为50
 		significant[node_color - 1] = n;//保存重要节点
 
-	int result;
     //棋盘边界
-	int pass_limit = (board_size(&b2) - 2) * (board_size(&b2) - 2) / 2;
+	int pass_limit = (board_size(b2) - 2) * (board_size(b2) - 2) / 2;
     //判断是否为第一个节点？？待解释
 	int passes = is_pass(b->last_move.coord) && b->moves > 0;
 
-	/* debug */
-	static char spaces[] = "\0                                                      ";
-	/* /debug */
 	if (UDEBUGL(8))
 		fprintf(stderr, "--- (#%d) UCT walk with color %d\n", t->root->u.playouts, player_color);
 
@@ -541,10 +568,10 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
         //字节写的随机数程序
 		if (!u->random_policy_chance || fast_random(u->random_policy_chance))
             //选择我们选择策略选出的下沉策略，下沉方式就是接单权值的计算方法，然后存储到ｄｅｓｃｅｎｔ数组中去
-			u->policy->descend(u->policy, t, &descent[dlen], parity, b2.moves > pass_limit);
+			u->policy->descend(u->policy, t, &descent[dlen], parity, b2->moves > pass_limit);
 		else
             //使用随机策略，而不是主策略
-			u->random_policy->descend(u->random_policy, t, &descent[dlen], parity, b2.moves > pass_limit);
+			u->random_policy->descend(u->random_policy, t, &descent[dlen], parity, b2->moves > pass_limit);
 
 
 		/*** Perform the descent: */
@@ -568,25 +595,28 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 			__sync_fetch_and_add(&n->descents, u->virtual_loss);
 
 		struct move m = { node_coord(n), node_color };
-		int res = board_play(&b2, &m);
+		int res = board_play(b2, &m);
 
-		if (res < 0 || (!is_pass(m.coord) && !group_at(&b2, m.coord)) /* suicide */
-		    || b2.superko_violation) {
+		if (res < 0 || (!is_pass(m.coord) && !group_at(b2, m.coord)) /* suicide */
+		    || b2->superko_violation) {
 			if (UDEBUGL(4)) {
 				for (struct tree_node *ni = n; ni; ni = ni->parent)
 					fprintf(stderr, "%s<%"PRIhash"> ", coord2sstr(node_coord(ni), t->board), ni->hash);
 				fprintf(stderr, "marking invalid %s node %d,%d res %d group %d spk %d\n",
 				        stone2str(node_color), coord_x(node_coord(n),b), coord_y(node_coord(n),b),
-					res, group_at(&b2, m.coord), b2.superko_violation);
+					res, group_at(b2, m.coord), b2->superko_violation);
 			}
 			n->hints |= TREE_HINT_INVALID;
-			result = 0;
-			goto end;
+			w->n = n; w->dlen = dlen;
+			w->node_color = node_color;
+			w->valid = false;
+			w->result = 0;
+			return false;
 		}
 
 		assert(node_coord(n) >= -1);
         //下沉策略分为２种一种是ucb1 一种是ucb_amaf
-		record_amaf_move(&amaf, node_coord(n), board_playing_ko_threat(&b2));
+		record_amaf_move(amaf, node_coord(n), board_playing_ko_threat(b2));
 
 		if (is_pass(node_coord(n)))
 			passes++;
@@ -606,15 +636,38 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		if (tree_leaf_node(n)
 		    && n->u.playouts - u->virtual_loss >= u->expand_p && t->nodes_size < u->max_tree_size
 		    && !__sync_lock_test_and_set(&n->is_expanded, 1))
-			tree_expand_node(t, n, &b2, next_color, u, -parity);
+			tree_expand_node(t, n, b2, next_color, u, -parity);
+
+		/* Get dcnn priors for the children once the node
+		 * proves interesting enough. */
+		if (u->dcnn_queue && !tree_leaf_node(n)
+		    && n->u.playouts >= u->dcnn_expand_p && !(n->hints & TREE_HINT_DCNN)
+		    && !(__sync_fetch_and_or(&n->hints, TREE_HINT_DCNN) & TREE_HINT_DCNN))
+			dcnn_queue_submit(u->dcnn_queue, t, n, b2, next_color, -parity);
 	}
 
-	amaf.game_baselen = amaf.gamelen;
+	amaf->game_baselen = amaf->gamelen;
 
 	if (t->use_extra_komi && u->dynkomi->persim) {
-		b2.komi += round(u->dynkomi->persim(u->dynkomi, &b2, t, n));
+		b2->komi += round(u->dynkomi->persim(u->dynkomi, b2, t, n));
 	}
 
+	w->n = n; w->dlen = dlen;
+	w->node_color = node_color;
+	w->valid = true;
+	return true;
+}
+
+/* Record the playout result in the tree. */
+static void
+uct_walk_update(struct uct *u, struct board *b, enum stone player_color, struct tree *t, struct uct_walk *w)
+{
+	struct playout_amafmap *amaf = &w->amaf;
+	struct uct_descent *descent = w->descent;
+	struct tree_node *n = w->n;
+	int dlen = w->dlen;
+	int result = w->result;
+
 	/* !!! !!! !!!
 	 * ALERT: The "result" number is extremely confusing. In some parts
 	 * of the code, it is from white's perspective, but here positive
@@ -622,25 +675,24 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 	 * !!! !!! !!! */
     /*警告：“结果”数字非常混乱。在代码的某些部分，它是从白色的角度看的，但这里正数是黑色的胜利！小心点。*/
 
-	// assert(tree_leaf_node(n));
-	/* In case of parallel tree search, the assertion might
-	 * not hold if two threads chew on the same node. */
-    /*在并行树搜索的情况下，如果两个线程咀嚼同一个节点，则断言可能不成立。*/
-    /*获取结果　模拟*/
-	result = uct_leaf_node(u, &b2, player_color, &amaf, descent, &dlen, significant, t, n, node_color, spaces);
-
 	if (u->policy->wants_amaf && u->playout_amaf_cutoff) {
-		unsigned int cutoff = amaf.game_baselen;
-		cutoff += (amaf.gamelen - amaf.game_baselen) * u->playout_amaf_cutoff / 100;
-		amaf.gamelen = cutoff;
+		unsigned int cutoff = amaf->game_baselen;
+		cutoff += (amaf->gamelen - amaf->game_baselen) * u->playout_amaf_cutoff / 100;
+		amaf->gamelen = cutoff;
 	}
 
 	/* Record the result. */
     /*记录结果*/
 	assert(n == t->root || n->parent);
-	floating_t rval = scale_value(u, b, node_color, significant, result);
+	floating_t rval = scale_value(u, b, w->node_color, w->significant, result);
     /*更新权值*/
-	u->policy->update(u->policy, t, n, node_color, player_color, &amaf, &b2, rval);
+	u->policy->update(u->policy, t, n, w->node_color, player_color, amaf, &w->b2, rval);
+
+	/* Slave of the distributed engine: remember which shared
+	 * nodes have new stats to report. */
+	if (u->slave && u->dirty_levels)
+		for (int di = 1; di < dlen && di <= u->dirty_levels; di++)
+			uct_dirty_add(descent[di].node);
 
 	stats_add_result(&t->avg_score, (float)result / 2, 1);
 	if (t->use_extra_komi) {
@@ -660,42 +712,65 @@ uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree
 		enum stone seq_color = player_color;
 		/* First move always starts a sequence. */
         /*第一步总是开始一个序列。*/
-		record_local_sequence(u, t, &b2, descent, dlen, 1, seq_color);
+		record_local_sequence(u, t, &w->b2, descent, dlen, 1, seq_color);
 		seq_color = stone_other(seq_color);
 		for (int dseqi = 2; dseqi < dlen; dseqi++, seq_color = stone_other(seq_color)) {
 			if (u->local_tree_allseq) {
 				/* We are configured to record all subsequences. */
                 /*我们被配置为记录所有子序列。*/
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, &w->b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 			if (descent[dseqi].node->d >= u->tenuki_d) {
 				/* Tenuki! Record the fresh sequence. */
                 /*Tenuki！记录新序列。*/
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, &w->b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 			if (descent[dseqi].lnode && !descent[dseqi].lnode) {
 				/* Record result for in-descent picked sequence. */
                 /*记录下降选择序列中的结果。*/
-				record_local_sequence(u, t, &b2, descent, dlen, dseqi, seq_color);
+				record_local_sequence(u, t, &w->b2, descent, dlen, dseqi, seq_color);
 				continue;
 			}
 		}
 	}
+}
 
-end:
+static void
+uct_walk_end(struct uct *u, struct uct_walk *w)
+{
 	/* We need to undo the virtual loss we added during descend. */
     /*我们需要撤销在下降过程中添加的虚拟损失。*/
 	if (u->virtual_loss) {
-		for (; n->parent; n = n->parent) {
+		for (struct tree_node *n = w->n; n->parent; n = n->parent) {
 			__sync_fetch_and_sub(&n->descents, u->virtual_loss);
 		}
 	}
 
-	board_done_noalloc(&b2);
-	return result;
+	board_done_noalloc(&w->b2);
+}
+
+//一次蒙特卡洛树搜索
+//先走到叶子节点，从叶子节点走到其他节点，从
+int
+uct_playout(struct uct *u, struct board *b, enum stone player_color, struct tree *t)
+{
+	struct uct_walk w;
+	if (uct_walk_descend(u, b, player_color, t, &w)) {
+		/* In case of parallel tree search, the assertion might
+		 * not hold if two threads chew on the same node. */
+		// assert(tree_leaf_node(w.n));
+		/*获取结果　模拟*/
+		uct_leaf_start(u, player_color, t, &w);
+		while (playout_game_step(&w.game));
+		w.result = uct_leaf_result(u, player_color, t, &w);
+		uct_walk_update(u, b, player_color, t, &w);
+	}
+	uct_walk_end(u, &w);
+	return w.result;
 }
+
 //玩多次
 int
 uct_playouts(struct uct *u, struct board *b, enum stone color, struct tree *t, struct time_info *ti)